@@ -0,0 +1,169 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <VMUtils/ref.hpp>
+#include <VMat/geometry.h>
+#include <VMCoreExtension/i3dblockfileplugininterface.h>
+#include <lvdblockstats.hpp>
+#include <lvdvoxeltype.hpp>
+
+namespace vm
+{
+/**
+ * @brief How the batched page requests are read
+ */
+enum LVDPageIOMode
+{
+	LVD_PAGE_IO_MMAP = 0,		   // copied out of the file mapping by the workers
+	LVD_PAGE_IO_PREAD = 1,		   // read with pread/preadv, not through the mapping
+	LVD_PAGE_IO_URING = 2,		   // read with io_uring into registered buffers, Linux only
+	LVD_PAGE_IO_URING_DIRECT = 3  // io_uring with O_DIRECT, bypasses the page cache
+};
+
+/**
+ * @brief A page to read into \a buffer, which holds a block of voxels of the GetVoxelType() of the level
+ */
+struct LVDPageRequest
+{
+	size_t pageID = 0;
+	int lod = 0;
+	void *buffer = nullptr;
+	bool ok = false;  // set on completion
+};
+
+/**
+ * @brief LVD-specific extension of the block file plugin interface.
+ *
+ * The renderer only sees plugins through the plugin loader, so it queries this interface
+ * (dynamic_cast) on the plugin it gets for ".lvd" to use the features plain
+ * I3DBlockFilePluginInterface has no room for.
+ *
+ * Open also takes the ".lvds" manifest of a sharded LVD, the pages are then read from and written to
+ * the shard holding them, and the ".lvdt" manifest of a time series, whose pages are read from the
+ * current timestep.
+ */
+class ILVDFilePluginInterface : public I3DBlockFilePluginInterface
+{
+public:
+	using I3DBlockFilePluginInterface::GetPage;
+
+	/**
+	 * @brief Opens one LVD file per level. \a fileNames[i] is the level i.
+	 */
+	virtual void OpenLODs( const std::vector<std::string> &fileNames ) = 0;
+
+	virtual int GetLODCount() const = 0;
+
+	/**
+	 * @brief The level served by the I3DBlockFilePluginInterface part, 0 unless this is a view from GetLODView
+	 */
+	virtual int GetLOD() const = 0;
+
+	virtual const void *GetPage( size_t pageID, int lod ) = 0;
+
+	/**
+	 * @brief Returns a block file interface of the level \a lod. It shares the opened file
+	 * and its mapping with this plugin, so it is cheap and could be used as the data source of a Block3DCache.
+	 */
+	virtual Ref<I3DBlockFilePluginInterface> GetLODView( int lod ) = 0;
+
+	/**
+	 * @brief The type of the voxels of \a lod. A page holds GetPageSize()^3 voxels of it, I3DBlockFilePluginInterface
+	 * users that assume 8-bit voxels only handle LVD_VOXEL_UINT8 levels.
+	 */
+	virtual LVDVoxelType GetVoxelType( int lod ) const = 0;
+
+	/**
+	 * @brief Returns the stats of the page without reading the page, or nullptr if they are unknown.
+	 * The pointer is valid as long as the file is opened.
+	 */
+	virtual const LVDBlockStats *GetPageStats( size_t pageID, int lod ) = 0;
+
+	/**
+	 * @brief Returns the lowest page holding the same voxels as \a pageID as far as the file tells, so pages
+	 * with the same instance could share one slot of a cache: the pages stored once in a LVD_FLAG_DEDUP level,
+	 * and all the absent pages. Returns \a pageID for a writable file.
+	 */
+	virtual size_t GetPageInstance( size_t pageID, int lod ) = 0;
+
+	/**
+	 * @brief Makes the following Open/OpenLODs map the files read-only with random access advice,
+	 * which is what the render path wants. Write fails on such a file.
+	 */
+	virtual void SetReadOnly( bool readOnly ) = 0;
+
+	/**
+	 * @brief Starts reading the pages in the background, so a later GetPage of them does not stall on page faults
+	 */
+	virtual void Prefetch( const std::vector<size_t> &pageIDs, int lod ) = 0;
+
+	/**
+	 * @brief Drops the pages from memory, they are read again by the next GetPage
+	 */
+	virtual void Evict( const std::vector<size_t> &pageIDs, int lod ) = 0;
+
+	/**
+	 * @brief Reads the pages of a read-only file with O_DIRECT, so the page cache does not keep a second
+	 * copy of the pages held by the cache of the application. Applies to the opened file and the next
+	 * Open/OpenLODs, call SetReadOnly( true ) first.
+	 */
+	virtual void SetDirectIO( bool enable ) = 0;
+
+	/**
+	 * @brief Returns true if the pages are actually read with O_DIRECT, which needs a read-only file on
+	 * a file system supporting it
+	 */
+	virtual bool GetDirectIO() const = 0;
+
+	/**
+	 * @brief Selects the backend of SubmitPages and the number of requests in flight, that is the worker
+	 * threads or the depth of the io_uring. Pending requests must be collected first.
+	 *
+	 * An io_uring mode falls back to LVD_PAGE_IO_MMAP if the kernel does not support it.
+	 */
+	virtual void SetPageIOMode( LVDPageIOMode mode, int threadCount ) = 0;
+
+	/**
+	 * @brief Returns the backend in use after the fallback
+	 */
+	virtual LVDPageIOMode GetPageIOMode() const = 0;
+
+	/**
+	 * @brief Queues the requests and returns immediately. The buffers must stay valid until the requests
+	 * are returned by CollectPages.
+	 */
+	virtual void SubmitPages( const std::vector<LVDPageRequest> &requests ) = 0;
+
+	/**
+	 * @brief Appends the completed requests to \a completed and returns how many. Blocks until at least
+	 * \a minCount are completed or no request is pending, so 0 never blocks.
+	 */
+	virtual size_t CollectPages( std::vector<LVDPageRequest> &completed, size_t minCount ) = 0;
+
+	/**
+	 * @brief Reads the voxels of \a bound (max exclusive, without the padding) of the level \a lod into \a dst,
+	 * x fastest. Rows and slices of \a dst are \a rowStride and \a sliceStride bytes apart, 0 means tightly
+	 * packed. Only the pages covering the region are read. Returns false if \a bound is not inside the data.
+	 */
+	virtual bool ReadRegion( const Bound3i &bound, int lod, void *dst, size_t rowStride, size_t sliceStride ) = 0;
+
+	/**
+	 * @brief The number of timesteps of a series, 1 for other files
+	 */
+	virtual int GetTimestepCount() const = 0;
+
+	virtual int GetTimestep() const = 0;
+
+	/**
+	 * @brief Makes the pages of every level, and of every view of the file, read from \a timestep.
+	 * Returns false if there is no such timestep.
+	 */
+	virtual bool SetTimestep( int timestep ) = 0;
+
+	/**
+	 * @brief Returns the pages of \a lod that may differ between the timesteps \a from and \a to, a cache
+	 * holding the pages of \a from only reloads these for \a to
+	 */
+	virtual std::vector<size_t> GetChangedPages( int from, int to, int lod ) = 0;
+};
+}  // namespace vm
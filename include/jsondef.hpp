@@ -10,3 +10,30 @@ struct LVDJSONStruct : vm::json::Serializable<LVDJSONStruct>
 	VM_JSON_FIELD( float, samplingRate );
 	VM_JSON_FIELD( std::vector<float>, spacing );
 };
+
+/**
+ * The manifest of a sharded LVD, see LVDShardedFile
+ */
+struct LVDShardManifest : vm::json::Serializable<LVDShardManifest>
+{
+	VM_JSON_FIELD( std::vector<std::string>, shards );	// relative to the manifest
+	VM_JSON_FIELD( std::string, striping );				// "round-robin" or "morton-range"
+};
+
+/**
+ * The manifest of a time series of LVDs, see LVDSeriesFile
+ */
+struct LVDSeriesManifest : vm::json::Serializable<LVDSeriesManifest>
+{
+	VM_JSON_FIELD( std::vector<std::string>, timesteps );  // relative to the manifest
+	VM_JSON_FIELD( std::vector<int>, keyframes );		  // the keyframe timestep of each timestep
+};
+
+/**
+ * The sidecar "<raw>.json" of a raw volume opened without conversion, see RawFilePlugin
+ */
+struct RawJSONStruct : vm::json::Serializable<RawJSONStruct>
+{
+	VM_JSON_FIELD( std::vector<int>, dataSize );
+	VM_JSON_FIELD( std::string, type );	 // "uint8", "uint16" or "float"
+};
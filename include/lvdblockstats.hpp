@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+
+namespace vm
+{
+enum
+{
+	LVD_STATS_HISTOGRAM_BINS = 16
+};
+
+/**
+ * @brief Summary of the voxels of a block (padding included), stored in the metadata section of a LVD level.
+ *
+ * It is enough to decide whether a block is invisible under a transfer function without reading the block.
+ */
+struct LVDBlockStats
+{
+	float min;
+	float max;
+	float mean;
+	uint32_t valid;	 // 0 if the block has never been written
+	// fraction of the voxels in each of the equal bins over the value range of the voxel type, in 1/65535
+	uint16_t histogram[ LVD_STATS_HISTOGRAM_BINS ];
+};
+}  // namespace vm
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace vm
+{
+/**
+ * @brief Type of the voxels of a LVD level, stored in the header of v2 levels. v1 levels are always 8-bit.
+ *
+ * Integer voxels are normalized by the GPU (GL_R8/GL_R16), float voxels (GL_R32F) are used as they
+ * are, so they are expected in [0, 1] like the domain of the transfer function.
+ */
+enum LVDVoxelType : uint32_t
+{
+	LVD_VOXEL_UINT8 = 0,
+	LVD_VOXEL_UINT16 = 1,
+	LVD_VOXEL_FLOAT32 = 2
+};
+
+inline size_t LVDVoxelBytes( LVDVoxelType type )
+{
+	switch ( type ) {
+	case LVD_VOXEL_UINT16: return 2;
+	case LVD_VOXEL_FLOAT32: return 4;
+	default: return 1;
+	}
+}
+}  // namespace vm
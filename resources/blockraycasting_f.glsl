@@ -36,6 +36,7 @@ layout(location = 9) uniform mat4 ModelMatrix;
 layout(location = 10) uniform mat4 ViewMatrix;
 layout(location = 11) uniform vec3 viewPos;
 layout(location = 12) uniform int LODCount;
+layout(location = 13) uniform uint Epoch;  // of the pass, a hash table entry equal to it is a block already reported
 
 vec2 vSize = vec2( 1024, 768 );
 float aspectRatio = vSize.x / vSize.y;
@@ -55,6 +56,10 @@ layout( std430, binding = 2 ) buffer PageTable
 {
 	uvec4 pageEntry[];
 }pageTable;
+layout( std430, binding = 4 ) buffer RequestStats
+{
+	uvec2 stat[];  // the rays that missed each block, and the complement of the bits of the nearest distance they saw
+}requestStats;
 
 struct LODInfo
 {
@@ -221,12 +226,16 @@ vec4 virtualVolumeSample( vec3 samplePos, inout int curLod, out bool mapped, out
 	{
 		// search coarser lod
 		uint hashTableOffset = lodInfoBuffer.lod[ curLod ].hashBufferOffset;
-		if ( atomicCompSwap( hashTable.blockId[ hashTableOffset + entryFlatIndex ], 0, 1 ) == 0 ) {
+		// every ray reports the miss, the blocks missed by many near rays are uploaded first
+		atomicAdd( requestStats.stat[ hashTableOffset + entryFlatIndex ].x, 1 );
+		atomicMax( requestStats.stat[ hashTableOffset + entryFlatIndex ].y, ~floatBitsToUint( EvalDistanceFromViewToBlockCenterCoord( samplePos, curLod ) ) );
+		// the entries of the earlier passes hold older epochs, so the table is not cleared between passes
+		uint stamp = hashTable.blockId[ hashTableOffset + entryFlatIndex ];
+		if ( stamp != Epoch && atomicCompSwap( hashTable.blockId[ hashTableOffset + entryFlatIndex ], stamp, Epoch ) == stamp ) {
 			uint index = atomicCounterIncrement( atomic_count[ curLod ] );
 
 			uint idBufferOffset = lodInfoBuffer.lod[ curLod ].idBufferOffset;
 			missedBlock.blockId[ idBufferOffset + index ] = entryFlatIndex;
-			hashTable.blockId[ hashTableOffset + entryFlatIndex ] = 1;  // exits
 		}
 		mapped = false;
 	} else {
@@ -1,8 +1,13 @@
 // std related
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <iostream>
 #include <fstream>
 #include <memory>
 #include <random>
+#include <tuple>
+#include <unordered_map>
 
 // GL-related
 
@@ -22,6 +27,7 @@
 
 #include <GLImpl.hpp>
 #include <jsondef.hpp>
+#include <ilvdfileplugininterface.hpp>
 using namespace vm;
 using namespace std;
 
@@ -37,6 +43,50 @@ namespace
 Bound3f bound( { 0, 0, 0 }, { 1, 1, 1 } );
 Point3f CubeVertices[ 8 ];
 Point3f CubeTexCoords[ 8 ];
+/**
+ * @brief Backend of the batched page reads of LVD levels, -1 (the default) reads the pages one by one through
+ * the host cache. The batched backends read into the staging ring and bypass it, so it is not allocated for them.
+ */
+int PageIOMode = -1;
+int PageIOThreads = 16;
+bool DirectIO = false;	// reads .lvd levels with O_DIRECT
+int TimestepInterval = 0;  // ms between the timesteps of a .lvdt series, 0 stays on the first one
+size_t StagingRingMB = 64;	// of the page upload staging ring
+/**
+ * @brief The budget of the refinement passes of a frame, 0 refines until every ray is finished. A frame
+ * over budget presents the unfinished rays and the next one continues them, unless RaysOutdated.
+ */
+int RefineBudgetMs = 0;
+int RefinePassesPerFrame = 0;
+size_t RefinePagesPerFrame = 0;
+bool RaysOutdated = true;  // the camera, the transfer function or the data changed since the rays were generated
+int RayGeneration = 0;	   // counts the times the rays were generated
+
+/**
+ * @brief The number of sets of feedback buffers the ray casting passes alternate between, see HelperFeedbackBuffers
+ */
+constexpr int FeedbackBufferCount = 2;
+
+/**
+ * @brief The texture format of the cache textures and the pixel type of the page uploads for a voxel type
+ */
+GLenum GLVoxelInternalFormat( LVDVoxelType type )
+{
+	switch ( type ) {
+	case LVD_VOXEL_UINT16: return GL_R16;
+	case LVD_VOXEL_FLOAT32: return GL_R32F;
+	default: return GL_R8;
+	}
+}
+
+GLenum GLVoxelUploadType( LVDVoxelType type )
+{
+	switch ( type ) {
+	case LVD_VOXEL_UINT16: return GL_UNSIGNED_SHORT;
+	case LVD_VOXEL_FLOAT32: return GL_FLOAT;
+	default: return GL_UNSIGNED_BYTE;
+	}
+}
 
 
 using DeviceMemoryEvalutor = std::function<Vector4i( const Vector3i & )>;
@@ -103,16 +153,14 @@ public:
 // 	IDBufferLength(il){}
 // };
 
-struct HelperGPUObjectSet
+/**
+ * \brief The buffers a ray casting pass reports the blocks it missed in.
+ *
+ * The passes alternate between FeedbackBufferCount sets of them, so the CPU reads the misses of a pass
+ * while the GPU runs the next one instead of draining the pipeline after every pass.
+ */
+struct HelperFeedbackBuffers
 {
-	/**
-		 * @brief Stores the GPU-end volume data.
-		 * 
-		 * The size of a single texture unit is limited. Several textures units are necessary
-		 * so as to make fully use of the GPU memory
-		 */
-	vector<GL::GLTexture> GLVolumeTexture;
-
 	/**
 		 * \brief Stores the atomic counters for every lod data
 		 *
@@ -122,7 +170,6 @@ struct HelperGPUObjectSet
 		 */
 	GL::GLBuffer GLAtomicCounterBuffer;
 	uint32_t *AtomicCounterBufferPersistentMappedPointer = nullptr;
-	size_t AtomicCounterBufferBytes = 0;
 	/**
 		 * \brief Stores the hash table for every lod data.
 		 *
@@ -131,7 +178,6 @@ struct HelperGPUObjectSet
 		 */
 	GL::GLBuffer GLHashBuffer;
 	uint32_t *HashBufferPersistentMappedPointer = nullptr;
-	size_t HashBufferBytes = 0;
 	/**
 		 * \brief Stores the missed block id for every lod data
 		 *
@@ -140,7 +186,34 @@ struct HelperGPUObjectSet
 		 */
 	GL::GLBuffer GLBlockIDBuffer;
 	uint32_t *BlockIDBufferPersistentMappedPointer = nullptr;
-	size_t BlockIDBufferBytes = 0;
+	/**
+		 * \brief Stores the number of rays that missed each block and the nearest distance they saw.
+		 *
+		 * Laid out like the hash buffer with two uint32 per block, see RequestStats in blockraycasting_f.glsl.
+		 * Only the entries of the missed blocks are written, they are cleared once they are read.
+		 */
+	GL::GLBuffer GLRequestStatsBuffer;
+	uint32_t *RequestStatsBufferPersistentMappedPointer = nullptr;
+	GLsync Fence = nullptr;	 // after the pass reporting into the buffers
+	int Generation = 0;		 // of the rays cast by the pass, see RayGeneration
+	/**
+		 * \brief The epoch of the last pass reporting into the buffers. A pass stamps the hash table entries of
+		 * the blocks it reports with its epoch instead of setting them, so the table is only cleared when the
+		 * epoch wraps around.
+		 */
+	uint32_t Epoch = 0;
+};
+
+struct HelperGPUObjectSet
+{
+	/**
+		 * @brief Stores the GPU-end volume data.
+		 * 
+		 * The size of a single texture unit is limited. Several textures units are necessary
+		 * so as to make fully use of the GPU memory
+		 */
+	vector<GL::GLTexture> GLVolumeTexture;
+
 	/**
 		 * \brief Stores the page table for every lod data
 		 *
@@ -148,7 +221,6 @@ struct HelperGPUObjectSet
 		 * and the second section of the page table buffer for the second LOD, etc.
 		 */
 	GL::GLBuffer GLPageTableBuffer;
-	uint32_t *PageTableBufferPersistentMappedPointer = nullptr;
 	size_t PageTableBufferBytes = 0;
 	/**
 		 * \brief Stores all the lod information.
@@ -158,6 +230,35 @@ struct HelperGPUObjectSet
 	GL::GLBuffer GLLODInfoBuffer;
 	uint32_t *LODInfoBufferPersistentMappedPointer = nullptr;
 	size_t LODInfoBufferBytes = 0;
+	/**
+		 * \brief The feedback buffers of the ray casting passes, a pass reports into the set after the one of
+		 * the previous pass. PendingFeedback holds the sets of the passes whose misses were not read yet.
+		 */
+	HelperFeedbackBuffers Feedback[ FeedbackBufferCount ];
+	deque<int> PendingFeedback;
+	int NextFeedback = 0;
+	size_t AtomicCounterBufferBytes = 0;  // of one set
+	size_t HashBufferBytes = 0;
+	size_t BlockIDBufferBytes = 0;
+	size_t RequestStatsBufferBytes = 0;
+	/**
+		 * \brief The staging ring of the page uploads, one page per slot.
+		 *
+		 * The pages are read into the slots, by the page reading threads for LVD levels, and uploaded to the
+		 * volume textures from the buffer, so the copy to the GPU does not stall the render thread. The slots
+		 * are handed out in order and a fence after the uploads of each run of slots guards them until the
+		 * GPU has read them.
+		 */
+	GL::GLBuffer GLStagingBuffer;
+	unsigned char *StagingBufferPersistentMappedPointer = nullptr;
+	size_t StagingBufferBytes = 0;
+	size_t StagingSlotBytes = 0;
+	size_t StagingSlotCount = 0;
+	size_t StagingRunSlots = 0;		   // a third of the ring
+	size_t StagingSlotsAcquired = 0;   // the next slot is StagingSlotsAcquired % StagingSlotCount
+	size_t StagingSlotsFenced = 0;	   // the slots acquired before it are guarded by a fence
+	size_t StagingSlotsReleased = 0;   // the slots acquired before it are free
+	deque<pair<GLsync, size_t>> StagingFences;	// with the StagingSlotsFenced they guard
 };
 
 struct HelperCPUObjectSet
@@ -175,6 +276,76 @@ struct HelperCPUObjectSet
 		 * Each Ref<Block3DCache> is coressponding to one of a LOD of volume data.
 		 */
 	vector<Ref<Block3DCache>> VolumeData;
+
+	/**
+	 * @brief The LVD interface of each LOD, used for the paging hints. Null if the level is not a LVD file.
+	 */
+	vector<ILVDFilePluginInterface *> LVDLevels;
+
+	/**
+	 * @brief Voxel type shared by all the levels, it is always 8-bit if the levels are not LVD files.
+	 * Block3DCache only holds 8-bit pages, the pages of wider voxels are read from the LVD levels directly.
+	 */
+	LVDVoxelType VoxelType = LVD_VOXEL_UINT8;
+
+	/**
+	 * @brief The missed pages of a LVD level are read into the staging ring, one slot per request
+	 */
+	vector<LVDPageRequest> PageRequests;
+
+	/**
+	 * @brief A page table entry pointing to the cache slot of another page with the same voxels
+	 * (see ILVDFilePluginInterface::GetPageInstance), with the entry it had before
+	 */
+	struct PageAlias
+	{
+		int lod;
+		size_t blockID;
+		MappingTableManager::PageTableEntry saved;
+	};
+
+	/**
+	 * @brief The aliases of each cache slot. The MappingTableManager does not know them, so they are
+	 * restored once it gives the slot to another page.
+	 */
+	unordered_map<uint64_t, vector<PageAlias>> PageAliases;
+
+	/**
+	 * @brief The slot of each page instance in the cache by LOD, and the LOD, instance and uploaded page of each slot
+	 */
+	vector<unordered_map<size_t, uint64_t>> InstanceSlots;
+	unordered_map<uint64_t, tuple<int, size_t, size_t>> SlotInstances;
+
+	/**
+	 * @brief The pages missed by a pass over all the levels, uploaded in the order of their priority.
+	 * \a index is the position of the page among the missed pages of its level.
+	 */
+	struct MissedPage
+	{
+		float priority;
+		int lod;
+		size_t index;
+	};
+	vector<MissedPage> MissedPages;
+
+	/**
+	 * @brief The number of pages the volume textures hold, a pass uploads no more
+	 */
+	size_t CachePageCount = 0;
+
+	/**
+	 * @brief The page table the MappingTableManager writes, PageTableEntry by PageTableEntry. A pass may
+	 * still run with the old entries, so they are copied to the GPU by glCall_FlushPageTable, in the order
+	 * of the GL commands.
+	 */
+	vector<uint32_t> PageTable;
+	vector<size_t> DirtyPageTableEntries;
+
+	/**
+	 * @brief The LOD and the page the MappingTableManager mapped to each cache slot, it unmaps the page
+	 * when it gives the slot to another one
+	 */
+	unordered_map<uint64_t, pair<int, size_t>> SlotPages;
 };
 
 struct HelperObjectSet
@@ -189,6 +360,7 @@ struct HelperObjectSet
 
 constexpr GLbitfield mapping_flags = GL_MAP_WRITE_BIT | GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
 constexpr GLbitfield storage_flags = GL_DYNAMIC_STORAGE_BIT | mapping_flags;
+constexpr GLbitfield staging_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
 
 unsigned int CubeVertexIndices[] = {
 	0, 2, 1, 1, 2, 3,
@@ -314,6 +486,7 @@ void glCall_UpdateTransferFunctionTexture( GL::GLTexture &texture,
 			GL_EXPR( glTextureSubImage1D( texture, 0, 0, dimension, GL_RGBA, GL_FLOAT, data.get() ) );
 		}
 	}
+	RaysOutdated = true;
 }
 
 void glCall_CameraUniformUpdate( ViewingTransform &camera,
@@ -321,6 +494,7 @@ void glCall_CameraUniformUpdate( ViewingTransform &camera,
 								 GL::GLProgram &positionGenerateProgram,
 								 GL::GLProgram &outofcoreProgram )
 {
+	RaysOutdated = true;
 	// camera
 	const auto mvpTransform = camera.GetPerspectiveMatrix() * camera.GetViewMatrixWrapper().LookAt();
 	const auto viewTransform = camera.GetViewMatrixWrapper().LookAt();
@@ -354,23 +528,86 @@ void *glCall_MapBufferRangeHelperFunc( GL::GLBuffer &buffer, GLenum target, size
 	return mappedPointer;
 }
 
+/**
+ * @brief Opens every level of the volume data listed in \a fileNames.
+ * 
+ * If the plugin implements ILVDFilePluginInterface, one plugin (and one file mapping) serves all
+ * the levels, otherwise each level is opened by its own plugin.
+ */
+vector<Ref<I3DBlockFilePluginInterface>> OpenVolumeLevels( const vector<string> &fileNames,
+														   PluginLoader &pluginLoader )
+{
+	vector<Ref<I3DBlockFilePluginInterface>> levels;
+	if ( fileNames.empty() )
+		return levels;
+	const auto cap = fileNames[ 0 ].substr( fileNames[ 0 ].find_last_of( '.' ) );
+	bool sameFormat = true;
+	for ( const auto &each : fileNames ) {
+		sameFormat = sameFormat && each.substr( each.find_last_of( '.' ) ) == cap;
+	}
+	// the levels of a sharded LVD or a series are separate manifests, each is opened by its own plugin
+	if ( sameFormat && ( fileNames.size() == 1 || ( cap != ".lvds" && cap != ".lvdt" ) ) ) {
+		auto p = pluginLoader.CreatePlugin<I3DBlockFilePluginInterface>( cap );
+		auto lvd = dynamic_cast<ILVDFilePluginInterface *>( p.Get() );
+		if ( lvd ) {
+			lvd->SetReadOnly( true );
+			lvd->SetDirectIO( DirectIO );
+			if ( fileNames.size() == 1 )
+				lvd->Open( fileNames[ 0 ] );
+			else
+				lvd->OpenLODs( fileNames );
+			for ( int i = 0; i < lvd->GetLODCount(); i++ ) {
+				levels.push_back( lvd->GetLODView( i ) );
+			}
+			return levels;
+		}
+	}
+
+	for ( int i = 0; i < fileNames.size(); i++ ) {
+		const auto cap = fileNames[ i ].substr( fileNames[ i ].find_last_of( '.' ) );
+		auto p = pluginLoader.CreatePlugin<I3DBlockFilePluginInterface>( cap );
+		if ( !p ) {
+			println( "Failed to load plugin to read {} file", cap );
+			exit( -1 );
+		}
+		if ( auto lvd = dynamic_cast<ILVDFilePluginInterface *>( p.Get() ) ) {
+			lvd->SetReadOnly( true );
+			lvd->SetDirectIO( DirectIO );
+		}
+		p->Open( fileNames[ i ] );
+		levels.push_back( p );
+	}
+	return levels;
+}
+
+/**
+ * @brief Whether the pages of a level skip its Block3DCache: the batched backends read them into the staging ring,
+ * and the cache only serves 8-bit levels of a single timestep
+ */
+bool BypassesHostCache( ILVDFilePluginInterface *lvd )
+{
+	return lvd && ( PageIOMode >= 0 || lvd->GetVoxelType( lvd->GetLOD() ) != LVD_VOXEL_UINT8 || lvd->GetTimestepCount() > 1 );
+}
+
 vector<Ref<Block3DCache>> SetupVolumeData(
   const vector<string> &fileNames,
   PluginLoader &pluginLoader,
-  size_t availableHostMemoryHint )
+  size_t availableHostMemoryHint,
+  vector<ILVDFilePluginInterface *> &lvdLevels )
 {
 	try {
-		const auto lodCount = fileNames.size();
+		const auto levels = OpenVolumeLevels( fileNames, pluginLoader );
+		const auto lodCount = levels.size();
 		vector<Ref<Block3DCache>> volumeData( lodCount );
+		lvdLevels.assign( lodCount, nullptr );
 		for ( int i = 0; i < lodCount; i++ ) {
-			const auto cap = fileNames[ i ].substr( fileNames[ i ].find_last_of( '.' ) );
-			auto p = pluginLoader.CreatePlugin<I3DBlockFilePluginInterface>( cap );
-			if ( !p ) {
-				println( "Failed to load plugin to read {} file", cap );
-				exit( -1 );
-			}
-			p->Open( fileNames[ i ] );
-			volumeData[ i ] = VM_NEW<Block3DCache>( p, [&availableHostMemoryHint]( I3DBlockDataInterface *p ) {
+			// the Block3DCache keeps the level alive
+			lvdLevels[ i ] = dynamic_cast<ILVDFilePluginInterface *>( levels[ i ].Get() );
+			const auto lvd = lvdLevels[ i ];
+			volumeData[ i ] = VM_NEW<Block3DCache>( levels[ i ], [&availableHostMemoryHint, lvd]( I3DBlockDataInterface *p ) {
+				if ( BypassesHostCache( lvd ) ) {
+					return Size3{ 1, 1, 1 };  // the pages are not read through the cache
+				}
 				// this a
 				const auto bytes = p->GetDataSizeWithoutPadding().Prod();
 				size_t th = 2 * 1024 * 1024 * size_t( 1024 );  // 2GB as default
@@ -399,11 +636,27 @@ HelperCPUObjectSet CreateHelperCPUObjectSet( const vector<string> &fileNames,
 											 size_t availableHostMemoryHint )
 {
 	HelperCPUObjectSet set;
-	set.VolumeData = SetupVolumeData( fileNames, pluginLoader, availableHostMemoryHint );
+	set.VolumeData = SetupVolumeData( fileNames, pluginLoader, availableHostMemoryHint, set.LVDLevels );
 	auto &cpuVolumeData = set.VolumeData;
 	if ( cpuVolumeData.size() == 0 ) {
 		return set;
 	}
+	set.InstanceSlots.resize( cpuVolumeData.size() );
+	if ( set.LVDLevels[ 0 ] ) {
+		set.VoxelType = set.LVDLevels[ 0 ]->GetVoxelType( set.LVDLevels[ 0 ]->GetLOD() );
+	}
+	for ( const auto lvd : set.LVDLevels ) {
+		if ( ( lvd ? lvd->GetVoxelType( lvd->GetLOD() ) : LVD_VOXEL_UINT8 ) != set.VoxelType ) {
+			println( "All levels must have the same voxel type" );
+			exit( -1 );
+		}
+		if ( lvd && PageIOMode >= 0 ) {
+			lvd->SetPageIOMode( LVDPageIOMode( PageIOMode ), PageIOThreads );
+			if ( lvd->GetPageIOMode() != PageIOMode ) {
+				println( "Page IO: io_uring is not supported, falling back to mmap" );
+			}
+		}
+	}
 
 	size_t pageTableTotalEntries = 0;
 	size_t hashBufferTotalBlocks = 0;
@@ -429,24 +682,33 @@ HelperCPUObjectSet CreateHelperCPUObjectSet( const vector<string> &fileNames,
 	return set;
 }
 
+void glCall_BindFeedbackBuffers( HelperFeedbackBuffers &feedback )
+{
+	assert( feedback.GLAtomicCounterBuffer.Valid() );
+	assert( feedback.GLBlockIDBuffer.Valid() );
+	assert( feedback.GLHashBuffer.Valid() );
+	assert( feedback.GLRequestStatsBuffer.Valid() );
+
+	GL_EXPR( glBindBufferBase( GL_ATOMIC_COUNTER_BUFFER, 3, feedback.GLAtomicCounterBuffer ) );
+
+	GL_EXPR( glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, feedback.GLBlockIDBuffer ) );
+
+	GL_EXPR( glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, feedback.GLHashBuffer ) );
+
+	GL_EXPR( glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 4, feedback.GLRequestStatsBuffer ) );
+}
+
 void glCall_ResourcesBinding( HelperObjectSet &set, GL::GLProgram &outofcoreProgram )
 {
 	assert( set.GPUSet.GLPageTableBuffer.Valid() );
-	assert( set.GPUSet.GLAtomicCounterBuffer.Valid() );
-	assert( set.GPUSet.GLBlockIDBuffer.Valid() );
-	assert( set.GPUSet.GLHashBuffer.Valid() );
 	assert( set.GPUSet.GLLODInfoBuffer.Valid() );
 
 	GL_EXPR( glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 2, set.GPUSet.GLPageTableBuffer ) );
 
-	GL_EXPR( glBindBufferBase( GL_ATOMIC_COUNTER_BUFFER, 3, set.GPUSet.GLAtomicCounterBuffer ) );
-
-	GL_EXPR( glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, set.GPUSet.GLBlockIDBuffer ) );
-
-	GL_EXPR( glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, set.GPUSet.GLHashBuffer ) );
-
 	GL_EXPR( glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 3, set.GPUSet.GLLODInfoBuffer ) );
 
+	glCall_BindFeedbackBuffers( set.GPUSet.Feedback[ set.GPUSet.NextFeedback ] );
+
 	assert( set.GPUSet.LODInfoBufferBytes == set.CPUSet.VolumeData.size() * sizeof( _std140_layout_LODInfo ) );
 	GL_EXPR( glNamedBufferSubData( set.GPUSet.GLLODInfoBuffer, 0, set.GPUSet.LODInfoBufferBytes, set.CPUSet.LODInfoCPUBuffer.data() ) );
 
@@ -459,17 +721,30 @@ void glCall_ResourcesBinding( HelperObjectSet &set, GL::GLProgram &outofcoreProg
 	GL_EXPR( glProgramUniform1i( outofcoreProgram, 12, set.CPUSet.VolumeData.size() ) );
 }
 
+void glCall_ClearFeedbackBuffers( HelperObjectSet &set, HelperFeedbackBuffers &feedback )
+{
+	// Clear Atomic counter as 0, the hash table is outdated by the epoch of the next pass
+	memset( feedback.AtomicCounterBufferPersistentMappedPointer, 0, set.GPUSet.AtomicCounterBufferBytes );
+}
+
+void glCall_ClearHashBuffer( HelperObjectSet &set, HelperFeedbackBuffers &feedback )
+{
+	memset( feedback.HashBufferPersistentMappedPointer, 0, set.GPUSet.HashBufferBytes );
+	feedback.Epoch = 0;
+}
+
 void glCall_ClearObjectSet( HelperObjectSet &set )
 {
-	// Clear Atomic counter as 0
-	memset( set.GPUSet.AtomicCounterBufferPersistentMappedPointer, 0, set.GPUSet.AtomicCounterBufferBytes );
-	memset( set.GPUSet.HashBufferPersistentMappedPointer, 0, set.GPUSet.HashBufferBytes );
+	for ( auto &feedback : set.GPUSet.Feedback ) {
+		glCall_ClearFeedbackBuffers( set, feedback );
+		glCall_ClearHashBuffer( set, feedback );
+	}
 }
 
 HelperObjectSet glCall_SetupResources( GL &gl, const std::string &fileName,
 									   PluginLoader &pluginLoader,
 									   size_t availableHostMemoryHint,
-									   std::function<Vec4i( const Vec3i &blockSize )> deviceMemoryEvaluator )
+									   std::function<Vec4i( const Vec3i &blockSize, size_t voxelBytes )> deviceMemoryEvaluator )
 {
 	LVDJSONStruct lvdJSON;
 	std::ifstream json( fileName );
@@ -478,6 +753,7 @@ HelperObjectSet glCall_SetupResources( GL &gl, const std::string &fileName,
 	//vector<string> testFileNames{"/home/ysl/data/s1.brv"};
 
 	HelperObjectSet set;
+	RaysOutdated = true;
 	set.CPUSet = CreateHelperCPUObjectSet( lvdJSON.fileNames, pluginLoader, availableHostMemoryHint * 1024 * 1024 );
 	if ( set.CPUSet.VolumeData.size() == 0 ) {
 		println( "No Volume Data" );
@@ -489,7 +765,8 @@ HelperObjectSet glCall_SetupResources( GL &gl, const std::string &fileName,
 	//availableDeviceMemoryHint * 1024*1024);
 
 	//const auto textureSize = evaluator->EvalPhysicalTextureSize();
-	auto deviceMemoryHint = deviceMemoryEvaluator( Vec3i( set.CPUSet.VolumeData[ 0 ]->BlockSize() ) );
+	const auto voxelBytes = LVDVoxelBytes( set.CPUSet.VoxelType );
+	auto deviceMemoryHint = deviceMemoryEvaluator( Vec3i( set.CPUSet.VolumeData[ 0 ]->BlockSize() ), voxelBytes );
 	const auto textureCount = deviceMemoryHint.w;
 	const auto textureBlockDim = Size3( Vec3i( deviceMemoryHint ) );
 
@@ -507,35 +784,38 @@ HelperObjectSet glCall_SetupResources( GL &gl, const std::string &fileName,
 		idBufferTotalBlocks += blocks;	  // *sizeof(uint32_t);
 	}
 
-	/// [1] Create Page Table Buffer and binding
-	set.GPUSet.GLPageTableBuffer = gl.CreateBuffer();
+	/// [1] Create Page Table, the GPU copy is created once the MappingTableManager initialized it
 	const size_t pageTableBufferBytes = pageTableTotalEntries * sizeof( MappingTableManager::PageTableEntry );
-	GL_EXPR( glNamedBufferStorage( set.GPUSet.GLPageTableBuffer, pageTableBufferBytes, nullptr, storage_flags ) );
-	set.GPUSet.PageTableBufferPersistentMappedPointer = (uint32_t *)glCall_MapBufferRangeHelperFunc( set.GPUSet.GLPageTableBuffer, GL_ARRAY_BUFFER, 0, pageTableBufferBytes, mapping_flags );
+	set.CPUSet.PageTable.assign( pageTableBufferBytes / sizeof( uint32_t ), 0 );
 	set.GPUSet.PageTableBufferBytes = pageTableBufferBytes;
 
-	/// [2] Create Atomic Buffer and bingding
+	/// [2] - [4] Create the feedback buffers: atomic counters, ID buffer, hash buffer and request stats buffer
 	const size_t atomicBufferBytes = lodCount * sizeof( uint32_t );
-	set.GPUSet.GLAtomicCounterBuffer = gl.CreateBuffer();
-	vector<uint32_t> zero( lodCount, 0 );
-	GL_EXPR( glNamedBufferStorage( set.GPUSet.GLAtomicCounterBuffer, atomicBufferBytes, nullptr, storage_flags ) );
-	set.GPUSet.AtomicCounterBufferPersistentMappedPointer = (uint32_t *)glCall_MapBufferRangeHelperFunc( set.GPUSet.GLAtomicCounterBuffer, GL_ATOMIC_COUNTER_BUFFER, 0, atomicBufferBytes, mapping_flags );
-	set.GPUSet.AtomicCounterBufferBytes = atomicBufferBytes;
-
-	///[3] Create ID Buffer and binding
 	const auto idBufferBytes = idBufferTotalBlocks * sizeof( uint32_t );
-	set.GPUSet.GLBlockIDBuffer = gl.CreateBuffer();
-	GL_EXPR( glNamedBufferStorage( set.GPUSet.GLBlockIDBuffer, idBufferBytes, nullptr, storage_flags ) );
-	set.GPUSet.BlockIDBufferPersistentMappedPointer = (uint32_t *)glCall_MapBufferRangeHelperFunc( set.GPUSet.GLBlockIDBuffer, GL_SHADER_STORAGE_BUFFER, 0, idBufferBytes, mapping_flags );
-	set.GPUSet.BlockIDBufferBytes = idBufferBytes;
-
-	///[4] Create Hash Buffer and binding
-	//vector<uint32_t> emptyBuffer( hashBufferTotalBlocks, 0 );
-	set.GPUSet.GLHashBuffer = gl.CreateBuffer();
 	const auto hashBufferBytes = hashBufferTotalBlocks * sizeof( uint32_t );
-	GL_EXPR( glNamedBufferStorage( set.GPUSet.GLHashBuffer, hashBufferBytes, nullptr, storage_flags ) );
-	set.GPUSet.HashBufferPersistentMappedPointer = (uint32_t *)glCall_MapBufferRangeHelperFunc( set.GPUSet.GLHashBuffer, GL_SHADER_STORAGE_BUFFER, 0, hashBufferBytes, mapping_flags );
+	const auto requestStatsBytes = hashBufferTotalBlocks * 2 * sizeof( uint32_t );	// zeroed once and then only where the missed blocks were reported
+	set.GPUSet.AtomicCounterBufferBytes = atomicBufferBytes;
+	set.GPUSet.BlockIDBufferBytes = idBufferBytes;
 	set.GPUSet.HashBufferBytes = hashBufferBytes;
+	set.GPUSet.RequestStatsBufferBytes = requestStatsBytes;
+	for ( auto &feedback : set.GPUSet.Feedback ) {
+		feedback.GLAtomicCounterBuffer = gl.CreateBuffer();
+		GL_EXPR( glNamedBufferStorage( feedback.GLAtomicCounterBuffer, atomicBufferBytes, nullptr, storage_flags ) );
+		feedback.AtomicCounterBufferPersistentMappedPointer = (uint32_t *)glCall_MapBufferRangeHelperFunc( feedback.GLAtomicCounterBuffer, GL_ATOMIC_COUNTER_BUFFER, 0, atomicBufferBytes, mapping_flags );
+
+		feedback.GLBlockIDBuffer = gl.CreateBuffer();
+		GL_EXPR( glNamedBufferStorage( feedback.GLBlockIDBuffer, idBufferBytes, nullptr, storage_flags ) );
+		feedback.BlockIDBufferPersistentMappedPointer = (uint32_t *)glCall_MapBufferRangeHelperFunc( feedback.GLBlockIDBuffer, GL_SHADER_STORAGE_BUFFER, 0, idBufferBytes, mapping_flags );
+
+		feedback.GLHashBuffer = gl.CreateBuffer();
+		GL_EXPR( glNamedBufferStorage( feedback.GLHashBuffer, hashBufferBytes, nullptr, storage_flags ) );
+		feedback.HashBufferPersistentMappedPointer = (uint32_t *)glCall_MapBufferRangeHelperFunc( feedback.GLHashBuffer, GL_SHADER_STORAGE_BUFFER, 0, hashBufferBytes, mapping_flags );
+
+		feedback.GLRequestStatsBuffer = gl.CreateBuffer();
+		GL_EXPR( glNamedBufferStorage( feedback.GLRequestStatsBuffer, requestStatsBytes, nullptr, storage_flags ) );
+		feedback.RequestStatsBufferPersistentMappedPointer = (uint32_t *)glCall_MapBufferRangeHelperFunc( feedback.GLRequestStatsBuffer, GL_SHADER_STORAGE_BUFFER, 0, requestStatsBytes, mapping_flags );
+		memset( feedback.RequestStatsBufferPersistentMappedPointer, 0, requestStatsBytes );
+	}
 
 	///[5] Create LOD Info Buffer and binding
 	const auto &lodInfo = set.CPUSet.LODInfoCPUBuffer;
@@ -548,7 +828,7 @@ HelperObjectSet glCall_SetupResources( GL &gl, const std::string &fileName,
 	auto &volumeDataTexture = set.GPUSet.GLVolumeTexture;
 	for ( int i = 0; i < textureCount; i++ ) {
 		auto texture = gl.CreateTexture( GL_TEXTURE_3D );
-		GL_EXPR( glTextureStorage3D( texture, 1, GL_R8, textureSize.x, textureSize.y, textureSize.z ) );
+		GL_EXPR( glTextureStorage3D( texture, 1, GLVoxelInternalFormat( set.CPUSet.VoxelType ), textureSize.x, textureSize.y, textureSize.z ) );
 		volumeDataTexture.push_back( std::move( texture ) );
 	}
 
@@ -560,7 +840,7 @@ HelperObjectSet glCall_SetupResources( GL &gl, const std::string &fileName,
 		info.offset = set.CPUSet.LODInfoCPUBuffer[ i ].pageTableOffset;
 		pageTableInfos.push_back( info );
 	}
-	const auto pageTablePtr = set.GPUSet.PageTableBufferPersistentMappedPointer;
+	const auto pageTablePtr = set.CPUSet.PageTable.data();
 	for ( int i = 0; i < lodCount; i++ ) {
 		pageTableInfos[ i ].external = (MappingTableManager::PageTableEntry *)pageTablePtr + pageTableInfos[ i ].offset;
 	}
@@ -568,64 +848,563 @@ HelperObjectSet glCall_SetupResources( GL &gl, const std::string &fileName,
 	set.MappingManager = make_shared<MappingTableManager>( pageTableInfos,	// Create Mapping table for lods
 														   textureBlockDim,
 														   textureCount );
+	set.GPUSet.GLPageTableBuffer = gl.CreateBuffer();
+	GL_EXPR( glNamedBufferStorage( set.GPUSet.GLPageTableBuffer, pageTableBufferBytes, pageTablePtr, GL_DYNAMIC_STORAGE_BIT ) );
+	set.CPUSet.CachePageCount = textureBlockDim.Prod() * textureCount;
 
-	const size_t volumeTextureMemoryUsage = textureSize.Prod() * textureCount;
+	// [8] Create the staging ring of the page uploads, at least three runs of one slot
+	size_t pageBytes = 0;
+	for ( int i = 0; i < lodCount; i++ ) {
+		pageBytes = ( std::max )( pageBytes, size_t( cpuVolumeData[ i ]->BlockSize().Prod() ) * voxelBytes );
+	}
+	set.GPUSet.StagingSlotBytes = pageBytes;
+	set.GPUSet.StagingSlotCount = ( std::max )( size_t( 3 ), StagingRingMB * 1024 * 1024 / pageBytes );
+	set.GPUSet.StagingRunSlots = set.GPUSet.StagingSlotCount / 3;
+	set.GPUSet.StagingBufferBytes = set.GPUSet.StagingSlotCount * pageBytes;
+	set.GPUSet.GLStagingBuffer = gl.CreateBuffer();
+	GL_EXPR( glNamedBufferStorage( set.GPUSet.GLStagingBuffer, set.GPUSet.StagingBufferBytes, nullptr, staging_flags ) );
+	set.GPUSet.StagingBufferPersistentMappedPointer = (unsigned char *)glCall_MapBufferRangeHelperFunc( set.GPUSet.GLStagingBuffer, GL_PIXEL_UNPACK_BUFFER, 0, set.GPUSet.StagingBufferBytes, staging_flags );
+
+	const size_t volumeTextureMemoryUsage = textureSize.Prod() * textureCount * voxelBytes;
 	//PrintVideoMemoryUsageInfo(std::cout,set,volumeTextureMemoryUsage);
 	PrintVideoMemoryUsageInfo( std::cout, set, volumeTextureMemoryUsage );
 
 	return set;
 }
+/**
+ * @brief Returns the page \a blockID of \a lod, read through the cache if it holds the voxel type.
+ * The cache would keep the pages of a series from the timestep they were read in, they are read directly.
+ */
+const void *ReadPage( HelperObjectSet &set, int lod, size_t blockID, const VirtualMemoryBlockIndex &index )
+{
+	const auto lvd = set.CPUSet.LVDLevels.empty() ? nullptr : set.CPUSet.LVDLevels[ lod ];
+	if ( lvd && ( set.CPUSet.VoxelType != LVD_VOXEL_UINT8 || lvd->GetTimestepCount() > 1 ) ) {
+		return lvd->GetPage( blockID, lvd->GetLOD() );
+	}
+	return set.CPUSet.VolumeData[ lod ]->GetPage( index );
+}
+
+MappingTableManager::PageTableEntry *PageTableEntryOf( HelperObjectSet &set, int lod, size_t blockID )
+{
+	return (MappingTableManager::PageTableEntry *)set.CPUSet.PageTable.data() + set.CPUSet.LODInfoCPUBuffer[ lod ].pageTableOffset + blockID;
+}
+
+/**
+ * @brief Marks the page table entry of \a blockID to be copied to the GPU by the next glCall_FlushPageTable
+ */
+void MarkPageTableEntry( HelperObjectSet &set, int lod, size_t blockID )
+{
+	set.CPUSet.DirtyPageTableEntries.push_back( set.CPUSet.LODInfoCPUBuffer[ lod ].pageTableOffset + blockID );
+}
+
+void SetPageTableEntry( HelperObjectSet &set, int lod, size_t blockID, const MappingTableManager::PageTableEntry &entry )
+{
+	*PageTableEntryOf( set, lod, blockID ) = entry;
+	MarkPageTableEntry( set, lod, blockID );
+}
+
+/**
+ * @brief Copies the marked page table entries to the GPU, a run of adjacent entries at a time. The copy
+ * follows the passes issued before, which still read the old entries.
+ */
+void glCall_FlushPageTable( HelperObjectSet &set )
+{
+	auto &dirty = set.CPUSet.DirtyPageTableEntries;
+	std::sort( dirty.begin(), dirty.end() );
+	dirty.erase( std::unique( dirty.begin(), dirty.end() ), dirty.end() );
+	const auto entries = (const MappingTableManager::PageTableEntry *)set.CPUSet.PageTable.data();
+	constexpr auto entryBytes = sizeof( MappingTableManager::PageTableEntry );
+	for ( size_t i = 0; i < dirty.size(); ) {
+		size_t end = i + 1;
+		while ( end < dirty.size() && dirty[ end ] == dirty[ end - 1 ] + 1 ) {
+			end++;
+		}
+		GL_EXPR( glNamedBufferSubData( set.GPUSet.GLPageTableBuffer, dirty[ i ] * entryBytes, ( end - i ) * entryBytes, entries + dirty[ i ] ) );
+		i = end;
+	}
+	dirty.clear();
+}
+
+uint64_t CacheSlotKey( const PhysicalMemoryBlockIndex &index )
+{
+	const auto p = index.ToVec3i();
+	return ( uint64_t( index.GetPhysicalStorageUnit() ) << 48 ) | ( uint64_t( p.z ) << 32 ) | ( uint64_t( p.y ) << 16 ) | uint64_t( p.x );
+}
+
+/**
+ * @brief Returns the next slot of the staging ring, after waiting for the GPU to finish reading it
+ */
+size_t glCall_AcquireStagingSlot( HelperObjectSet &set )
+{
+	auto &gpuSet = set.GPUSet;
+	while ( gpuSet.StagingSlotsAcquired - gpuSet.StagingSlotsReleased >= gpuSet.StagingSlotCount ) {
+		assert( gpuSet.StagingFences.empty() == false );  // at most two runs are not fenced
+		const auto fence = gpuSet.StagingFences.front();
+		gpuSet.StagingFences.pop_front();
+		GLenum status = GL_TIMEOUT_EXPIRED;
+		while ( status == GL_TIMEOUT_EXPIRED ) {
+			GL_EXPR( status = glClientWaitSync( fence.first, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000 ) );
+		}
+		GL_EXPR( glDeleteSync( fence.first ) );
+		gpuSet.StagingSlotsReleased = fence.second;
+	}
+	return gpuSet.StagingSlotsAcquired++ % gpuSet.StagingSlotCount;
+}
+
+/**
+ * @brief Fences the uploads issued so far, which must include the ones from the slots acquired before the
+ * \a acquired th. They are free again once the GPU passed the fence.
+ */
+void glCall_FenceStagingSlots( HelperObjectSet &set, size_t acquired )
+{
+	auto &gpuSet = set.GPUSet;
+	if ( acquired <= gpuSet.StagingSlotsFenced ) {
+		return;
+	}
+	GLsync fence = nullptr;
+	GL_EXPR( fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 ) );
+	gpuSet.StagingFences.emplace_back( fence, acquired );
+	gpuSet.StagingSlotsFenced = acquired;
+}
+
+unsigned char *StagingSlotPointer( HelperObjectSet &set, size_t slot )
+{
+	return set.GPUSet.StagingBufferPersistentMappedPointer + slot * set.GPUSet.StagingSlotBytes;
+}
+
+/**
+ * @brief Uploads the page in \a slot of the staging ring to \a posInCache of the texture \a unit.
+ * The staging buffer must be bound to GL_PIXEL_UNPACK_BUFFER.
+ */
+void glCall_UploadStagedPage( HelperObjectSet &set, size_t slot, int unit, const Vec3i &posInCache, const Size3 &blockSize )
+{
+	const auto texHandle = set.GPUSet.GLVolumeTexture[ unit ].GetGLHandle();
+	const auto offset = (const void *)( slot * set.GPUSet.StagingSlotBytes );
+	GL_EXPR( glTextureSubImage3D( texHandle, 0, posInCache.x, posInCache.y, posInCache.z, blockSize.x, blockSize.y, blockSize.z, GL_RED, GLVoxelUploadType( set.CPUSet.VoxelType ), offset ) );
+}
+
+/**
+ * @brief Copies a page read on the render thread into the staging ring and uploads it from there, see
+ * glCall_UploadStagedPage. Fence the last run with glCall_FenceStagingSlots when the pages are uploaded.
+ */
+void glCall_UploadPage( HelperObjectSet &set, const void *page, int unit, const Vec3i &posInCache, const Size3 &blockSize )
+{
+	const auto slot = glCall_AcquireStagingSlot( set );
+	memcpy( StagingSlotPointer( set, slot ), page, blockSize.Prod() * LVDVoxelBytes( set.CPUSet.VoxelType ) );
+	glCall_UploadStagedPage( set, slot, unit, posInCache, blockSize );
+	if ( set.GPUSet.StagingSlotsAcquired % set.GPUSet.StagingRunSlots == 0 ) {
+		glCall_FenceStagingSlots( set, set.GPUSet.StagingSlotsAcquired );
+	}
+}
+
+/**
+ * @brief Points the page table entry of \a blockID to \a slot, which holds a page with the same voxels
+ */
+void AliasCacheSlot( HelperObjectSet &set, int lod, size_t blockID, uint64_t slot )
+{
+	const auto &holder = set.CPUSet.SlotInstances.at( slot );
+	set.CPUSet.PageAliases[ slot ].push_back( { lod, blockID, *PageTableEntryOf( set, lod, blockID ) } );
+	SetPageTableEntry( set, lod, blockID, *PageTableEntryOf( set, get<0>( holder ), get<2>( holder ) ) );
+}
+
+/**
+ * @brief Forgets the instance held by \a slot and restores the entries of its aliases, they are requested again
+ */
+void ReleaseCacheSlot( HelperObjectSet &set, uint64_t slot )
+{
+	auto &cpuSet = set.CPUSet;
+	const auto aliases = cpuSet.PageAliases.find( slot );
+	if ( aliases != cpuSet.PageAliases.end() ) {
+		for ( const auto &alias : aliases->second ) {
+			SetPageTableEntry( set, alias.lod, alias.blockID, alias.saved );
+		}
+		cpuSet.PageAliases.erase( aliases );
+	}
+	const auto holder = cpuSet.SlotInstances.find( slot );
+	if ( holder != cpuSet.SlotInstances.end() ) {
+		cpuSet.InstanceSlots[ get<0>( holder->second ) ].erase( get<1>( holder->second ) );
+		cpuSet.SlotInstances.erase( holder );
+	}
+}
+
+/**
+ * @brief Maps the missed pages whose instance is in the cache to its slot and keeps one missed page per
+ * instance in \a blockIDs, with its instance in \a instances. The other missed pages of an instance are
+ * returned in \a pending with the page kept for it.
+ */
+void ShareCachedInstances( HelperObjectSet &set, int lod, vector<uint32_t> &blockIDs, vector<size_t> &instances, vector<pair<uint32_t, uint32_t>> &pending )
+{
+	const auto lvd = set.CPUSet.LVDLevels[ lod ];
+	const auto &slots = set.CPUSet.InstanceSlots[ lod ];
+	unordered_map<size_t, uint32_t> kept;
+	instances.clear();
+	pending.clear();
+	for ( const auto id : blockIDs ) {
+		const auto instance = lvd->GetPageInstance( id, lvd->GetLOD() );
+		const auto slot = slots.find( instance );
+		if ( slot != slots.end() ) {
+			AliasCacheSlot( set, lod, id, slot->second );
+			continue;
+		}
+		const auto first = kept.emplace( instance, id );
+		if ( first.second ) {
+			blockIDs[ instances.size() ] = id;
+			instances.push_back( instance );
+		} else {
+			pending.emplace_back( id, first.first->second );
+		}
+	}
+	blockIDs.resize( instances.size() );
+}
+
+/**
+ * @brief Records the slots given to the pages of ShareCachedInstances and maps the pending pages to them
+ */
+void ShareUploadedInstances( HelperObjectSet &set, int lod, const vector<uint32_t> &blockIDs, const vector<size_t> &instances,
+							 const vector<PhysicalMemoryBlockIndex> &physicalSpaceAddress, const vector<pair<uint32_t, uint32_t>> &pending )
+{
+	unordered_map<uint32_t, uint64_t> slotOf;
+	for ( int i = 0; i < physicalSpaceAddress.size(); i++ ) {
+		const auto slot = CacheSlotKey( physicalSpaceAddress[ i ] );
+		set.CPUSet.InstanceSlots[ lod ][ instances[ i ] ] = slot;
+		set.CPUSet.SlotInstances[ slot ] = make_tuple( lod, instances[ i ], size_t( blockIDs[ i ] ) );
+		slotOf[ blockIDs[ i ] ] = slot;
+	}
+	for ( const auto &p : pending ) {
+		// pages whose instance got no slot are requested again
+		const auto slot = slotOf.find( p.second );
+		if ( slot != slotOf.end() ) {
+			AliasCacheSlot( set, lod, p.first, slot->second );
+		}
+	}
+}
+
+/**
+ * @brief Returns false if the page table entry of \a blockID is unmapped, otherwise its cache slot in \a slot
+ */
+bool MappedCacheSlot( HelperObjectSet &set, int lod, size_t blockID, uint64_t &slot )
+{
+	const auto entry = (const uint32_t *)PageTableEntryOf( set, lod, blockID );  // the uvec4 of blockraycasting_f.glsl
+	if ( ( entry[ 3 ] & 0xf ) == 2 ) {											  // the unmapped flag
+		return false;
+	}
+	slot = ( uint64_t( ( entry[ 3 ] >> 4 ) & 0xf ) << 48 ) | ( uint64_t( entry[ 2 ] ) << 32 ) | ( uint64_t( entry[ 1 ] ) << 16 ) | uint64_t( entry[ 0 ] );
+	return true;
+}
+
+/**
+ * @brief Uploads the pages among \a blockIDs that are in the cache again, in place. The others are read
+ * when they are missed.
+ */
+void glCall_RefreshCachedPages( HelperObjectSet &set, int lod, const vector<size_t> &blockIDs )
+{
+	const auto lvd = set.CPUSet.LVDLevels[ lod ];
+	const auto blockSize = set.CPUSet.VolumeData[ lod ]->BlockSize();
+	const auto dim = set.CPUSet.VolumeData[ lod ]->BlockDim();
+	vector<pair<size_t, uint64_t>> cached;
+	for ( const auto id : blockIDs ) {
+		uint64_t slot = 0;
+		if ( MappedCacheSlot( set, lod, id, slot ) == false ) {
+			continue;
+		}
+		const auto holder = set.CPUSet.SlotInstances.find( slot );
+		if ( holder != set.CPUSet.SlotInstances.end() && ( get<0>( holder->second ) != lod || get<2>( holder->second ) != id ) ) {
+			// an alias of the page in the slot, it is unmapped and requested again
+			auto &aliases = set.CPUSet.PageAliases[ slot ];
+			for ( auto it = aliases.begin(); it != aliases.end(); ++it ) {
+				if ( it->lod == lod && it->blockID == id ) {
+					SetPageTableEntry( set, lod, id, it->saved );
+					aliases.erase( it );
+					break;
+				}
+			}
+			continue;
+		}
+		ReleaseCacheSlot( set, slot );	// the aliases of the page do not hold its new voxels
+		cached.emplace_back( id, slot );
+	}
+	vector<size_t> pages;
+	for ( const auto &each : cached ) {
+		pages.push_back( each.first );
+	}
+	lvd->Prefetch( pages, lvd->GetLOD() );
+	GL_EXPR( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, set.GPUSet.GLStagingBuffer ) );
+	for ( const auto &each : cached ) {
+		const auto slot = each.second;
+		const auto posInCache = Vec3i( blockSize ) * Vec3i( int( slot & 0xffff ), int( ( slot >> 16 ) & 0xffff ), int( ( slot >> 32 ) & 0xffff ) );
+		const auto d = ReadPage( set, lod, each.first, VirtualMemoryBlockIndex( each.first, dim.x, dim.y, dim.z ) );
+		glCall_UploadPage( set, d, int( slot >> 48 ), posInCache, blockSize );
+	}
+	glCall_FenceStagingSlots( set, set.GPUSet.StagingSlotsAcquired );
+	GL_EXPR( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 ) );
+}
+
+/**
+ * @brief Moves the levels to the next timestep of their series and refreshes the cached pages that changed,
+ * so playing a series back uploads as much as the data changes
+ */
+void glCall_AdvanceTimestep( HelperObjectSet &set )
+{
+	const auto &lvdLevels = set.CPUSet.LVDLevels;
+	if ( lvdLevels.empty() || lvdLevels[ 0 ] == nullptr || lvdLevels[ 0 ]->GetTimestepCount() <= 1 ) {
+		return;
+	}
+	const int from = lvdLevels[ 0 ]->GetTimestep();
+	const int to = ( from + 1 ) % lvdLevels[ 0 ]->GetTimestepCount();
+	// the views of one file share the timestep, the levels opened separately are set one by one
+	for ( const auto lvd : lvdLevels ) {
+		if ( lvd == nullptr || lvd->SetTimestep( to ) == false ) {
+			println( "The levels of the series have different timesteps" );
+			return;
+		}
+	}
+	RaysOutdated = true;
+	for ( int lod = 0; lod < lvdLevels.size(); lod++ ) {
+		glCall_RefreshCachedPages( set, lod, lvdLevels[ lod ]->GetChangedPages( from, to, lvdLevels[ lod ]->GetLOD() ) );
+	}
+	glCall_FlushPageTable( set );
+}
+
+/**
+ * @brief Reads the pages of \a descs (linear ids in \a blockIDs) into the staging ring on the page reading
+ * threads and uploads each one as soon as it is read. The ring is filled a run of slots at a time, the
+ * threads read the next run while the current one is uploaded and the GPU copies the previous one.
+ */
+void glCall_UploadPagesAsync( HelperObjectSet &set, int lod, const vector<uint32_t> &blockIDs, const vector<BlockDescriptor> &descs )
+{
+	const auto lvd = set.CPUSet.LVDLevels[ lod ];
+	const auto blockSize = set.CPUSet.VolumeData[ lod ]->BlockSize();
+	auto &gpuSet = set.GPUSet;
+	auto &requests = set.CPUSet.PageRequests;
+	const auto run = gpuSet.StagingRunSlots;
+	const auto runCount = ( descs.size() + run - 1 ) / run;
+	vector<size_t> descOfSlot( gpuSet.StagingSlotCount );
+	vector<size_t> left( runCount ), runEnd( runCount );  // the pages of each run not uploaded yet, the slots acquired by then
+	size_t submittedRuns = 0, fencedRuns = 0;
+	const auto submitRun = [ & ]() {
+		requests.clear();
+		for ( auto i = submittedRuns * run; i < descs.size() && requests.size() < run; i++ ) {
+			const auto slot = glCall_AcquireStagingSlot( set );
+			descOfSlot[ slot ] = i;
+			LVDPageRequest request;
+			request.pageID = blockIDs[ i ];
+			request.lod = lvd->GetLOD();
+			request.buffer = StagingSlotPointer( set, slot );
+			requests.push_back( request );
+		}
+		left[ submittedRuns ] = requests.size();
+		runEnd[ submittedRuns++ ] = gpuSet.StagingSlotsAcquired;
+		lvd->SubmitPages( requests );
+	};
+
+	GL_EXPR( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, gpuSet.GLStagingBuffer ) );
+	vector<LVDPageRequest> completed;
+	while ( fencedRuns < runCount ) {
+		while ( submittedRuns < runCount && submittedRuns - fencedRuns < 2 ) {
+			submitRun();
+		}
+		completed.clear();
+		if ( lvd->CollectPages( completed, 1 ) == 0 ) {
+			break;
+		}
+		for ( const auto &r : completed ) {
+			const auto slot = ( (unsigned char *)r.buffer - gpuSet.StagingBufferPersistentMappedPointer ) / gpuSet.StagingSlotBytes;
+			const auto i = descOfSlot[ slot ];
+			if ( r.ok == false ) {	// fall back to the synchronous read
+				memcpy( r.buffer, ReadPage( set, lod, blockIDs[ i ], descs[ i ].Key() ), blockSize.Prod() * LVDVoxelBytes( set.CPUSet.VoxelType ) );
+			}
+			glCall_UploadStagedPage( set, slot, descs[ i ].Value().GetPhysicalStorageUnit(), Vec3i( blockSize ) * descs[ i ].Value().ToVec3i(), blockSize );
+			left[ i / run ]--;
+		}
+		// the runs are fenced in order, a run read before the previous one waits for it
+		while ( fencedRuns < submittedRuns && left[ fencedRuns ] == 0 ) {
+			glCall_FenceStagingSlots( set, runEnd[ fencedRuns++ ] );
+		}
+	}
+	glCall_FenceStagingSlots( set, gpuSet.StagingSlotsAcquired );  // nothing is pending if the collect failed
+	GL_EXPR( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 ) );
+}
+
+/**
+ * @brief Orders the missed pages: the more rays wait for a page and the nearer it is, the sooner it is uploaded.
+ * A page of a coarser level covers eight times the volume of a page of the finer one and unblocks the rays
+ * passing through all of it, it is weighted by its level.
+ */
+float MissedPagePriority( int lod, uint32_t rays, float distance )
+{
+	return float( rays ) * float( 1 << lod ) / ( 1.0f + distance );
+}
+
+/**
+ * @brief Issues a ray casting pass, which reports its misses into the next set of feedback buffers
+ */
+void glCall_RayCastingPass( HelperObjectSet &set, GL::GLProgram &outofcoreProgram )
+{
+	auto &gpuSet = set.GPUSet;
+	const int current = gpuSet.NextFeedback;
+	auto &feedback = gpuSet.Feedback[ current ];
+	assert( feedback.Fence == nullptr );  // the buffers of the pass before the previous one are read
+	if ( ++feedback.Epoch == 0 ) {
+		// the hash table may hold any epoch once it wrapped around
+		glCall_ClearHashBuffer( set, feedback );
+		feedback.Epoch = 1;
+	}
+	GL_EXPR( glProgramUniform1ui( outofcoreProgram, 13, feedback.Epoch ) );
+	glCall_BindFeedbackBuffers( feedback );
+	GL_EXPR( glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT ) );  // the rays continue where the previous pass left them
+	GL_EXPR( glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 ) );				   // vertex is hard coded in shader
+	GL_EXPR( glMemoryBarrier( GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT ) );	   // the misses are read through the mapped pointers
+	GL_EXPR( feedback.Fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 ) );
+	feedback.Generation = RayGeneration;
+	gpuSet.PendingFeedback.push_back( current );
+	gpuSet.NextFeedback = ( current + 1 ) % FeedbackBufferCount;
+}
+
+/**
+ * @brief Uploads the pages missed by the pass before the last one issued, so the GPU runs the last one
+ * meanwhile. They are uploaded in the order of their priority over all the levels, at most \a pageBudget
+ * of them, which is decreased by the number uploaded, and no more than the cache holds. The other pages
+ * are requested again by a later pass, the pages mapped since the pass are skipped.
+ *
+ * Returns true if the pass missed no page, that is every ray was finished by it. A pass of the rays
+ * generated before the current ones never finishes them.
+ */
 bool glCall_Refine( HelperObjectSet &set,
 					vector<uint32_t> &missedBlockIDPool,
-					vector<BlockDescriptor> &descs )
+					vector<BlockDescriptor> &descs,
+					size_t &pageBudget )
 {
-	GL_EXPR( glFinish() );
-	assert( set.GPUSet.AtomicCounterBufferPersistentMappedPointer );
-	assert( set.GPUSet.BlockIDBufferPersistentMappedPointer );
-	assert( set.GPUSet.HashBufferPersistentMappedPointer );
+	auto &gpuSet = set.GPUSet;
+	if ( gpuSet.PendingFeedback.size() < FeedbackBufferCount ) {
+		return false;  // only the last pass is running, the next one is issued first
+	}
+	auto &feedback = gpuSet.Feedback[ gpuSet.PendingFeedback.front() ];
+	gpuSet.PendingFeedback.pop_front();
+	GLenum status = GL_TIMEOUT_EXPIRED;
+	while ( status == GL_TIMEOUT_EXPIRED ) {
+		GL_EXPR( status = glClientWaitSync( feedback.Fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000 ) );
+	}
+	GL_EXPR( glDeleteSync( feedback.Fence ) );
+	feedback.Fence = nullptr;
+	assert( feedback.AtomicCounterBufferPersistentMappedPointer );
+	assert( feedback.BlockIDBufferPersistentMappedPointer );
+	assert( feedback.HashBufferPersistentMappedPointer );
+	assert( feedback.RequestStatsBufferPersistentMappedPointer );
 	assert( set.MappingManager );
-	bool refined = true;
+	bool refined = feedback.Generation == RayGeneration;
 	const auto &lodInfo = set.CPUSet.LODInfoCPUBuffer;
 	auto &cpuVolumeData = set.CPUSet.VolumeData;
 	const auto lodCount = cpuVolumeData.size();
+	auto &missed = set.CPUSet.MissedPages;
+	missed.clear();
+	vector<vector<uint32_t>> missedPages( lodCount );
+	// pages with the same voxels as a cached page share its slot, the others are uploaded once per instance
+	vector<vector<size_t>> instances( lodCount );
+	vector<vector<pair<uint32_t, uint32_t>>> pendingAliases( lodCount );
 	for ( int curLod = 0; curLod < lodCount; curLod++ ) {
 		//missedBlockIDCache.clear();
-		const auto counter = set.GPUSet.AtomicCounterBufferPersistentMappedPointer;
+		const auto counter = feedback.AtomicCounterBufferPersistentMappedPointer;
 		const size_t curLodMissedBlockCount = *( counter + curLod );
 		if ( curLodMissedBlockCount == 0 )	// render finished
 			continue;
-		// Bounding block
-		//blocks = ( std::min )( memoryEvaluators->EvalPhysicalBlockDim().Prod() * memoryEvaluators->EvalPhysicalTextureCount(), blocks );
 		refined = false;
 
-		missedBlockIDPool.resize( curLodMissedBlockCount );
-		memcpy( missedBlockIDPool.data(), set.GPUSet.BlockIDBufferPersistentMappedPointer + lodInfo[ curLod ].idBufferOffset, sizeof( uint32_t ) * curLodMissedBlockCount );
+		const auto ids = feedback.BlockIDBufferPersistentMappedPointer + lodInfo[ curLod ].idBufferOffset;
+		auto &pages = missedPages[ curLod ];
+		pages.clear();
+		for ( size_t i = 0; i < curLodMissedBlockCount; i++ ) {
+			uint64_t slot = 0;
+			if ( MappedCacheSlot( set, curLod, ids[ i ], slot ) == false ) {  // the later passes may have missed it too
+				pages.push_back( ids[ i ] );
+			}
+		}
+		const auto lvd = set.CPUSet.LVDLevels.empty() ? nullptr : set.CPUSet.LVDLevels[ curLod ];
+		if ( lvd ) {
+			ShareCachedInstances( set, curLod, pages, instances[ curLod ], pendingAliases[ curLod ] );
+		}
+		const auto stats = feedback.RequestStatsBufferPersistentMappedPointer + 2 * lodInfo[ curLod ].hashBufferOffset;
+		for ( size_t i = 0; i < pages.size(); i++ ) {
+			const uint32_t nearest = ~stats[ 2 * pages[ i ] + 1 ];
+			float distance = 0;
+			memcpy( &distance, &nearest, sizeof( float ) );
+			missed.push_back( { MissedPagePriority( curLod, stats[ 2 * pages[ i ] ], distance ), curLod, i } );
+		}
+		// only the missed pages were reported, the rest of the buffer is still zero
+		for ( size_t i = 0; i < curLodMissedBlockCount; i++ ) {
+			stats[ 2 * ids[ i ] ] = stats[ 2 * ids[ i ] + 1 ] = 0;
+		}
+	}
+
+	// the pages served by this pass, by level in the order of their priority
+	const auto served = ( std::min )( missed.size(), ( std::min )( pageBudget, set.CPUSet.CachePageCount ) );
+	std::partial_sort( missed.begin(), missed.begin() + served, missed.end(), []( const HelperCPUObjectSet::MissedPage &a, const HelperCPUObjectSet::MissedPage &b ) { return a.priority > b.priority; } );
+	vector<vector<size_t>> servedIndices( lodCount );
+	for ( size_t i = 0; i < served; i++ ) {
+		servedIndices[ missed[ i ].lod ].push_back( missed[ i ].index );
+	}
+
+	for ( int curLod = 0; curLod < lodCount; curLod++ ) {
+		if ( servedIndices[ curLod ].empty() )
+			continue;
+		const auto lvd = set.CPUSet.LVDLevels.empty() ? nullptr : set.CPUSet.LVDLevels[ curLod ];
+		vector<size_t> servedInstances;
+		missedBlockIDPool.clear();
+		for ( const auto i : servedIndices[ curLod ] ) {
+			missedBlockIDPool.push_back( missedPages[ curLod ][ i ] );
+			if ( lvd ) {
+				servedInstances.push_back( instances[ curLod ][ i ] );
+			}
+		}
 		const auto dim = cpuVolumeData[ curLod ]->BlockDim();
-		const auto physicalBlockCount = dim.Prod();
 		vector<VirtualMemoryBlockIndex> virtualSpaceAddress;
-		virtualSpaceAddress.reserve( curLodMissedBlockCount );
+		virtualSpaceAddress.reserve( missedBlockIDPool.size() );
 		descs.clear();
-		//descs.reserve( curLodMissedBlockCount );
-		//println( "lod: {}, blocks: {}", curLod, blocks );
-		for ( int i = 0; i < curLodMissedBlockCount && i < physicalBlockCount; i++ ) {
+		for ( int i = 0; i < missedBlockIDPool.size(); i++ ) {
 			virtualSpaceAddress.emplace_back( missedBlockIDPool[ i ], dim.x, dim.y, dim.z );
 		}
 
 		const auto physicalSpaceAddress = set.MappingManager->UpdatePageTable( curLod, virtualSpaceAddress );
+		pageBudget -= ( std::min )( pageBudget, physicalSpaceAddress.size() );
+		for ( int i = 0; i < physicalSpaceAddress.size(); i++ ) {
+			const auto slot = CacheSlotKey( physicalSpaceAddress[ i ] );
+			ReleaseCacheSlot( set, slot );
+			// the entries of the mapped page and of the page unmapped from its slot changed
+			const auto page = set.CPUSet.SlotPages.find( slot );
+			if ( page != set.CPUSet.SlotPages.end() ) {
+				MarkPageTableEntry( set, page->second.first, page->second.second );
+			}
+			set.CPUSet.SlotPages[ slot ] = make_pair( curLod, size_t( missedBlockIDPool[ i ] ) );
+			MarkPageTableEntry( set, curLod, missedBlockIDPool[ i ] );
+		}
+		if ( lvd ) {
+			ShareUploadedInstances( set, curLod, missedBlockIDPool, servedInstances, physicalSpaceAddress, pendingAliases[ curLod ] );
+		}
+
+		if ( lvd && PageIOMode < 0 ) {
+			// the pages of all missed blocks are read at once instead of faulting them in one by one below
+			lvd->Prefetch( vector<size_t>( missedBlockIDPool.begin(), missedBlockIDPool.begin() + physicalSpaceAddress.size() ), lvd->GetLOD() );
+		}
 
 		for ( int i = 0; i < physicalSpaceAddress.size(); i++ ) {
 			descs.emplace_back( physicalSpaceAddress[ i ], virtualSpaceAddress[ i ] );
 		}
 
 		const auto blockSize = cpuVolumeData[ curLod ]->BlockSize();
+		if ( lvd && PageIOMode >= 0 ) {
+			glCall_UploadPagesAsync( set, curLod, missedBlockIDPool, descs );
+			continue;
+		}
+		GL_EXPR( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, set.GPUSet.GLStagingBuffer ) );
 		for ( int i = 0; i < descs.size(); i++ ) {
 			const auto posInCache = Vec3i( blockSize ) * descs[ i ].Value().ToVec3i();
-			const auto d = cpuVolumeData[ curLod ]->GetPage( descs[ i ].Key() );
-			const auto texHandle = set.GPUSet.GLVolumeTexture[ descs[ i ].Value().GetPhysicalStorageUnit() ].GetGLHandle();
-			GL_EXPR( glTextureSubImage3D( texHandle, 0, posInCache.x, posInCache.y, posInCache.z, blockSize.x, blockSize.y, blockSize.z, GL_RED, GL_UNSIGNED_BYTE, d ) );
+			const auto d = ReadPage( set, curLod, missedBlockIDPool[ i ], descs[ i ].Key() );
+			glCall_UploadPage( set, d, descs[ i ].Value().GetPhysicalStorageUnit(), posInCache, blockSize );
 		}
+		glCall_FenceStagingSlots( set, set.GPUSet.StagingSlotsAcquired );
+		GL_EXPR( glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 ) );
 	}
-	glCall_ClearObjectSet( set );
+	glCall_ClearFeedbackBuffers( set, feedback );
+	glCall_FlushPageTable( set );
 	return refined;
 }
 
@@ -635,6 +1414,7 @@ void PrintVideoMemoryUsageInfo( std::ostream &os, const HelperObjectSet &set,
 	//const size_t volumeTextureMemoryUsage = memoryEvaluators->EvalPhysicalTextureSize().Prod() * memoryEvaluators->EvalPhysicalTextureCount();
 	size_t pageTableBufferBytes = 0;
 	size_t totalCPUMemoryUsage = 0;
+	size_t doubleCachingSavings = 0;
 	const auto lodCount = set.CPUSet.VolumeData.size();
 	auto &cpuVolumeData = set.CPUSet.VolumeData;
 	auto &mappingTableManager = set.MappingManager;
@@ -644,7 +1424,7 @@ void PrintVideoMemoryUsageInfo( std::ostream &os, const HelperObjectSet &set,
 		fprintln( os, "Data Resolution: {}", cpuVolumeData[ i ]->DataSizeWithoutPadding() );
 		fprintln( os, "Block Dimension: {}", cpuVolumeData[ i ]->BlockDim() );
 		fprintln( os, "Block Size: {}", cpuVolumeData[ i ]->BlockSize() );
-		fprintln( os, "Data Size: {.2} GB", ( cpuVolumeData[ i ]->BlockDim() * cpuVolumeData[ i ]->BlockSize() ).Prod() * 1.0 / 1024 / 1024 / 1024 );
+		fprintln( os, "Data Size: {.2} GB", ( cpuVolumeData[ i ]->BlockDim() * cpuVolumeData[ i ]->BlockSize() ).Prod() * LVDVoxelBytes( set.CPUSet.VoxelType ) * 1.0 / 1024 / 1024 / 1024 );
 		fprintln( os, "CPU Memory Usage: {.2} GB", cpuVolumeData[ i ]->CPUCacheSize().Prod() * 1.0 / 1024 / 1024 / 1024 );
 
 		const auto blocks = cpuVolumeData[ i ]->BlockDim().Prod();
@@ -652,24 +1432,45 @@ void PrintVideoMemoryUsageInfo( std::ostream &os, const HelperObjectSet &set,
 		fprintln( os, "IDBuffer Memory Usage: {}, Offset: {}", blocks * sizeof( uint32_t ), lodInfo[ i ].idBufferOffset );
 		fprintln( os, "PageTable Memory Usage: {}, Offset: {}", mappingTableManager->GetBytes( i ), lodInfo[ i ].pageTableOffset );
 
+		// a mapped level keeps a page cache copy of every cached block, up to the whole level
+		const size_t cacheBytes = cpuVolumeData[ i ]->CPUCacheSize().Prod();
+		const size_t levelBytes = ( cpuVolumeData[ i ]->BlockDim() * cpuVolumeData[ i ]->BlockSize() ).Prod() * LVDVoxelBytes( set.CPUSet.VoxelType );
+		const auto lvd = set.CPUSet.LVDLevels.empty() ? nullptr : set.CPUSet.LVDLevels[ i ];
+		if ( BypassesHostCache( lvd ) ) {
+			// nothing is cached twice, the pages only have their copy in the page cache if any
+			fprintln( os, "Page Cache Copy: none, the host cache is bypassed{}", lvd->GetDirectIO() ? " and the pages are read with O_DIRECT" : "" );
+		} else if ( lvd && lvd->GetDirectIO() ) {
+			fprintln( os, "Page Cache Copy: none (O_DIRECT), up to {.2} GB saved once the host cache is full", ( std::min )( cacheBytes, levelBytes ) * 1.0 / 1024 / 1024 / 1024 );
+			doubleCachingSavings += ( std::min )( cacheBytes, levelBytes );
+		} else {
+			fprintln( os, "Page Cache Copy: up to {.2} GB", ( std::min )( cacheBytes, levelBytes ) * 1.0 / 1024 / 1024 / 1024 );
+		}
+
 		pageTableBufferBytes += mappingTableManager->GetBytes( i );
 		totalCPUMemoryUsage += cpuVolumeData[ i ]->CPUCacheSize().Prod();
 	}
 
+	const auto blockIDBufferBytes = FeedbackBufferCount * set.GPUSet.BlockIDBufferBytes;
+	const auto hashBufferBytes = FeedbackBufferCount * set.GPUSet.HashBufferBytes;
+	const auto requestStatsBufferBytes = FeedbackBufferCount * set.GPUSet.RequestStatsBufferBytes;
 	const auto totalGPUMemoryUsage = pageTableBufferBytes +
 									 volumeTextureMemoryUsage +
-									 set.GPUSet.BlockIDBufferBytes +
-									 set.GPUSet.HashBufferBytes;
+									 blockIDBufferBytes +
+									 hashBufferBytes +
+									 requestStatsBufferBytes;
 
 	//println( "BlockDim: {} | Texture Size: {}", memoryEvaluators->EvalPhysicalBlockDim(), memoryEvaluators->EvalPhysicalTextureSize() );
 	fprintln( os, "------------Summary Memory Usage ---------------" );
 	fprintln( os, "Data Resolution: {}", cpuVolumeData[ 0 ]->DataSizeWithoutPadding() );
 	fprintln( os, "Volume Texture Memory Usage: {} Bytes = {.2} MB", volumeTextureMemoryUsage, volumeTextureMemoryUsage * 1.0 / 1024 / 1024 );
 	fprintln( os, "Page Table Memory Usage: {} Bytes = {.2} MB", pageTableBufferBytes, pageTableBufferBytes * 1.0 / 1024 / 1024 );
-	fprintln( os, "Total ID Buffer Block Memory Usage: {} Bytes = {.2} MB", set.GPUSet.BlockIDBufferBytes, set.GPUSet.BlockIDBufferBytes * 1.0 / 1024 / 1024 );
-	fprintln( os, "Total Hash Buffer Block Memory Usage: {} Bytes = {.2} MB", set.GPUSet.HashBufferBytes, set.GPUSet.HashBufferBytes * 1.0 / 1024 / 1024 );
+	fprintln( os, "Total ID Buffer Block Memory Usage: {} Bytes = {.2} MB", blockIDBufferBytes, blockIDBufferBytes * 1.0 / 1024 / 1024 );
+	fprintln( os, "Total Hash Buffer Block Memory Usage: {} Bytes = {.2} MB", hashBufferBytes, hashBufferBytes * 1.0 / 1024 / 1024 );
+	fprintln( os, "Total Request Stats Buffer Memory Usage: {} Bytes = {.2} MB", requestStatsBufferBytes, requestStatsBufferBytes * 1.0 / 1024 / 1024 );
+	fprintln( os, "Staging Ring Memory Usage: {} Bytes = {.2} MB, {} Slots", set.GPUSet.StagingBufferBytes, set.GPUSet.StagingBufferBytes * 1.0 / 1024 / 1024, set.GPUSet.StagingSlotCount );
 	fprintln( os, "Total Volume Data GPU Memory Usage: {} Bytes = {.2} GB", totalGPUMemoryUsage, totalGPUMemoryUsage * 1.0 / 1024 / 1024 / 1024 );
 	fprintln( os, "Total CPU Memory Usage: {} Bytes = {.2} GB", totalCPUMemoryUsage, totalCPUMemoryUsage * 1.0 / 1024 / 1024 / 1024 );
+	fprintln( os, "Double Caching Saved by O_DIRECT: up to {} Bytes = {.2} GB (the levels read through the host cache)", doubleCachingSavings, doubleCachingSavings * 1.0 / 1024 / 1024 / 1024 );
 	fprintln( os, "================================" );
 }
 
@@ -687,6 +1488,14 @@ int main( int argc, char **argv )
 	a.add<string>( "cam", '\0', "camera json file", false );
 	a.add<string>( "tf", '\0', "transfer function text file", false );
 	a.add<string>( "pd", '\0', "specifies plugin load directoy", false, "plugins" );
+	a.add<string>( "pageio", '\0', "how the pages of .lvd levels are read: sync (through the host cache), mmap, pread, uring or uring-direct", false, "sync" );
+	a.add<int>( "pagethreads", '\0', "number of page reading threads, or the io_uring depth", false, 16 );
+	a.add( "direct", '\0', "read .lvd levels with O_DIRECT, bypassing the page cache" );
+	a.add<int>( "play", '\0', "plays a .lvdt series back, advancing a timestep every given ms", false, 0 );
+	a.add<size_t>( "staging", '\0', "size of the page upload staging ring in MB", false, 64 );
+	a.add<int>( "budget", '\0', "refinement time per frame in ms, a frame over it shows the unfinished rays, 0 refines completely", false, 0 );
+	a.add<int>( "budget-passes", '\0', "refinement passes per frame, 0 for no limit", false, 0 );
+	a.add<size_t>( "budget-pages", '\0', "pages uploaded per frame, 0 for no limit", false, 0 );
 	a.parse_check( argc, argv );
 
 
@@ -709,13 +1518,32 @@ int main( int argc, char **argv )
 		availableDeviceMemory = a.get<size_t>( "dmem" );
 	}
 	availableHostMemory = a.get<size_t>( "hmem" );
-
-	auto de = [availableDeviceMemory]( const Vector3i &blockSize ) {
+	const auto pageIO = a.get<string>( "pageio" );
+	if ( pageIO == "mmap" ) {
+		PageIOMode = LVD_PAGE_IO_MMAP;
+	} else if ( pageIO == "uring" ) {
+		PageIOMode = LVD_PAGE_IO_URING;
+	} else if ( pageIO == "uring-direct" ) {
+		PageIOMode = LVD_PAGE_IO_URING_DIRECT;
+	} else if ( pageIO == "pread" ) {
+		PageIOMode = LVD_PAGE_IO_PREAD;
+	} else {
+		PageIOMode = -1;  // sync
+	}
+	PageIOThreads = a.get<int>( "pagethreads" );
+	DirectIO = a.exist( "direct" );
+	TimestepInterval = a.get<int>( "play" );
+	StagingRingMB = a.get<size_t>( "staging" );
+	RefineBudgetMs = a.get<int>( "budget" );
+	RefinePassesPerFrame = a.get<int>( "budget-passes" );
+	RefinePagesPerFrame = a.get<size_t>( "budget-pages" );
+
+	auto de = [availableDeviceMemory]( const Vector3i &blockSize, size_t voxelBytes ) {
 		int textureUnitCount = 4;
 		const auto maxBytesPerTexUnit = availableDeviceMemory * 3 / 4 / textureUnitCount;
 		int d = 0;
 		while ( ++d ) {
-			const auto memory = d * d * d * blockSize.Prod();
+			const auto memory = d * d * d * blockSize.Prod() * voxelBytes;
 			if ( memory >= maxBytesPerTexUnit )
 				break;
 		}
@@ -735,6 +1563,7 @@ int main( int argc, char **argv )
 	println( "Specified Avalable Host Memory Hint: {}", availableHostMemory );
 	println( "Specified Avalable Device Memory Hint: {}", availableDeviceMemory );
 	println( "Plugin directory: {}", a.get<string>( "pd" ) );
+	println( "Page IO: {}, {} threads{}", pageIO, PageIOThreads, DirectIO ? ", O_DIRECT" : "" );
   
 
 	println( "Load Plugin..." );
@@ -1076,6 +1905,7 @@ int main( int argc, char **argv )
 			} else if ( extension == ".cam" ) {
 				try{
 					camera = ConfigCamera(each);
+					RaysOutdated = true;
 				}catch(std::exception & e){
 					println("Cannot open .cam file: {}",e.what());
 				}
@@ -1106,28 +1936,38 @@ int main( int argc, char **argv )
 	const GLenum drawBuffers[ 2 ] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
 	const GLenum allDrawBuffers[ 3 ] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
 
+	auto lastTimestep = chrono::steady_clock::now();
 	while ( gl->Wait() == false ) {
+		const auto frameStart = chrono::steady_clock::now();
+		if ( TimestepInterval > 0 && frameStart - lastTimestep >= chrono::milliseconds( TimestepInterval ) ) {
+			glCall_AdvanceTimestep( set );
+			lastTimestep = frameStart;
+		}
 		/*Ray Casting Rendering Loop*/
-		// Pass [1]: Generates ray position into textures
-		glEnable( GL_BLEND );  // Blend is necessary for ray-casting position generation
-		GL_EXPR( glUseProgram( positionGenerateProgram ) );
+		// Pass [1]: Generates ray position into textures, skipped while the rays of the last frame are continued
 		GL_EXPR( glBindFramebuffer( GL_FRAMEBUFFER, GLFramebuffer ) );
-
-		// GL_EXPR(glClearNamedFramebufferfv(GLFramebuffer,GL_COLOR,0,zeroRGBA)); // Clear EntryPosTexture
-		// GL_EXPR(glClearNamedFramebufferfv(GLFramebuffer,GL_COLOR,1,zeroRGBA)); // Clear ExitPosTexture
-		// GL_EXPR(glClearNamedFramebufferfv(GLFramebuffer,GL_COLOR,2,zeroRGBA)); // Clear ResultTexture
-		/**
-		 * @brief Clearing framebuffer by using the non-DSA api because commented DSA version above has no
-		 * effect on intel GPU. Maybe it's a graphics driver bug. 
-		 * see https://software.intel.com/en-us/forums/graphics-driver-bug-reporting/topic/740117
-		 */
-		GL_EXPR( glDrawBuffers( 3, allDrawBuffers ) );
-		GL_EXPR( glClearBufferfv( GL_COLOR, 0, zeroRGBA ) );  // Clear EntryPosTexture
-		GL_EXPR( glClearBufferfv( GL_COLOR, 1, zeroRGBA ) );  // CLear ExitPosTexture
-		GL_EXPR( glClearBufferfv( GL_COLOR, 2, zeroRGBA ) );  // Clear ResultTexture
-
-		GL_EXPR( glNamedFramebufferDrawBuffers( GLFramebuffer, 2, drawBuffers ) );	// draw into these buffers
-		GL_EXPR( glDrawElements( GL_TRIANGLES, 36, GL_UNSIGNED_INT, nullptr ) );	// 12 triangles, 36 vertices in total
+		if ( RaysOutdated ) {
+			glEnable( GL_BLEND );  // Blend is necessary for ray-casting position generation
+			GL_EXPR( glUseProgram( positionGenerateProgram ) );
+
+			// GL_EXPR(glClearNamedFramebufferfv(GLFramebuffer,GL_COLOR,0,zeroRGBA)); // Clear EntryPosTexture
+			// GL_EXPR(glClearNamedFramebufferfv(GLFramebuffer,GL_COLOR,1,zeroRGBA)); // Clear ExitPosTexture
+			// GL_EXPR(glClearNamedFramebufferfv(GLFramebuffer,GL_COLOR,2,zeroRGBA)); // Clear ResultTexture
+			/**
+			 * @brief Clearing framebuffer by using the non-DSA api because commented DSA version above has no
+			 * effect on intel GPU. Maybe it's a graphics driver bug. 
+			 * see https://software.intel.com/en-us/forums/graphics-driver-bug-reporting/topic/740117
+			 */
+			GL_EXPR( glDrawBuffers( 3, allDrawBuffers ) );
+			GL_EXPR( glClearBufferfv( GL_COLOR, 0, zeroRGBA ) );  // Clear EntryPosTexture
+			GL_EXPR( glClearBufferfv( GL_COLOR, 1, zeroRGBA ) );  // CLear ExitPosTexture
+			GL_EXPR( glClearBufferfv( GL_COLOR, 2, zeroRGBA ) );  // Clear ResultTexture
+
+			GL_EXPR( glNamedFramebufferDrawBuffers( GLFramebuffer, 2, drawBuffers ) );	// draw into these buffers
+			GL_EXPR( glDrawElements( GL_TRIANGLES, 36, GL_UNSIGNED_INT, nullptr ) );	// 12 triangles, 36 vertices in total
+			RaysOutdated = false;
+			RayGeneration++;
+		}
 
 		// Pass [2 - n]: Ray casting here
 		GL_EXPR( glDisable( GL_BLEND ) );
@@ -1135,10 +1975,19 @@ int main( int argc, char **argv )
 		//GL_EXPR(glUseProgram(raycastingProgram));
 		GL_EXPR( glUseProgram( outofcoreProgram ) );
 		GL_EXPR( glNamedFramebufferDrawBuffer( GLFramebuffer, GL_COLOR_ATTACHMENT2 ) );	 // draw into result texture
-		//While out-of-core refine
+		//While out-of-core refine, within the budget of the frame
+		size_t pageBudget = RefinePagesPerFrame > 0 ? RefinePagesPerFrame : SIZE_MAX;
+		int passes = 0;
+		bool finished = false;
 		do {
-			GL_EXPR( glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 ) );	 // vertex is hard coded in shader
-		} while ( glCall_Refine( set, missedBlockHostPool, blockDescHostPool ) == false );
+			glCall_RayCastingPass( set, outofcoreProgram );
+			finished = glCall_Refine( set, missedBlockHostPool, blockDescHostPool, pageBudget );
+			passes++;
+		} while ( finished == false && pageBudget > 0 &&
+				  ( RefinePassesPerFrame <= 0 || passes < RefinePassesPerFrame ) &&
+				  ( RefineBudgetMs <= 0 || chrono::steady_clock::now() - frameStart < chrono::milliseconds( RefineBudgetMs ) ) );
+		// the rays of a finished frame are generated again, the next frame may see other data
+		RaysOutdated = RaysOutdated || finished;
 
 		// Pass [n + 1]: Blit result to default framebuffer
 		GL_EXPR( glBindFramebuffer( GL_FRAMEBUFFER, 0 ) );	// prepare to display
@@ -0,0 +1,96 @@
+#include "lvdalignedbufferpool.h"
+
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace vm
+{
+namespace
+{
+unsigned char *AlignedAlloc( std::size_t bytes, std::size_t alignment )
+{
+#ifdef _WIN32
+	return static_cast<unsigned char *>( _aligned_malloc( bytes, alignment ) );
+#else
+	void *p = nullptr;
+	return posix_memalign( &p, alignment, bytes ) == 0 ? static_cast<unsigned char *>( p ) : nullptr;
+#endif
+}
+
+void AlignedFree( unsigned char *p )
+{
+#ifdef _WIN32
+	_aligned_free( p );
+#else
+	free( p );
+#endif
+}
+}  // namespace
+
+LVDAlignedBufferPool::Buffer &LVDAlignedBufferPool::Buffer::operator=( Buffer &&other ) noexcept
+{
+	if ( this != &other ) {
+		if ( ptr ) {
+			pool->Release( ptr );
+		}
+		pool = other.pool;
+		ptr = other.ptr;
+		other.ptr = nullptr;
+	}
+	return *this;
+}
+
+LVDAlignedBufferPool::Buffer::~Buffer()
+{
+	if ( ptr ) {
+		pool->Release( ptr );
+	}
+}
+
+LVDAlignedBufferPool::LVDAlignedBufferPool( std::size_t bufferBytes, std::size_t alignment ) :
+  bufferBytes( ( bufferBytes + alignment - 1 ) / alignment * alignment ),
+  alignment( alignment )
+{
+}
+
+LVDAlignedBufferPool::~LVDAlignedBufferPool()
+{
+	// every Buffer must be returned by now
+	for ( const auto p : freeBuffers ) {
+		AlignedFree( p );
+	}
+}
+
+LVDAlignedBufferPool::Buffer LVDAlignedBufferPool::Acquire()
+{
+	{
+		std::lock_guard<std::mutex> lk( mutex );
+		if ( freeBuffers.empty() == false ) {
+			const auto p = freeBuffers.back();
+			freeBuffers.pop_back();
+			return Buffer( this, p );
+		}
+	}
+	const auto p = AlignedAlloc( bufferBytes, alignment );
+	if ( p == nullptr ) {
+		return Buffer();
+	}
+	std::lock_guard<std::mutex> lk( mutex );
+	allocatedCount++;
+	return Buffer( this, p );
+}
+
+void LVDAlignedBufferPool::Release( unsigned char *buffer )
+{
+	std::lock_guard<std::mutex> lk( mutex );
+	freeBuffers.push_back( buffer );
+}
+
+std::size_t LVDAlignedBufferPool::AllocatedBytes()
+{
+	std::lock_guard<std::mutex> lk( mutex );
+	return allocatedCount * bufferBytes;
+}
+}  // namespace vm
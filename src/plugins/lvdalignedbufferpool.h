@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace vm
+{
+/**
+ * \brief A thread-safe pool of equally sized buffers aligned for O_DIRECT. Buffers are allocated on
+ * demand and reused, they are only freed with the pool.
+ */
+class LVDAlignedBufferPool
+{
+	std::size_t bufferBytes;
+	std::size_t alignment;
+	std::mutex mutex;
+	std::vector<unsigned char *> freeBuffers;
+	std::size_t allocatedCount = 0;
+
+	void Release( unsigned char *buffer );
+
+public:
+	/**
+	 * \brief A buffer of the pool, returned to it when destroyed
+	 */
+	class Buffer
+	{
+		LVDAlignedBufferPool *pool = nullptr;
+		unsigned char *ptr = nullptr;
+
+	public:
+		Buffer() = default;
+		Buffer( LVDAlignedBufferPool *pool, unsigned char *ptr ) :
+		  pool( pool ), ptr( ptr ) {}
+		Buffer( Buffer &&other ) noexcept :
+		  pool( other.pool ), ptr( other.ptr ) { other.ptr = nullptr; }
+		Buffer &operator=( Buffer &&other ) noexcept;
+		Buffer( const Buffer & ) = delete;
+		Buffer &operator=( const Buffer & ) = delete;
+		~Buffer();
+		unsigned char *Data() const { return ptr; }
+		explicit operator bool() const { return ptr != nullptr; }
+	};
+
+	LVDAlignedBufferPool( std::size_t bufferBytes, std::size_t alignment );
+	~LVDAlignedBufferPool();
+	LVDAlignedBufferPool( const LVDAlignedBufferPool & ) = delete;
+	LVDAlignedBufferPool &operator=( const LVDAlignedBufferPool & ) = delete;
+	/**
+	 * \brief Returns an empty buffer if the allocation fails
+	 */
+	Buffer Acquire();
+	std::size_t BufferBytes() const { return bufferBytes; }
+	std::size_t Alignment() const { return alignment; }
+	std::size_t AllocatedBytes();
+};
+}  // namespace vm
@@ -0,0 +1,157 @@
+#include "lvdcodec.h"
+#include <cstring>
+#include <algorithm>
+
+namespace vm
+{
+LVDBlockCodec LVDCodec::Encode( const unsigned char *src, size_t count, std::vector<unsigned char> &dst )
+{
+	thread_local std::vector<unsigned char> scratch;
+	dst.resize( count );
+	scratch.resize( count );
+
+	const size_t rle = EncodeRLE( src, count, dst.data(), count );
+	// delta must beat rle if rle succeeded
+	const size_t delta = EncodeDeltaBitPack( src, count, scratch.data(), rle ? rle : count );
+	if ( delta ) {
+		dst.assign( scratch.begin(), scratch.begin() + delta );
+		return LVD_CODEC_DELTA_BITPACK;
+	}
+	if ( rle ) {
+		dst.resize( rle );
+		return LVD_CODEC_RLE;
+	}
+	dst.assign( src, src + count );
+	return LVD_CODEC_RAW;
+}
+
+bool LVDCodec::Decode( LVDBlockCodec codec, const unsigned char *src, size_t length, unsigned char *dst, size_t count )
+{
+	switch ( codec ) {
+	case LVD_CODEC_RAW:
+		if ( length != count ) return false;
+		memcpy( dst, src, count );
+		return true;
+	case LVD_CODEC_RLE: return DecodeRLE( src, length, dst, count );
+	case LVD_CODEC_DELTA_BITPACK: return DecodeDeltaBitPack( src, length, dst, count );
+	default: return false;
+	}
+}
+
+size_t LVDCodec::EncodeRLE( const unsigned char *src, size_t count, unsigned char *dst, size_t capacity )
+{
+	size_t i = 0, o = 0;
+	while ( i < count ) {
+		size_t run = 1;
+		while ( i + run < count && run < 128 && src[ i + run ] == src[ i ] ) run++;
+		if ( run >= 3 ) {
+			if ( o + 2 >= capacity ) return 0;
+			dst[ o++ ] = (unsigned char)( 257 - run );
+			dst[ o++ ] = src[ i ];
+			i += run;
+		} else {
+			// literals until a run of 3 starts
+			const size_t start = i;
+			size_t literal = 0;
+			while ( i < count && literal < 128 ) {
+				if ( i + 2 < count && src[ i ] == src[ i + 1 ] && src[ i ] == src[ i + 2 ] ) break;
+				i++;
+				literal++;
+			}
+			if ( o + 1 + literal >= capacity ) return 0;
+			dst[ o++ ] = (unsigned char)( literal - 1 );
+			memcpy( dst + o, src + start, literal );
+			o += literal;
+		}
+	}
+	return o;
+}
+
+bool LVDCodec::DecodeRLE( const unsigned char *src, size_t length, unsigned char *dst, size_t count )
+{
+	size_t i = 0, o = 0;
+	while ( i < length ) {
+		const unsigned c = src[ i++ ];
+		if ( c < 128 ) {
+			const size_t n = c + 1;
+			if ( i + n > length || o + n > count ) return false;
+			memcpy( dst + o, src + i, n );
+			i += n;
+			o += n;
+		} else if ( c > 128 ) {
+			const size_t n = 257 - c;
+			if ( i >= length || o + n > count ) return false;
+			memset( dst + o, src[ i++ ], n );
+			o += n;
+		}
+	}
+	return o == count;
+}
+
+size_t LVDCodec::EncodeDeltaBitPack( const unsigned char *src, size_t count, unsigned char *dst, size_t capacity )
+{
+	unsigned char zigzag[ LVD_DELTA_GROUP_SIZE ];
+	unsigned char prev = 0;
+	size_t o = 0;
+	for ( size_t g = 0; g < count; g += LVD_DELTA_GROUP_SIZE ) {
+		const size_t n = ( std::min )( size_t( LVD_DELTA_GROUP_SIZE ), count - g );
+		unsigned char bitsOr = 0;
+		for ( size_t k = 0; k < n; k++ ) {
+			const int d = int8_t( src[ g + k ] - prev );
+			prev = src[ g + k ];
+			zigzag[ k ] = (unsigned char)( ( d << 1 ) ^ ( d >> 7 ) );
+			bitsOr |= zigzag[ k ];
+		}
+		int width = 0;
+		while ( width < 8 && ( bitsOr >> width ) ) width++;
+		const size_t bytes = ( n * width + 7 ) / 8;
+		if ( o + 1 + bytes >= capacity ) return 0;
+
+		dst[ o++ ] = (unsigned char)width;
+		uint32_t acc = 0;
+		int bits = 0;
+		for ( size_t k = 0; k < n; k++ ) {
+			acc |= uint32_t( zigzag[ k ] ) << bits;
+			bits += width;
+			while ( bits >= 8 ) {
+				dst[ o++ ] = acc & 0xff;
+				acc >>= 8;
+				bits -= 8;
+			}
+		}
+		if ( bits > 0 ) dst[ o++ ] = acc & 0xff;
+	}
+	return o;
+}
+
+bool LVDCodec::DecodeDeltaBitPack( const unsigned char *src, size_t length, unsigned char *dst, size_t count )
+{
+	unsigned char prev = 0;
+	size_t i = 0;
+	for ( size_t g = 0; g < count; g += LVD_DELTA_GROUP_SIZE ) {
+		const size_t n = ( std::min )( size_t( LVD_DELTA_GROUP_SIZE ), count - g );
+		if ( i >= length ) return false;
+		const int width = src[ i++ ];
+		if ( width > 8 ) return false;
+		const size_t bytes = ( n * width + 7 ) / 8;
+		if ( i + bytes > length ) return false;
+
+		const uint32_t mask = ( 1u << width ) - 1;
+		uint32_t acc = 0;
+		int bits = 0;
+		for ( size_t k = 0; k < n; k++ ) {
+			while ( bits < width ) {
+				acc |= uint32_t( src[ i++ ] ) << bits;
+				bits += 8;
+			}
+			const unsigned z = acc & mask;
+			acc >>= width;
+			bits -= width;
+			const int d = int( z >> 1 ) ^ -int( z & 1 );
+			prev = (unsigned char)( prev + d );
+			dst[ g + k ] = prev;
+		}
+	}
+	return i == length;
+}
+}  // namespace vm
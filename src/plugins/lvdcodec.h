@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lvdfileheader.h"
+
+namespace vm
+{
+/**
+ * \brief Lossless block codecs of LVD v2.
+ *
+ * RLE is a PackBits variant. A control byte c < 128 is followed by c + 1 literal bytes,
+ * c > 128 means the next byte repeats 257 - c times.
+ *
+ * Delta + bit-packing stores the zigzag-encoded difference of each voxel to its predecessor.
+ * Every group of LVD_DELTA_GROUP_SIZE values is prefixed with its bit width and packed LSB first.
+ */
+class LVDCodec
+{
+public:
+	enum
+	{
+		LVD_DELTA_GROUP_SIZE = 128
+	};
+
+	/**
+	 * \brief Encodes \a count bytes with the smallest codec into \a dst and returns the codec.
+	 * \a dst holds the raw bytes when no codec is smaller than the block itself.
+	 */
+	static LVDBlockCodec Encode( const unsigned char *src, size_t count, std::vector<unsigned char> &dst );
+
+	/**
+	 * \brief Decodes \a length bytes encoded by \a codec into \a count bytes of \a dst.
+	 * Returns false if the encoded data is corrupted.
+	 */
+	static bool Decode( LVDBlockCodec codec, const unsigned char *src, size_t length, unsigned char *dst, size_t count );
+
+	/**
+	 * \brief Returns the encoded size, or 0 if it would not be less than \a capacity
+	 */
+	static size_t EncodeRLE( const unsigned char *src, size_t count, unsigned char *dst, size_t capacity );
+	static bool DecodeRLE( const unsigned char *src, size_t length, unsigned char *dst, size_t count );
+
+	static size_t EncodeDeltaBitPack( const unsigned char *src, size_t count, unsigned char *dst, size_t capacity );
+	static bool DecodeDeltaBitPack( const unsigned char *src, size_t length, unsigned char *dst, size_t count );
+};
+}  // namespace vm
@@ -0,0 +1,213 @@
+#include "lvdconverter.h"
+#include "lvdfile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+#include <cstring>
+
+#include <VMFoundation/rawreader.h>
+#include <VMFoundation/logger.h>
+
+namespace vm
+{
+namespace
+{
+/**
+ * \brief Voxels [begin, end) of the raw, a Z-slab of all of x and y or a Morton cell
+ */
+struct RawRegion
+{
+	std::vector<unsigned char> data;
+	Vec3i begin;
+	Vec3i end;
+};
+
+/**
+ * \brief Blocks converted from one raw region, in the order they are written
+ */
+struct ConvertUnit
+{
+	Vec3i begin;
+	Vec3i end;
+	std::vector<uint64_t> blockIds;
+};
+
+void ReadRegion( RawReader &reader, const Vec3i &dataSize, const Vec3i &begin, const Vec3i &end, RawRegion &region )
+{
+	region.begin = Vec3i( ( std::max )( begin.x, 0 ), ( std::max )( begin.y, 0 ), ( std::max )( begin.z, 0 ) );
+	region.end = Vec3i( ( std::min )( end.x, dataSize.x ), ( std::min )( end.y, dataSize.y ), ( std::min )( end.z, dataSize.z ) );
+	const Vec3i size( ( std::max )( region.end.x - region.begin.x, 0 ), ( std::max )( region.end.y - region.begin.y, 0 ), ( std::max )( region.end.z - region.begin.z, 0 ) );
+	region.data.resize( std::size_t( size.x ) * size.y * size.z * reader.GetElementSize() );
+	if ( region.data.empty() == false ) {
+		reader.readRegion( region.begin, Size3( size.x, size.y, size.z ), region.data.data() );
+	}
+}
+
+/**
+ * \brief Copies the block starting at voxel \a start (it could be negative because of the padding)
+ * out of the region, the voxels outside of the region are zero. Voxels are \a es bytes.
+ */
+void BrickBlock( const RawRegion &region, const Vec3i &start, int blockSide, std::size_t es, unsigned char *dst )
+{
+	const auto &lo = region.begin, &hi = region.end;
+	const int x0 = ( std::max )( start.x, lo.x ), x1 = ( std::min )( start.x + blockSide, hi.x );
+	for ( int z = 0; z < blockSide; z++ ) {
+		const int gz = start.z + z;
+		for ( int y = 0; y < blockSide; y++ ) {
+			const int gy = start.y + y;
+			auto row = dst + ( std::size_t( z ) * blockSide + y ) * blockSide * es;
+			if ( gz < lo.z || gz >= hi.z || gy < lo.y || gy >= hi.y || x1 <= x0 ) {
+				memset( row, 0, blockSide * es );
+				continue;
+			}
+			const auto src = region.data.data() + ( std::size_t( gz - lo.z ) * ( hi.y - lo.y ) + ( gy - lo.y ) ) * ( hi.x - lo.x ) * es;
+			memset( row, 0, ( x0 - start.x ) * es );
+			memcpy( row + ( x0 - start.x ) * es, src + ( x0 - lo.x ) * es, ( x1 - x0 ) * es );
+			memset( row + ( x1 - start.x ) * es, 0, ( start.x + blockSide - x1 ) * es );
+		}
+	}
+}
+}  // namespace
+
+bool ConvertRawToLVD( const LVDConvertOptions &options )
+{
+	const auto &dataSize = options.dataSize;
+	const int blockSide = 1 << options.blockSideInLog;
+	const int step = blockSide - 2 * options.padding;
+	if ( step <= 0 || dataSize.x <= 0 || dataSize.y <= 0 || dataSize.z <= 0 ) {
+		LOG_ERROR << "lvdconvert: bad block size, padding or data size";
+		return false;
+	}
+
+	const std::size_t es = LVDVoxelBytes( options.voxelType );
+	RawReader reader( options.rawFileName, Size3( dataSize.x, dataSize.y, dataSize.z ), es );
+	std::unique_ptr<LVDFile> single;
+	std::unique_ptr<LVDShardedFile> sharded;
+	if ( options.shardCount > 1 ) {
+		sharded.reset( new LVDShardedFile( options.lvdFileName, options.shardCount, options.striping, options.blockSideInLog, dataSize, options.padding, options.flags, options.voxelType ) );
+		if ( sharded->Valid() == false ) {
+			return false;
+		}
+	} else {
+		single.reset( new LVDFile( options.lvdFileName, options.blockSideInLog, dataSize, options.padding, LVD_VERSION_2, options.flags, options.voxelType ) );
+		if ( single->Valid() == false ) {
+			return false;
+		}
+	}
+	LVDFile &lvd = sharded ? *sharded->Shard( 0 ) : *single;  // the geometry
+
+	if ( options.flushInterval > 0 ) {
+		if ( sharded ) {
+			sharded->StartBackgroundFlush( std::chrono::milliseconds( options.flushInterval ) );
+		} else {
+			lvd.StartBackgroundFlush( std::chrono::milliseconds( options.flushInterval ) );
+		}
+	}
+
+	const auto blockDim = lvd.SizeByBlock();
+	const std::size_t rowBlocks = blockDim.x * blockDim.y;
+	const int threadCount = options.threadCount > 0 ? options.threadCount : ( std::max )( 1u, std::thread::hardware_concurrency() );
+
+	// a linear level is converted by Z-slabs of one block row, a Morton level by cubic cells of cellSide^3
+	// blocks in Morton order, the blocks of a cell in Morton order too. The Morton code of a block is the
+	// code of its cell followed by its code in the cell, so the file is written in the Morton order.
+	const bool morton = lvd.MortonOrder();
+	int cellSide = 1;
+	auto cellBytes = [ & ]( int side ) { return std::size_t( side * step + 2 * options.padding ) * ( side * step + 2 * options.padding ) * ( side * step + 2 * options.padding ) * es; };
+	while ( morton && std::size_t( cellSide ) < ( std::max )( { blockDim.x, blockDim.y, blockDim.z } ) && 2 * cellBytes( 2 * cellSide ) <= options.memoryBudget ) {
+		cellSide *= 2;
+	}
+	const Size3 cellDim( vm::RoundUpDivide( blockDim.x, std::size_t( cellSide ) ), vm::RoundUpDivide( blockDim.y, std::size_t( cellSide ) ), vm::RoundUpDivide( blockDim.z, std::size_t( cellSide ) ) );
+	const auto cellOrder = morton ? LVDMortonOrder( cellDim ) : std::vector<uint64_t>();
+	const auto orderInCell = morton ? LVDMortonOrder( Size3( cellSide, cellSide, cellSide ) ) : std::vector<uint64_t>();
+	const std::size_t unitCount = morton ? cellOrder.size() : blockDim.z;
+
+	const std::size_t unitBytes = morton ? cellBytes( cellSide ) : std::size_t( dataSize.x ) * dataSize.y * blockSide * es;
+	const bool prefetch = 2 * unitBytes <= options.memoryBudget;
+	if ( unitBytes > options.memoryBudget ) {
+		LOG_WARNING << "lvdconvert: a raw region (" << unitBytes << " bytes) exceeds the memory budget";
+	}
+
+	auto unitOf = [ & ]( std::size_t u, ConvertUnit &unit ) {
+		unit.blockIds.clear();
+		if ( morton == false ) {
+			unit.begin = Vec3i( 0, 0, int( u ) * step - options.padding );
+			unit.end = Vec3i( dataSize.x, dataSize.y, unit.begin.z + blockSide );
+			for ( std::size_t i = 0; i < rowBlocks; i++ ) {
+				unit.blockIds.push_back( u * rowBlocks + i );
+			}
+			return;
+		}
+		const std::size_t c = cellOrder[ u ];
+		const Vec3i cell( int( c % cellDim.x ), int( c / cellDim.x % cellDim.y ), int( c / ( cellDim.x * cellDim.y ) ) );
+		const Vec3i first = cell * cellSide;
+		const Vec3i last( ( std::min )( first.x + cellSide, int( blockDim.x ) ) - 1, ( std::min )( first.y + cellSide, int( blockDim.y ) ) - 1, ( std::min )( first.z + cellSide, int( blockDim.z ) ) - 1 );
+		unit.begin = first * step - Vec3i( options.padding, options.padding, options.padding );
+		unit.end = last * step - Vec3i( options.padding, options.padding, options.padding ) + Vec3i( blockSide, blockSide, blockSide );
+		for ( const auto l : orderInCell ) {
+			const Vec3i b = first + Vec3i( int( l % cellSide ), int( l / cellSide % cellSide ), int( l / ( cellSide * cellSide ) ) );
+			if ( b.x <= last.x && b.y <= last.y && b.z <= last.z ) {
+				unit.blockIds.push_back( ( std::size_t( b.z ) * blockDim.y + b.y ) * blockDim.x + b.x );
+			}
+		}
+	};
+	auto readUnit = [ & ]( std::size_t u, ConvertUnit &unit, RawRegion &region ) {
+		unitOf( u, unit );
+		ReadRegion( reader, dataSize, unit.begin, unit.end, region );
+	};
+
+	ConvertUnit currentUnit, nextUnit;
+	RawRegion current, next;
+	readUnit( 0, currentUnit, current );
+	for ( std::size_t u = 0; u < unitCount; u++ ) {
+		std::future<void> reading;
+		if ( prefetch && u + 1 < unitCount ) {
+			reading = std::async( std::launch::async, readUnit, u + 1, std::ref( nextUnit ), std::ref( next ) );
+		}
+
+		std::atomic<std::size_t> nextBlock{ 0 };
+		auto work = [ & ]() {
+			std::vector<unsigned char> block( lvd.BlockBytes() );
+			for ( std::size_t i; ( i = nextBlock++ ) < currentUnit.blockIds.size(); ) {
+				const std::size_t id = currentUnit.blockIds[ i ];
+				const int bx = id % blockDim.x, by = id / blockDim.x % blockDim.y, bz = id / rowBlocks;
+				const Vec3i start( bx * step - options.padding, by * step - options.padding, bz * step - options.padding );
+				BrickBlock( current, start, blockSide, es, block.data() );
+				if ( sharded ) {
+					sharded->WriteBlock( (const char *)block.data(), id );
+				} else {
+					lvd.WriteBlock( (const char *)block.data(), id );
+				}
+			}
+		};
+		std::vector<std::thread> workers;
+		for ( int t = 1; t < threadCount; t++ ) {
+			workers.emplace_back( work );
+		}
+		work();
+		for ( auto &t : workers ) {
+			t.join();
+		}
+
+		if ( u + 1 < unitCount ) {
+			if ( reading.valid() ) {
+				reading.get();
+			} else {
+				readUnit( u + 1, nextUnit, next );
+			}
+			std::swap( current, next );
+			std::swap( currentUnit, nextUnit );
+		}
+		LOG_INFO << "lvdconvert: " << u + 1 << "/" << unitCount << ( morton ? " cells" : " block rows" );
+	}
+	if ( sharded ) {
+		sharded->Close();
+	} else {
+		lvd.Close();
+	}
+	return true;
+}
+}  // namespace vm
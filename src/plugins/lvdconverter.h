@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <VMat/geometry.h>
+
+#include "lvdfileheader.h"
+#include "lvdshardedfile.h"
+
+namespace vm
+{
+struct LVDConvertOptions
+{
+	std::string rawFileName;
+	std::string lvdFileName;
+	Vec3i dataSize;
+	int blockSideInLog = 6;
+	int padding = 2;
+	int threadCount = 0;					   // 0 means the hardware concurrency
+	std::size_t memoryBudget = 4ULL << 30;	   // bytes of the raw slabs in flight
+	uint32_t flags = LVD_FLAG_SPARSE;
+	LVDVoxelType voxelType = LVD_VOXEL_UINT8;  // of the raw and the LVD, in native byte order
+	int flushInterval = 0;	// ms between background flushes of the written blocks, 0 only flushes at the end
+	int shardCount = 1;		// more than 1 writes a sharded LVD, lvdFileName is then its manifest
+	LVDStriping striping = LVD_STRIPING_ROUND_ROBIN;
+};
+
+/**
+ * \brief Converts a raw volume into a LVD file.
+ *
+ * The raw is streamed in Z-slabs of one block row each (plus the padding of the neighbouring rows), the next
+ * slab is read while the blocks of the current one are bricked, encoded and written by a pool of threads.
+ * Only two slabs are kept in memory, or one if two do not fit in \a memoryBudget.
+ *
+ * With LVD_FLAG_MORTON the raw is streamed in cubic cells of blocks instead, as large as the budget allows,
+ * and the cells and the blocks in them are written in Morton order.
+ *
+ * A sharded LVD is written by the same workers, each block to its own shard, so the writes to the shards
+ * proceed in parallel.
+ */
+bool ConvertRawToLVD( const LVDConvertOptions &options );
+}  // namespace vm
@@ -1,15 +1,84 @@
 
 #include <iostream>
 #include <fstream>
+#include <filesystem>
 #include <VMFoundation/libraryloader.h>
 #include <VMFoundation/pluginloader.h>
 #include <VMFoundation/logger.h>
 #include "lvdfile.h"
+#include "lvdcodec.h"
+#include "lvdpagereader.h"
+#include <map>
+#include <algorithm>
+#include <thread>
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#include <emmintrin.h>
+#define LVD_STREAMING_STORES
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace vm
 {
-void LVDFile::InitLVDIO()
+namespace
+{
+enum
+{
+	StreamingStoreBytes = 32 << 20	// outputs from about the size of a last level cache
+};
+
+/**
+ * \brief Copies with non-temporal stores, so a large output does not evict the blocks being read.
+ * StoreFence() must be called before the data is read by another thread.
+ */
+void StreamCopy( unsigned char *dst, const unsigned char *src, std::size_t bytes )
+{
+#ifdef LVD_STREAMING_STORES
+	const std::size_t head = ( std::min )( ( 16 - ( uintptr_t( dst ) & 15 ) ) & 15, bytes );
+	memcpy( dst, src, head );
+	std::size_t i = head;
+	for ( ; i + 16 <= bytes; i += 16 ) {
+		_mm_stream_si128( (__m128i *)( dst + i ), _mm_loadu_si128( (const __m128i *)( src + i ) ) );
+	}
+	memcpy( dst + i, src + i, bytes - i );
+#else
+	memcpy( dst, src, bytes );
+#endif
+}
+
+void StoreFence()
+{
+#ifdef LVD_STREAMING_STORES
+	_mm_sfence();
+#endif
+}
+
+/**
+ * \brief 64-bit hash of the encoded bytes of a block, extents with equal hashes are still compared in full
+ */
+uint64_t HashExtent( const unsigned char *bytes, std::size_t size )
+{
+	uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+	std::size_t i = 0;
+	for ( ; i + sizeof( uint64_t ) <= size; i += sizeof( uint64_t ) ) {
+		uint64_t word;
+		memcpy( &word, bytes + i, sizeof( uint64_t ) );
+		h = ( h ^ word ) * 0xff51afd7ed558ccdull;
+		h ^= h >> 32;
+	}
+	for ( ; i < size; i++ ) {
+		h = ( h ^ bytes[ i ] ) * 0x100000001b3ull;
+	}
+	return h ^ ( h >> 29 );
+}
+}  // namespace
+
+Ref<IMappingFile> LVDFile::InitLVDIO()
 {
+	Ref<IMappingFile> lvdIO;
 #ifdef _WIN32
 	lvdIO = PluginLoader::GetPluginLoader()->CreatePlugin<IMappingFile>( "windows" );
 #else defined( __linux__ ) || defined( __APPLE__ )
@@ -17,209 +86,1246 @@ void LVDFile::InitLVDIO()
 #endif
 	if ( lvdIO == nullptr )
 		throw std::runtime_error( "can not load ioplugin" );
+	return lvdIO;
 }
 
-void LVDFile::InitInfoByHeader(const LVDFileHeader & header){
-	int vx = header.dataDim[ 0 ];
-	int vy = header.dataDim[ 1 ];
-	int vz = header.dataDim[ 2 ];
-	logBlockSize = header.blockLengthInLog;
-	padding = header.padding;
+bool LVDFile::InitInfoByHeader( const LVDFileHeader &header, LODLevel &level )
+{
+	const uint64_t vx = header.dataDim[ 0 ];
+	const uint64_t vy = header.dataDim[ 1 ];
+	const uint64_t vz = header.dataDim[ 2 ];
+	level.logBlockSize = header.blockLengthInLog;
+	level.padding = header.padding;
 
-	const int originalWidth = header.originalDataDim[ 0 ];
-	const int originalHeight = header.originalDataDim[ 1 ];
-	const int originalDepth = header.originalDataDim[ 2 ];
+	const uint64_t originalWidth = header.originalDataDim[ 0 ];
+	const uint64_t originalHeight = header.originalDataDim[ 1 ];
+	const uint64_t originalDepth = header.originalDataDim[ 2 ];
 
-	if ( logBlockSize != LogBlockSize5 && logBlockSize != LogBlockSize6 && logBlockSize != LogBlockSize7 ) {
+	if ( level.logBlockSize != LogBlockSize5 && level.logBlockSize != LogBlockSize6 && level.logBlockSize != LogBlockSize7 ) {
 		std::cout << "Unsupported block size\n";
-		validFlag = false;
-		return;
+		return false;
+	}
+	if ( header.voxelType > LVD_VOXEL_FLOAT32 ) {
+		std::cout << "Unsupported voxel type\n";
+		return false;
 	}
 
-	const size_t aBlockSize = BlockSize();
+	const uint64_t aBlockSize = uint64_t( 1 ) << level.logBlockSize;
 
 	// aBlockSize must be power of 2, e.g. 32 or 64
-	const int bx = ( ( vx + aBlockSize - 1 ) & ~( aBlockSize - 1 ) ) / aBlockSize;
-	const int by = ( ( vy + aBlockSize - 1 ) & ~( aBlockSize - 1 ) ) / aBlockSize;
-	const int bz = ( ( vz + aBlockSize - 1 ) & ~( aBlockSize - 1 ) ) / aBlockSize;
-
-	vSize = vm::Size3( ( vx ), ( vy ), ( vz ) );
-	bSize = vm::Size3( bx, by, bz );
-	oSize = vm::Size3( originalWidth, originalHeight, originalDepth );
+	const uint64_t bx = ( ( vx + aBlockSize - 1 ) & ~( aBlockSize - 1 ) ) / aBlockSize;
+	const uint64_t by = ( ( vy + aBlockSize - 1 ) & ~( aBlockSize - 1 ) ) / aBlockSize;
+	const uint64_t bz = ( ( vz + aBlockSize - 1 ) & ~( aBlockSize - 1 ) ) / aBlockSize;
+	if ( ( header.flags & LVD_FLAG_SPARSE ) && bx * by * bz > UINT32_MAX ) {
+		std::cout << "Too many blocks for a sparse level\n";
+		return false;
+	}
 
+	level.vSize = vm::Size3( ( vx ), ( vy ), ( vz ) );
+	level.bSize = vm::Size3( bx, by, bz );
+	level.oSize = vm::Size3( originalWidth, originalHeight, originalDepth );
+	return true;
 }
-LVDFile::LVDFile( const std::string &fileName ) :
-  validFlag( true ), lvdIO( nullptr )
+
+bool LVDFile::MapLevels( const std::string &fileName, std::vector<LODLevel> &lods )
 {
 	std::ifstream fileHandle;
 
 	fileHandle.open( fileName, std::fstream::binary );
 	if ( !fileHandle.is_open() ) {
 		std::cout << "Can not open .lvd\n";
-		validFlag = false;
-		fileHandle.close();
-		return;
+		return false;
 	}
+	fileHandle.seekg( 0, std::ios::end );
+	const std::size_t fileSize = fileHandle.tellg();
 
-	unsigned char headerBuf[ LVD_HEADER_SIZE ];
-
-	fileHandle.read( (char *)headerBuf, LVD_HEADER_SIZE );
-	header.Decode( headerBuf );
+	// A multi-level container is a chain of complete single-level LVDs, so the levels are
+	// found by walking the headers. A plain LVD is a container with one level.
+	const auto first = lods.size();
+	std::size_t offset = 0;
+	while ( offset + LVD_HEADER_SIZE <= fileSize ) {
+		unsigned char headerBuf[ LVD_V2_HEADER_SIZE ] = { 0 };
+		fileHandle.seekg( offset, std::ios::beg );
+		fileHandle.read( (char *)headerBuf, ( std::min )( std::size_t( LVD_V2_HEADER_SIZE ), fileSize - offset ) );
+		fileHandle.clear();
 
+		LODLevel level;
+		level.header.Decode( headerBuf );
+		if ( level.header.magicNum != LVDFileMagicNumber && level.header.magicNum != LVDFileMagicNumberV2 ) {
+			break;
+		}
+		if ( InitInfoByHeader( level.header, level ) == false ) {
+			return false;
+		}
+		const std::size_t levelBytes = level.header.levelBytes;
+		if ( levelBytes < std::size_t( level.header.HeaderSize() ) || offset + levelBytes > fileSize ) {
+			std::cout << "Truncated level in .lvd\n";
+			break;
+		}
+		if ( level.header.version >= LVD_VERSION_2 &&
+			 ( level.header.blockTableOffset + sizeof( LVDBlockEntry ) * BlockCount( level ) > levelBytes ||
+			   level.header.payloadEnd > levelBytes ||
+			   ( level.header.statsOffset && level.header.statsOffset + sizeof( LVDBlockStats ) * BlockCount( level ) > levelBytes ) ) ) {
+			std::cout << "Bad block table in .lvd\n";
+			return false;
+		}
+		level.fileName = fileName;
+		level.levelOffset = offset;
+		level.mappedBytes = levelBytes;
+		level.lastInFile = false;
+		lods.push_back( std::move( level ) );
+		offset += levelBytes;
+	}
 	fileHandle.close();
 
-	//uint32_t magicNumber;
-	//fileHandle.read((char*)&magicNumber, sizeof(int));
-
-	if ( header.magicNum != LVDFileMagicNumber ) {
+	if ( lods.size() == first ) {
 		std::cout << " This is not a lvd file\n";
-		validFlag = false;
-		fileHandle.close();
-		return;
+		return false;
 	}
+	lods.back().lastInFile = true;
 
-	//int vx, vy, vz, bx, by, bz;
-	//int m_originalWidth, m_originalHeight, m_originalDepth;
+	auto lvdIO = InitLVDIO();
+	if ( readOnly ) {
+		lvdIO->Open( fileName, offset, FileAccess::Read, MapAccess::ReadOnly );
+	} else {
+		lvdIO->Open( fileName, offset, FileAccess::ReadWrite, MapAccess::ReadWrite );
+	}
 
-	/*fileHandle.read((char*)&vx, sizeof(int));
-		fileHandle.read((char*)&vy, sizeof(int));
-		fileHandle.read((char*)&vz, sizeof(int));
-		fileHandle.read((char*)&logBlockSize, sizeof(int));
-		fileHandle.read((char*)&repeat, sizeof(int));
-		fileHandle.read((char*)&m_originalWidth, sizeof(int));
-		fileHandle.read((char*)&m_originalHeight, sizeof(int));
-		fileHandle.read((char*)&m_originalDepth, sizeof(int));*/
+	const auto lvdPtr = lvdIO->MemoryMap( 0, offset );
+	if ( !lvdPtr ) throw std::runtime_error( "LVDReader: bad mapping" );
 
-	int vx = header.dataDim[ 0 ];
-	int vy = header.dataDim[ 1 ];
-	int vz = header.dataDim[ 2 ];
-	logBlockSize = header.blockLengthInLog;
-	padding = header.padding;
+	for ( auto i = first; i < lods.size(); i++ ) {
+		BindLevel( lods[ i ], lvdPtr + lods[ i ].levelOffset, lvdIO );
+		IndexLevel( lods[ i ] );
+	}
+	return true;
+}
 
-	const int originalWidth = header.originalDataDim[ 0 ];
-	const int originalHeight = header.originalDataDim[ 1 ];
-	const int originalDepth = header.originalDataDim[ 2 ];
+void LVDFile::BindLevel( LODLevel &level, unsigned char *levelPtr, Ref<IMappingFile> io )
+{
+	level.levelPtr = levelPtr;
+	level.dataPtr = levelPtr + level.header.payloadOffset;
+	level.blockTable = level.header.version >= LVD_VERSION_2 ? (LVDBlockEntry *)( levelPtr + level.header.blockTableOffset ) : nullptr;
+	level.stats = level.header.statsOffset ? (LVDBlockStats *)( levelPtr + level.header.statsOffset ) : nullptr;
+	level.occupancy = level.header.flags & LVD_FLAG_SPARSE ? LVDOccupancy( levelPtr, BlockCount( level ) ) : LVDOccupancy();
+	level.io = std::move( io );
+	level.slots.clear();
+	if ( level.header.flags & LVD_FLAG_MORTON ) {
+		const auto order = LVDMortonOrder( level.bSize );
+		level.slots.resize( order.size() );
+		for ( std::size_t slot = 0; slot < order.size(); slot++ ) {
+			level.slots[ order[ slot ] ] = slot;
+		}
+	}
+	const auto wordCount = LVDOccupancy::WordCount( BlockCount( level ) );
+	level.dirty.reset( new std::atomic<uint64_t>[ wordCount ] );
+	for ( std::size_t w = 0; w < wordCount; w++ ) {
+		level.dirty[ w ] = 0;
+	}
+}
 
-	if ( logBlockSize != LogBlockSize5 && logBlockSize != LogBlockSize6 && logBlockSize != LogBlockSize7 ) {
-		std::cout << "Unsupported block size\n";
-		validFlag = false;
-		return;
+LVDBlockEntry *LVDFile::FindBlock( const LODLevel &level, std::size_t blockId )
+{
+	LVDBlockEntry *entry = nullptr;
+	const auto slot = Slot( level, blockId );
+	if ( level.occupancy.Valid() ) {
+		entry = level.occupancy.Test( slot ) ? level.blockTable + level.occupancy.Rank( slot ) : nullptr;
+	} else {
+		entry = level.blockTable + slot;
 	}
+	return entry && entry->length ? entry : nullptr;
+}
 
-	const size_t aBlockSize = BlockSize();
+std::size_t LVDFile::SlotBlock( const LODLevel &level, std::size_t slot )
+{
+	return level.slots.empty() ? slot : std::find( level.slots.begin(), level.slots.end(), slot ) - level.slots.begin();
+}
 
-	// aBlockSize must be power of 2, e.g. 32 or 64
-	const int bx = ( ( vx + aBlockSize - 1 ) & ~( aBlockSize - 1 ) ) / aBlockSize;
-	const int by = ( ( vy + aBlockSize - 1 ) & ~( aBlockSize - 1 ) ) / aBlockSize;
-	const int bz = ( ( vz + aBlockSize - 1 ) & ~( aBlockSize - 1 ) ) / aBlockSize;
+void LVDFile::IndexLevel( LODLevel &level )
+{
+	if ( level.blockTable == nullptr ) {
+		return;
+	}
+	if ( readOnly && level.occupancy.Valid() ) {
+		const auto slot = level.occupancy.FirstAbsent();
+		if ( slot < BlockCount( level ) ) {
+			level.absentInstance = SlotBlock( level, slot );
+		}
+	} else if ( readOnly ) {
+		level.absentOnce.reset( new std::once_flag );
+	}
+	if ( ( level.header.flags & LVD_FLAG_DEDUP ) == 0 ) {
+		return;
+	}
+	if ( readOnly ) {
+		level.instances.resize( BlockCount( level ) );
+	} else {
+		level.dedup.reset( new DedupIndex );
+	}
+	std::unordered_map<uint64_t, uint64_t> firstOfExtent;
+	for ( std::size_t id = 0; id < BlockCount( level ); id++ ) {
+		const auto entry = FindBlock( level, id );
+		if ( entry == nullptr ) {
+			continue;
+		}
+		if ( readOnly ) {
+			level.instances[ id ] = firstOfExtent.emplace( entry->offset, id ).first->second;
+		} else if ( entry->offset + entry->length <= level.mappedBytes ) {
+			auto &extent = level.dedup->extents[ entry->offset ];
+			if ( extent.refs++ == 0 ) {
+				extent.hash = HashExtent( level.levelPtr + entry->offset, entry->length );
+				extent.length = entry->length;
+				extent.codec = entry->codec;
+				level.dedup->offsets.emplace( extent.hash, entry->offset );
+			}
+		}
+	}
+}
 
-	vSize = vm::Size3( ( vx ), ( vy ), ( vz ) );
-	bSize = vm::Size3( bx, by, bz );
-	oSize = vm::Size3( originalWidth, originalHeight, originalDepth );
+void LVDFile::CompactLevel( LODLevel &level )
+{
+	// the table is indexed by block id while writing, a sparse level only keeps the occupied entries
+	const auto blockCount = BlockCount( level );
+	LVDOccupancy::Build( level.blockTable, blockCount, level.levelPtr );
+	std::size_t slot = 0;
+	for ( std::size_t i = 0; i < blockCount; i++ ) {
+		if ( level.blockTable[ i ].length != 0 ) {
+			level.blockTable[ slot++ ] = level.blockTable[ i ];
+		}
+	}
+	memset( level.blockTable + slot, 0, sizeof( LVDBlockEntry ) * ( blockCount - slot ) );
+	level.occupancy = LVDOccupancy( level.levelPtr, blockCount );
+}
 
-	const std::size_t bytes = std::size_t( vx ) * vy * vz + LVD_HEADER_SIZE;
+void LVDFile::FinalizeLevels()
+{
+	if ( writable == false ) {
+		return;
+	}
+	// v2 payloads only know their end after writing, so the headers are updated and the
+	// unused tail of the last level of a file is cut
+	std::vector<std::pair<std::string, std::size_t>> trims;
+	for ( auto &level : levels ) {
+		if ( level.header.version < LVD_VERSION_2 || level.levelPtr == nullptr ) {
+			continue;
+		}
+		if ( ( level.header.flags & LVD_FLAG_SPARSE ) && level.occupancy.Valid() == false ) {
+			CompactLevel( level );
+		}
+		if ( level.lastInFile ) {
+			level.header.levelBytes = level.header.payloadEnd;
+			trims.emplace_back( level.fileName, level.levelOffset + level.header.levelBytes );
+		}
+		memcpy( level.levelPtr, level.header.Encode(), LVD_V2_HEADER_SIZE );
+		level.io->Flush( level.levelPtr, level.header.payloadEnd, 0 );
+	}
+	for ( auto &level : levels ) {
+		if ( level.io != nullptr ) {
+			level.io->Close();
+		}
+	}
+	levels.clear();
+	for ( auto &io : retiredMappings ) {
+		io->Close();
+	}
+	retiredMappings.clear();
+	for ( const auto &trim : trims ) {
+		std::error_code ec;
+		std::filesystem::resize_file( trim.first, trim.second, ec );
+		if ( ec ) {
+			LOG_ERROR << "LVDFile: failed to trim " << trim.first << ": " << ec.message();
+		}
+	}
+	writable = false;
+}
 
-	InitLVDIO();
-	lvdIO->Open( fileName, bytes, FileAccess::ReadWrite, MapAccess::ReadWrite );
+LVDFile::LVDFile( const std::string &fileName, bool readOnly ) :
+  fileName( fileName ), validFlag( true ), readOnly( readOnly )
+{
+	validFlag = MapLevels( fileName, levels );
+	if ( validFlag && readOnly ) {
+		SetAccessPattern( LVD_ADVICE_RANDOM );
+	}
+}
 
-	lvdPtr = lvdIO->MemoryMap( 0, bytes );
-	if ( !lvdPtr ) throw std::runtime_error( "LVDReader: bad mapping" );
+LVDFile::LVDFile( const std::vector<std::string> &fileName, const std::vector<int> &lods, bool readOnly ) :
+  validFlag( true ), readOnly( readOnly )
+{
+	// lods selects the listed levels to open, all of them by default
+	std::vector<int> levelOfDetails = lods;
+	if ( levelOfDetails.size() == 0 ) {
+		for ( std::size_t i = 0; i < fileName.size(); i++ )
+			levelOfDetails.push_back( int( i ) );
+	}
+	for ( const auto lod : levelOfDetails ) {
+		if ( lod < 0 || std::size_t( lod ) >= fileName.size() ) {
+			std::cout << "LOD " << lod << " is out of the file list\n";
+			validFlag = false;
+			return;
+		}
+		// Every file contributes all of its levels, so a list of containers is also accepted
+		if ( MapLevels( fileName[ lod ], levels ) == false ) {
+			validFlag = false;
+			return;
+		}
+	}
+	if ( fileName.empty() == false ) {
+		this->fileName = fileName[ 0 ];
+	}
+	if ( validFlag && readOnly ) {
+		SetAccessPattern( LVD_ADVICE_RANDOM );
+	}
 }
 
-LVDFile::LVDFile( const std::vector<std::string> &fileName, const std::vector<int> &lods )
+LVDFile::LVDFile( const std::string &fileName, int blockSideInLog, const Vec3i &dataSize, int padding, int version, uint32_t flags, LVDVoxelType voxelType ) :
+  LVDFile( fileName, blockSideInLog, std::vector<Vec3i>{ dataSize }, padding, version, flags, voxelType )
 {
-	std::vector<int> levelOfDetails;
-	if ( lods.size() == 0 ) {
-		for ( int i = 0; i < fileName.size(); i++ )
-			levelOfDetails.push_back( i );
-	} 
 }
-LVDFile::LVDFile( const std::string & fileName,int blockSideInLog, const Vec3i &dataSize, int padding )
+
+LVDFile::LVDFile( const std::string &fileName, int blockSideInLog, const std::vector<Vec3i> &lodDataSize, int padding, int version, uint32_t flags, LVDVoxelType voxelType ) :
+  fileName( fileName ), validFlag( true ), writable( true )
 {
-	header.magicNum = LVDFileMagicNumber;
-	header.blockLengthInLog = (uint32_t)blockSideInLog;
-	header.padding = padding;
 	if (blockSideInLog < 5 || blockSideInLog > 10) {
 		LOG_FATAL << "Too large block size";
 	}
+	if ( voxelType != LVD_VOXEL_UINT8 && version < LVD_VERSION_2 ) {
+		LOG_ERROR << "LVDFile: v1 files only have 8-bit voxels";
+		validFlag = false;
+		writable = false;
+		return;
+	}
+	const std::size_t voxelBytes = LVDVoxelBytes( voxelType );
 	const auto blockSide = (1ULL << blockSideInLog);
 	auto f = [ &blockSide, &padding ]( int x ) { return vm::RoundUpDivide(x,blockSide - 2ULL * padding)*blockSide; };
-	const size_t dataX = f( dataSize.x );
-	const size_t dataY = f( dataSize.y );
-	const size_t dataZ = f( dataSize.z );
-	header.dataDim[ 0 ] = dataX;
-	header.dataDim[ 1 ] = dataY;
-	header.dataDim[ 2 ] = dataZ;
-	header.originalDataDim[ 0 ] = dataSize.x;
-	header.originalDataDim[ 1 ] = dataSize.y;
-	header.originalDataDim[ 2 ] = dataSize.z;
-
-	unsigned char headerBuf[ LVD_HEADER_SIZE ];
-	header.Encode();
-	memcpy( headerBuf, header.Encode(), LVD_HEADER_SIZE );
 
-	InitLVDIO();
+	std::size_t fileSize = 0;
+	for ( const auto &dataSize : lodDataSize ) {
+		LODLevel level;
+		auto &header = level.header;
+		header.magicNum = version >= LVD_VERSION_2 ? LVDFileMagicNumberV2 : LVDFileMagicNumber;
+		header.blockLengthInLog = (uint32_t)blockSideInLog;
+		header.padding = padding;
+		const size_t dataX = f( dataSize.x );
+		const size_t dataY = f( dataSize.y );
+		const size_t dataZ = f( dataSize.z );
+		header.dataDim[ 0 ] = dataX;
+		header.dataDim[ 1 ] = dataY;
+		header.dataDim[ 2 ] = dataZ;
+		header.originalDataDim[ 0 ] = dataSize.x;
+		header.originalDataDim[ 1 ] = dataSize.y;
+		header.originalDataDim[ 2 ] = dataSize.z;
+		if ( version >= LVD_VERSION_2 ) {
+			// [header][(sparse) occupancy index][block table][payload], the payload is page aligned and could
+			// grow up to the raw size. The file is only allocated where it is written and trimmed on close.
+			const std::size_t blockCount = ( dataX / blockSide ) * ( dataY / blockSide ) * ( dataZ / blockSide );
+			header.version = LVD_VERSION_2;
+			header.flags = flags;
+			if ( ( flags & LVD_FLAG_SPARSE ) && blockCount > UINT32_MAX ) {
+				// the rank directory of the occupancy index counts in 32 bits
+				LOG_WARNING << "LVDFile: a level of " << blockCount << " blocks is stored dense";
+				header.flags &= ~LVD_FLAG_SPARSE;
+			}
+			header.voxelType = voxelType;
+			header.blockTableOffset = LVD_V2_HEADER_SIZE + ( header.flags & LVD_FLAG_SPARSE ? LVDOccupancy::IndexBytes( blockCount ) : 0 );
+			header.statsOffset = header.blockTableOffset + blockCount * sizeof( LVDBlockEntry );
+			header.payloadOffset = vm::RoundUpDivide( header.statsOffset + blockCount * sizeof( LVDBlockStats ), uint64_t( LVD_BLOCK_ALIGNMENT ) ) * LVD_BLOCK_ALIGNMENT;
+			header.payloadEnd = header.payloadOffset;
+			header.levelBytes = header.payloadOffset + dataX * dataY * dataZ * voxelBytes;
+		} else {
+			header.levelBytes = dataX * dataY * dataZ + LVD_HEADER_SIZE;
+			header.payloadOffset = LVD_HEADER_SIZE;
+		}
+		validFlag = InitInfoByHeader( header, level ) && validFlag;
 
-	const auto fileSize = dataX * dataY * dataZ + LVD_HEADER_SIZE;
+		level.fileName = fileName;
+		level.levelOffset = fileSize;
+		level.mappedBytes = header.levelBytes;
+		level.lastInFile = false;
+		fileSize += header.levelBytes;
+		levels.push_back( std::move( level ) );
+	}
+	if ( levels.empty() ) {
+		validFlag = false;
+		return;
+	}
+	levels.back().lastInFile = true;
 
+	auto lvdIO = InitLVDIO();
 	lvdIO->Open( fileName.c_str(), fileSize, FileAccess::ReadWrite, MapAccess::ReadWrite );
-	lvdPtr = lvdIO->MemoryMap( 0, fileSize );
+	const auto lvdPtr = lvdIO->MemoryMap( 0, fileSize );
 	if ( !lvdPtr ) 
 		throw std::runtime_error( "LVDReader: bad mapping" );
 
-	memcpy(lvdPtr,headerBuf,LVD_HEADER_SIZE);
-	lvdIO->Flush(lvdPtr,LVD_HEADER_SIZE,0);
-	InitInfoByHeader(header);
+	for ( auto &level : levels ) {
+		// a sparse level is written with a dense table and only marked sparse when it is compacted,
+		// so an unfinished file is still readable
+		const auto flags = level.header.flags;
+		level.header.flags &= ~LVD_FLAG_SPARSE;
+		const auto headerSize = level.header.HeaderSize();
+		memcpy( lvdPtr + level.levelOffset, level.header.Encode(), headerSize );
+		lvdIO->Flush( lvdPtr + level.levelOffset, headerSize, 0 );
+		BindLevel( level, lvdPtr + level.levelOffset, lvdIO );
+		level.header.flags = flags;
+		if ( level.blockTable ) {
+			// the file may exist before
+			memset( level.blockTable, 0, sizeof( LVDBlockEntry ) * BlockCount( level ) );
+			memset( level.stats, 0, sizeof( LVDBlockStats ) * BlockCount( level ) );
+		}
+		if ( level.blockTable && ( flags & LVD_FLAG_DEDUP ) ) {
+			level.dedup.reset( new DedupIndex );
+		}
+	}
 }
 
+void LVDFile::ReadBlock( char *dest, std::size_t blockId, int lod )
+{
+	const size_t blockCount = BlockBytes( lod );
+	const auto &level = levels[ lod ];
+	if ( directIO ) {
+		const auto location = LocateBlock( blockId, lod );
+		if ( location.length == 0 ) {
+			memset( dest, 0, blockCount );
+		} else {
+			ReadDirect( level, location.offset - level.levelOffset, location.length, location.codec, dest, blockCount );
+		}
+		return;
+	}
+	if ( level.blockTable == nullptr ) {
+		const auto d = level.dataPtr;
+		//fileHandle.seekg(blockCount * blockId + 36, std::ios::beg);
+		memcpy( dest, d + blockCount * blockId, sizeof( char ) * blockCount );
+		//fileHandle.read(dest, sizeof(char) * blockCount);
+		return;
+	}
+
+	const auto found = FindBlock( level, blockId );
+	if ( found == nullptr ) {
+		memset( dest, 0, blockCount );
+		return;
+	}
+	const auto entry = *found;
+	if ( entry.offset + entry.length > level.mappedBytes ||
+		 LVDCodec::Decode( LVDBlockCodec( entry.codec ), level.levelPtr + entry.offset, entry.length, (unsigned char *)dest, blockCount ) == false ) {
+		throw std::runtime_error( "LVDReader: corrupted block" );
+	}
+}
 
-void LVDFile::ReadBlock( char *dest, int blockId, int lod )
+void LVDFile::WriteBlock( const char *src, std::size_t blockId, int lod )
 {
-	const size_t blockCount = BlockDataCount();
-	const auto d = lvdPtr + LVD_HEADER_SIZE;
+	const size_t blockCount = BlockBytes( lod );
+	auto &level = levels[ lod ];
+	if ( readOnly ) {
+		throw std::runtime_error( "LVDFile: the file is opened read-only" );
+	}
+	if ( level.blockTable == nullptr ) {
+		const auto d = level.dataPtr;
+		memcpy( d + blockCount * blockId, src, sizeof( char ) * blockCount );
+		MarkDirty( level, blockId );
+		return;
+	}
+
+	if ( level.stats ) {
+		ComputeBlockStats( (const unsigned char *)src, BlockDataCount( lod ), level.header.voxelType, level.stats[ Slot( level, blockId ) ] );
+	}
+	const bool elide = ( level.header.flags & LVD_FLAG_SPARSE ) && IsZeroBlock( src, blockCount );
+	if ( level.occupancy.Valid() ) {
+		// the slots of a compacted level are fixed, only the stored blocks could be rewritten in place
+		const auto stored = FindBlock( level, blockId );
+		if ( stored == nullptr || elide ) {
+			throw std::runtime_error( "LVDFile: can not change the occupancy of a finalized sparse level" );
+		}
+	}
+	writable = true;  // the v2 headers are updated and the files trimmed on close
+	if ( elide ) {
+		auto &entry = level.blockTable[ Slot( level, blockId ) ];
+		if ( level.dedup ) {
+			std::lock_guard<std::mutex> lk( level.dedup->mutex );
+			ReleaseExtent( *level.dedup, entry );
+		}
+		entry = LVDBlockEntry{};
+		MarkDirty( level, blockId );
+		return;
+	}
+
+	thread_local std::vector<unsigned char> encoded;
+	const auto codec = LVDCodec::Encode( (const unsigned char *)src, blockCount, encoded );
 
-	//fileHandle.seekg(blockCount * blockId + 36, std::ios::beg);
-	memcpy( dest, d + blockCount * blockId, sizeof( char ) * blockCount );
-	//fileHandle.read(dest, sizeof(char) * blockCount);
+	auto &entry = level.occupancy.Valid() ? *FindBlock( level, blockId ) : level.blockTable[ Slot( level, blockId ) ];
+	if ( level.dedup ) {
+		WriteDeduplicated( level, entry, encoded, codec );
+		MarkDirty( level, blockId );
+		return;
+	}
+	uint64_t offset = 0;
+	if ( entry.length != 0 && encoded.size() <= entry.length ) {
+		offset = entry.offset;	// rewrites in place
+	} else if ( level.occupancy.Valid() ) {
+		throw std::runtime_error( "LVDFile: the block does not fit in its slot" );
+	} else {
+		offset = AllocatePayload( level, encoded.size() );
+	}
+	memcpy( level.levelPtr + offset, encoded.data(), encoded.size() );
+	entry.offset = offset;
+	entry.length = encoded.size();
+	entry.codec = codec;
+	MarkDirty( level, blockId );
 }
 
-void LVDFile::WriteBlock( const char *src, int blockId, int lod )
+uint64_t LVDFile::AllocatePayload( LODLevel &level, std::size_t bytes )
 {
-	(void)lod;
-	const size_t blockCount = BlockDataCount();
-	const auto d = lvdPtr + LVD_HEADER_SIZE;
-	memcpy(d + blockCount * blockId, src, sizeof( char ) * blockCount );
+	const uint64_t slotBytes = level.header.flags & LVD_FLAG_ALIGNED ? vm::RoundUpDivide( uint64_t( bytes ), uint64_t( LVD_BLOCK_ALIGNMENT ) ) * LVD_BLOCK_ALIGNMENT : bytes;
+	std::lock_guard<std::mutex> lk( writeMutex );
+	if ( level.header.payloadEnd + slotBytes > level.mappedBytes && GrowLevel( level, level.header.payloadEnd + slotBytes ) == false ) {
+		throw std::runtime_error( "LVDFile: no space left in the level" );
+	}
+	const auto offset = level.header.payloadEnd;
+	level.header.payloadEnd += slotBytes;
+	return offset;
 }
 
-bool LVDFile::Flush( int blockId, int lod )
+bool LVDFile::GrowLevel( LODLevel &level, uint64_t bytes )
 {
-	assert( lvdPtr );
-	(void)lod;
-	const auto d = lvdPtr + LVD_HEADER_SIZE;
-	const size_t blockCount = BlockDataCount();
-	return lvdIO->Flush( d + blockCount * blockId, sizeof( char ) * blockCount, 0 );
+	if ( level.lastInFile == false ) {
+		return false;  // the next level follows it in the file
+	}
+	// Close cut the payload of a reopened level to its end, it gets the room of the raw blocks back at
+	// once and grows by a quarter after that, so the file is mapped again a few times at most
+	const uint64_t rawBytes = level.header.payloadOffset + level.header.dataDim[ 0 ] * level.header.dataDim[ 1 ] * level.header.dataDim[ 2 ] * LVDVoxelBytes( level.header.voxelType );
+	const uint64_t levelBytes = ( std::max )( { bytes, rawBytes, level.mappedBytes + level.mappedBytes / 4 } );
+	const std::size_t fileBytes = level.levelOffset + levelBytes;
+	auto io = InitLVDIO();
+	unsigned char *ptr = io->Open( level.fileName, fileBytes, FileAccess::ReadWrite, MapAccess::ReadWrite ) ? io->MemoryMap( 0, fileBytes ) : nullptr;
+	if ( ptr == nullptr ) {
+		LOG_ERROR << "LVDFile: failed to extend " << level.fileName;
+		return false;
+	}
+	// other threads could still copy blocks through the old mapping, it is kept until the file is closed
+	const auto old = level.io;
+	retiredMappings.push_back( old );
+	for ( auto &l : levels ) {
+		if ( l.io.Get() != old.Get() ) {
+			continue;
+		}
+		l.levelPtr = ptr + l.levelOffset;
+		l.dataPtr = l.levelPtr + l.header.payloadOffset;
+		l.blockTable = l.blockTable ? (LVDBlockEntry *)( l.levelPtr + l.header.blockTableOffset ) : nullptr;
+		l.stats = l.stats ? (LVDBlockStats *)( l.levelPtr + l.header.statsOffset ) : nullptr;
+		l.occupancy = l.occupancy.Valid() ? LVDOccupancy( l.levelPtr, BlockCount( l ) ) : LVDOccupancy();
+		l.io = io;
+	}
+	level.header.levelBytes = levelBytes;
+	level.mappedBytes = levelBytes;
+	// the blocks appended from now on are inside the level even if the file is not closed, an unfinished
+	// sparse level is still dense on disk
+	const auto flags = level.header.flags;
+	if ( level.occupancy.Valid() == false ) {
+		level.header.flags &= ~LVD_FLAG_SPARSE;
+	}
+	memcpy( level.levelPtr, level.header.Encode(), LVD_V2_HEADER_SIZE );
+	level.header.flags = flags;
+	return true;
 }
 
-bool LVDFile::Flush()
+void LVDFile::WriteDeduplicated( LODLevel &level, LVDBlockEntry &entry, const std::vector<unsigned char> &encoded, LVDBlockCodec codec )
+{
+	auto &index = *level.dedup;
+	const auto hash = HashExtent( encoded.data(), encoded.size() );
+	// the extent is copied under the lock, so an equal block written at the same time finds it complete
+	std::lock_guard<std::mutex> lk( index.mutex );
+	const auto candidates = index.offsets.equal_range( hash );
+	for ( auto it = candidates.first; it != candidates.second; ++it ) {
+		auto &extent = index.extents[ it->second ];
+		if ( extent.length != encoded.size() || extent.codec != codec || memcmp( level.levelPtr + it->second, encoded.data(), encoded.size() ) != 0 ) {
+			continue;
+		}
+		if ( entry.length == 0 || entry.offset != it->second ) {
+			ReleaseExtent( index, entry );
+			extent.refs++;
+			entry.offset = it->second;
+			entry.length = extent.length;
+			entry.codec = codec;
+		}
+		return;
+	}
+
+	// an extent shared with other blocks is never rewritten in place
+	const auto owned = entry.length != 0 ? index.extents.find( entry.offset ) : index.extents.end();
+	uint64_t offset = 0;
+	if ( owned != index.extents.end() && owned->second.refs == 1 && encoded.size() <= entry.length ) {
+		offset = entry.offset;
+		ReleaseExtent( index, entry );
+	} else if ( level.occupancy.Valid() ) {
+		throw std::runtime_error( "LVDFile: the block does not fit in its slot or shares it with other blocks" );
+	} else {
+		ReleaseExtent( index, entry );
+		offset = AllocatePayload( level, encoded.size() );
+	}
+	memcpy( level.levelPtr + offset, encoded.data(), encoded.size() );
+	auto &extent = index.extents[ offset ];
+	extent.hash = hash;
+	extent.length = encoded.size();
+	extent.codec = codec;
+	extent.refs = 1;
+	index.offsets.emplace( hash, offset );
+	entry.offset = offset;
+	entry.length = encoded.size();
+	entry.codec = codec;
+}
+
+void LVDFile::ReleaseExtent( DedupIndex &index, const LVDBlockEntry &entry )
+{
+	if ( entry.length == 0 ) {
+		return;
+	}
+	const auto it = index.extents.find( entry.offset );
+	if ( it == index.extents.end() || --it->second.refs != 0 ) {
+		return;
+	}
+	// the unreferenced extent is dead space of the payload, it is not matched any more
+	const auto candidates = index.offsets.equal_range( it->second.hash );
+	for ( auto c = candidates.first; c != candidates.second; ++c ) {
+		if ( c->second == entry.offset ) {
+			index.offsets.erase( c );
+			break;
+		}
+	}
+	index.extents.erase( it );
+}
+
+void LVDFile::MarkDirty( LODLevel &level, std::size_t blockId )
+{
+	// release: a flusher that sees the bit also sees the block and its entry
+	level.dirty[ blockId / 64 ].fetch_or( uint64_t( 1 ) << ( blockId % 64 ), std::memory_order_release );
+}
+
+bool LVDFile::FlushLevel( LODLevel &level, int lod )
+{
+	std::vector<std::pair<unsigned char *, std::size_t>> ranges;
+	const auto wordCount = LVDOccupancy::WordCount( BlockCount( level ) );
+	for ( std::size_t w = 0; w < wordCount; w++ ) {
+		auto bits = level.dirty[ w ].exchange( 0, std::memory_order_acquire );
+		for ( int k = 0; bits; k++, bits >>= 1 ) {
+			if ( ( bits & 1 ) == 0 ) {
+				continue;
+			}
+			AddBlockRange( level, lod, w * 64 + k, ranges );
+		}
+	}
+	if ( ranges.empty() ) {
+		return true;
+	}
+	if ( level.blockTable ) {
+		// the header, the block table and the stats are in front of the payload
+		if ( writable && level.occupancy.Valid() == false ) {
+			// an unfinished sparse level is still dense on disk, see the constructor
+			std::lock_guard<std::mutex> lk( writeMutex );
+			const auto flags = level.header.flags;
+			level.header.flags &= ~LVD_FLAG_SPARSE;
+			memcpy( level.levelPtr, level.header.Encode(), LVD_V2_HEADER_SIZE );
+			level.header.flags = flags;
+		}
+		ranges.emplace_back( level.levelPtr, level.header.payloadOffset );
+	}
+
+	bool ok = true;
+	MergePageRanges( level, ranges, [ &]( unsigned char *begin, std::size_t bytes ) {
+		ok = level.io->Flush( begin, bytes, 0 ) && ok;
+	} );
+	return ok;
+}
+
+void LVDFile::AddBlockRange( const LODLevel &level, int lod, std::size_t blockId, std::vector<std::pair<unsigned char *, std::size_t>> &ranges ) const
+{
+	const std::size_t blockBytes = BlockBytes( lod );
+	if ( level.blockTable == nullptr ) {
+		ranges.emplace_back( level.dataPtr + blockBytes * blockId, blockBytes );
+	} else if ( const auto entry = FindBlock( level, blockId ) ) {
+		ranges.emplace_back( level.levelPtr + entry->offset, entry->length );
+	}
+}
+
+void LVDFile::MergePageRanges( const LODLevel &level, std::vector<std::pair<unsigned char *, std::size_t>> &ranges,
+							   const std::function<void( unsigned char *, std::size_t )> &fn )
+{
+	// msync and madvise want page aligned addresses, the mapping itself is page aligned
+	const auto pageMask = ~uintptr_t( 4095 );
+	const auto levelEnd = level.levelPtr + level.mappedBytes;
+	std::sort( ranges.begin(), ranges.end() );
+	unsigned char *begin = nullptr, *end = nullptr;
+	for ( const auto &r : ranges ) {
+		const auto b = (unsigned char *)( uintptr_t( r.first ) & pageMask );
+		const auto e = ( std::min )( (unsigned char *)( ( uintptr_t( r.first + r.second ) + 4095 ) & pageMask ), levelEnd );
+		if ( begin && b <= end ) {
+			end = ( std::max )( end, e );
+			continue;
+		}
+		if ( begin ) {
+			fn( begin, end - begin );
+		}
+		begin = b;
+		end = e;
+	}
+	if ( begin ) {
+		fn( begin, end - begin );
+	}
+}
+
+void LVDFile::Advise( unsigned char *begin, std::size_t bytes, LVDAccessAdvice advice )
+{
+#ifndef _WIN32
+	const int flags[] = { MADV_NORMAL, MADV_RANDOM, MADV_SEQUENTIAL, MADV_WILLNEED, MADV_DONTNEED };
+	const auto b = (unsigned char *)( uintptr_t( begin ) & ~uintptr_t( 4095 ) );
+	if ( madvise( b, bytes + ( begin - b ), flags[ advice ] ) != 0 ) {
+		LOG_DEBUG << "LVDFile: madvise failed";
+	}
+#endif
+}
+
+bool LVDFile::SetDirectIO( bool enable )
 {
-	LOG_CRITICAL << "LVDReader::Flush() -- Not implement yet";
+	if ( enable == directIO ) {
+		return true;
+	}
+	if ( enable == false ) {
+		CloseDirectIO();
+		return true;
+	}
+#if defined( __linux__ ) && defined( O_DIRECT )
+	if ( readOnly == false || levels.empty() ) {
+		return false;
+	}
+	std::size_t blockBytes = 0;
+	for ( auto &level : levels ) {
+		auto it = directFds.find( level.fileName );
+		if ( it == directFds.end() ) {
+			it = directFds.emplace( level.fileName, open( level.fileName.c_str(), O_RDONLY | O_DIRECT ) ).first;
+		}
+		if ( it->second < 0 ) {
+			LOG_WARNING << "LVDFile: " << level.fileName << " can not be opened for direct I/O";
+			CloseDirectIO();
+			return false;
+		}
+		level.directFd = it->second;
+		blockBytes = ( std::max )( blockBytes, ( std::size_t( 1 ) << ( 3 * level.logBlockSize ) ) * LVDVoxelBytes( level.header.voxelType ) );
+	}
+	// an unaligned block spans one more page at most
+	directBuffers.reset( new LVDAlignedBufferPool( blockBytes + LVD_BLOCK_ALIGNMENT, LVD_BLOCK_ALIGNMENT ) );
+	directIO = true;
+	for ( const auto &level : levels ) {
+		// the payload pages faulted in so far are not needed any more
+		Advise( level.dataPtr, level.mappedBytes - level.header.payloadOffset, LVD_ADVICE_DONTNEED );
+	}
+	return true;
+#else
 	return false;
+#endif
+}
+
+void LVDFile::CloseDirectIO()
+{
+	directReader = nullptr;  // its workers read through the descriptors
+#ifndef _WIN32
+	for ( const auto &fd : directFds ) {
+		if ( fd.second >= 0 ) {
+			close( fd.second );
+		}
+	}
+#endif
+	directFds.clear();
+	for ( auto &level : levels ) {
+		level.directFd = -1;
+	}
+	directIO = false;
+	directBuffers = nullptr;
+}
+
+void LVDFile::ReadDirect( const LODLevel &level, uint64_t offset, uint32_t length, LVDBlockCodec codec, char *dest, std::size_t blockBytes )
+{
+#ifndef _WIN32
+	const uint64_t fileOffset = level.levelOffset + offset;
+	const uint64_t begin = fileOffset / LVD_BLOCK_ALIGNMENT * LVD_BLOCK_ALIGNMENT;
+	const uint64_t end = vm::RoundUpDivide( fileOffset + length, uint64_t( LVD_BLOCK_ALIGNMENT ) ) * LVD_BLOCK_ALIGNMENT;
+	auto buffer = directBuffers->Acquire();
+	if ( !buffer || end - begin > directBuffers->BufferBytes() ) {
+		throw std::runtime_error( "LVDReader: no buffer for a direct read" );
+	}
+	// the aligned end could be past the end of the file, a short read is fine if it covers the block
+	uint64_t done = 0;
+	while ( done < fileOffset - begin + length ) {
+		const auto n = pread( level.directFd, buffer.Data() + done, end - begin - done, off_t( begin + done ) );
+		if ( n <= 0 ) {
+			throw std::runtime_error( "LVDReader: direct read failed" );
+		}
+		done += n;
+	}
+	const auto src = buffer.Data() + ( fileOffset - begin );
+	if ( LVDCodec::Decode( codec, src, length, (unsigned char *)dest, blockBytes ) == false ) {
+		throw std::runtime_error( "LVDReader: corrupted block" );
+	}
+#endif
+}
+
+void LVDFile::ReadAll( void *dst, int lod, int threadCount )
+{
+	const auto s = OriginalDataSize( lod );
+	const std::size_t rowStride = s.x * VoxelBytes( lod );
+	DebrickRegion( Vec3i( 0, 0, 0 ), Vec3i( s.x, s.y, s.z ), (unsigned char *)dst, rowStride, rowStride * s.y, lod, threadCount, false );
+}
+
+bool LVDFile::ReadRegion( const Bound3i &bound, int lod, void *dst, std::size_t rowStride, std::size_t sliceStride, int threadCount,
+						  const std::function<bool( std::size_t )> &blockFilter )
+{
+	if ( lod < 0 || lod >= LODCount() ) {
+		return false;
+	}
+	const auto s = OriginalDataSize( lod );
+	if ( bound.min.x < 0 || bound.min.y < 0 || bound.min.z < 0 ||
+		 bound.max.x <= bound.min.x || bound.max.y <= bound.min.y || bound.max.z <= bound.min.z ||
+		 std::size_t( bound.max.x ) > s.x || std::size_t( bound.max.y ) > s.y || std::size_t( bound.max.z ) > s.z ) {
+		LOG_ERROR << "LVDFile::ReadRegion: the region is empty or not inside the data";
+		return false;
+	}
+	const Vec3i begin( bound.min.x, bound.min.y, bound.min.z );
+	const Vec3i size( bound.max.x - bound.min.x, bound.max.y - bound.min.y, bound.max.z - bound.min.z );
+	if ( rowStride == 0 ) {
+		rowStride = size.x * VoxelBytes( lod );
+	}
+	if ( sliceStride == 0 ) {
+		sliceStride = rowStride * size.y;
+	}
+	DebrickRegion( begin, size, (unsigned char *)dst, rowStride, sliceStride, lod, threadCount, true, blockFilter );
+	return true;
+}
+
+void LVDFile::DebrickRegion( const Vec3i &begin, const Vec3i &size, unsigned char *dst, std::size_t rowStride, std::size_t sliceStride, int lod, int threadCount, bool prefetch,
+							 const std::function<bool( std::size_t )> &blockFilter )
+{
+	if ( size.x <= 0 || size.y <= 0 || size.z <= 0 ) {
+		return;
+	}
+	const auto &level = levels[ lod ];
+	const std::size_t es = VoxelBytes( lod );
+	const int blockSide = BlockSize( lod ), padding = level.padding, step = blockSide - 2 * padding;
+	const Vec3i end( begin.x + size.x, begin.y + size.y, begin.z + size.z );
+	const auto blockDim = level.bSize;
+
+	auto ids = CoveringBlocks( begin, end, lod );
+	if ( blockFilter ) {
+		ids.erase( std::remove_if( ids.begin(), ids.end(), [ &blockFilter ]( uint64_t id ) { return blockFilter( id ) == false; } ), ids.end() );
+	}
+	if ( prefetch && directIO == false ) {
+		// a readahead hint only, with direct I/O ForEachBlock reads the blocks in batches itself
+		AdviseBlocks( std::vector<std::size_t>( ids.begin(), ids.end() ), lod, LVD_ADVICE_WILLNEED );
+	}
+	const bool streaming = sliceStride * size.z >= StreamingStoreBytes;
+
+	ForEachBlock( ids, lod, threadCount, [ & ]( std::size_t id, const unsigned char *block ) {
+		const int bx = id % blockDim.x, by = id / blockDim.x % blockDim.y, bz = id / ( blockDim.x * blockDim.y );
+		const Vec3i lo( ( std::max )( begin.x, bx * step ), ( std::max )( begin.y, by * step ), ( std::max )( begin.z, bz * step ) );
+		const Vec3i hi( ( std::min )( end.x, bx * step + step ), ( std::min )( end.y, by * step + step ), ( std::min )( end.z, bz * step + step ) );
+		const std::size_t rowBytes = ( hi.x - lo.x ) * es;
+		for ( int z = lo.z; z < hi.z; z++ ) {
+			for ( int y = lo.y; y < hi.y; y++ ) {
+				const auto src = block + ( ( std::size_t( z - bz * step + padding ) * blockSide + ( y - by * step + padding ) ) * blockSide + ( lo.x - bx * step + padding ) ) * es;
+				const auto d = dst + ( z - begin.z ) * sliceStride + ( y - begin.y ) * rowStride + ( lo.x - begin.x ) * es;
+				if ( streaming ) {
+					StreamCopy( d, src, rowBytes );
+				} else {
+					memcpy( d, src, rowBytes );
+				}
+			}
+		}
+	} );
+}
+
+std::vector<uint64_t> LVDFile::CoveringBlocks( const Vec3i &begin, const Vec3i &end, int lod ) const
+{
+	const auto &level = levels[ lod ];
+	const uint64_t step = BlockSize( lod ) - 2 * level.padding;
+	const auto dim = level.bSize;
+	const uint64_t x0 = begin.x / step, y0 = begin.y / step, z0 = begin.z / step;
+	const uint64_t x1 = ( std::min )( ( end.x - 1 ) / step, dim.x - 1 ), y1 = ( std::min )( ( end.y - 1 ) / step, dim.y - 1 ), z1 = ( std::min )( ( end.z - 1 ) / step, dim.z - 1 );
+	std::vector<uint64_t> ids;
+	ids.reserve( ( x1 - x0 + 1 ) * ( y1 - y0 + 1 ) * ( z1 - z0 + 1 ) );
+	for ( uint64_t z = z0; z <= z1; z++ ) {
+		for ( uint64_t y = y0; y <= y1; y++ ) {
+			for ( uint64_t x = x0; x <= x1; x++ ) {
+				ids.push_back( ( z * dim.y + y ) * dim.x + x );
+			}
+		}
+	}
+	if ( level.slots.empty() == false ) {
+		// the linear order is the storage order of the other levels
+		std::sort( ids.begin(), ids.end(), [ &level ]( uint64_t a, uint64_t b ) { return level.slots[ a ] < level.slots[ b ]; } );
+	}
+	return ids;
+}
+
+void LVDFile::ForEachBlock( const std::vector<uint64_t> &ids, int lod, int threadCount, const std::function<void( std::size_t, const unsigned char * )> &fn )
+{
+	if ( threadCount <= 0 ) {
+		threadCount = ( std::max )( 1u, std::thread::hardware_concurrency() );
+	}
+	auto parallel = [ threadCount ]( std::size_t count, const std::function<void( std::size_t )> &body ) {
+		std::atomic<std::size_t> next{ 0 };
+		auto work = [ & ]() {
+			for ( std::size_t i; ( i = next++ ) < count; ) {
+				body( i );
+			}
+			StoreFence();  // fn may copy with streaming stores
+		};
+		std::vector<std::thread> workers;
+		for ( std::size_t t = 1; t < ( std::min )( std::size_t( threadCount ), count ); t++ ) {
+			workers.emplace_back( work );
+		}
+		work();
+		for ( auto &t : workers ) {
+			t.join();
+		}
+	};
+	if ( directIO == false ) {
+		parallel( ids.size(), [ & ]( std::size_t i ) {
+			thread_local std::vector<unsigned char> buffer;
+			const auto id = ids[ i ];
+			const unsigned char *block = BlockOccupied( id, lod ) ? ReadBlock( id, lod ) : ZeroBlock( lod );
+			if ( block == nullptr ) {
+				// compressed
+				buffer.resize( BlockBytes( lod ) );
+				ReadBlock( (char *)buffer.data(), id, lod );
+				block = buffer.data();
+			}
+			fn( id, block );
+		} );
+		return;
+	}
+
+	// Without the page cache every block is a read of its own, they are submitted to a page reader a batch
+	// at a time, and a batch is copied out while the next one is read.
+	const std::size_t blockBytes = BlockBytes( lod );
+	const std::size_t batchBlocks = ( std::min )( ids.size(), std::size_t( threadCount ) * 4 );
+	std::vector<unsigned char> buffers[ 2 ];
+	buffers[ 0 ].resize( batchBlocks * blockBytes );
+	buffers[ 1 ].resize( batchBlocks * blockBytes );
+	std::lock_guard<std::mutex> lk( directReaderMutex );
+	if ( directReader == nullptr ) {
+		// without io_uring the pread workers read through the O_DIRECT descriptors of the file
+		const auto mode = LVDIOUring::Supported() ? LVD_PAGE_IO_URING_DIRECT : LVD_PAGE_IO_PREAD;
+		const int readerThreads = int( ( std::max )( 1u, std::thread::hardware_concurrency() ) );
+		directReader.reset( new LVDPageReader( std::shared_ptr<LVDFile>( std::shared_ptr<LVDFile>(), this ), mode, readerThreads ) );
+	}
+	auto &reader = *directReader;
+	auto submit = [ & ]( std::size_t first, std::vector<unsigned char> &buffer ) {
+		std::vector<LVDPageRequest> requests;
+		for ( std::size_t i = first; i < ( std::min )( first + batchBlocks, ids.size() ); i++ ) {
+			requests.push_back( LVDPageRequest{ ids[ i ], lod, buffer.data() + ( i - first ) * blockBytes, false } );
+		}
+		reader.Submit( requests );
+		return requests.size();
+	};
+	auto pending = submit( 0, buffers[ 0 ] );
+	for ( std::size_t first = 0, current = 0; first < ids.size(); first += batchBlocks, current ^= 1 ) {
+		std::vector<LVDPageRequest> done;
+		while ( done.size() < pending ) {
+			reader.Collect( done, pending - done.size() );
+		}
+		for ( const auto &r : done ) {
+			if ( r.ok == false ) {
+				throw std::runtime_error( "LVDReader: corrupted block" );
+			}
+		}
+		pending = first + batchBlocks < ids.size() ? submit( first + batchBlocks, buffers[ current ^ 1 ] ) : 0;
+		const auto count = ( std::min )( batchBlocks, ids.size() - first );
+		parallel( count, [ & ]( std::size_t i ) {
+			fn( ids[ first + i ], buffers[ current ].data() + i * blockBytes );
+		} );
+	}
+}
+
+void LVDFile::SetAccessPattern( LVDAccessAdvice advice )
+{
+	for ( const auto &level : levels ) {
+		Advise( level.levelPtr, level.mappedBytes, advice );
+	}
+}
+
+void LVDFile::AdviseBlocks( const std::vector<std::size_t> &blockIds, int lod, LVDAccessAdvice advice )
+{
+	const auto &level = levels[ lod ];
+	if ( directIO && advice == LVD_ADVICE_WILLNEED ) {
+		return;	 // the blocks are not read through the mapping
+	}
+	std::vector<std::pair<unsigned char *, std::size_t>> ranges;
+	ranges.reserve( blockIds.size() );
+	for ( const auto id : blockIds ) {
+		if ( id < BlockCount( lod ) ) {
+			AddBlockRange( level, lod, id, ranges );
+		}
+	}
+	MergePageRanges( level, ranges, [ advice ]( unsigned char *begin, std::size_t bytes ) { Advise( begin, bytes, advice ); } );
+}
+
+bool LVDFile::Flush( std::size_t blockId, int lod )
+{
+	const auto &level = levels[ lod ];
+	assert( level.levelPtr );
+	if ( level.blockTable == nullptr ) {
+		const auto d = level.dataPtr;
+		const size_t blockCount = BlockBytes( lod );
+		return level.io->Flush( d + blockCount * blockId, sizeof( char ) * blockCount, 0 );
+	}
+	if ( level.stats ) {
+		level.io->Flush( (unsigned char *)( level.stats + Slot( level, blockId ) ), sizeof( LVDBlockStats ), 0 );
+	}
+	const auto entry = FindBlock( level, blockId );
+	if ( entry == nullptr && level.occupancy.Valid() ) {
+		return true;  // an absent block of a compacted level has no table entry
+	}
+	if ( entry == nullptr ) {
+		return level.io->Flush( (unsigned char *)( level.blockTable + Slot( level, blockId ) ), sizeof( LVDBlockEntry ), 0 );
+	}
+	return level.io->Flush( level.levelPtr + entry->offset, entry->length, 0 ) &&
+		   level.io->Flush( (unsigned char *)entry, sizeof( LVDBlockEntry ), 0 );
+}
+
+bool LVDFile::Flush()
+{
+	std::lock_guard<std::mutex> lk( flushMutex );
+	bool ok = true;
+	for ( int lod = 0; lod < LODCount(); lod++ ) {
+		ok = FlushLevel( levels[ lod ], lod ) && ok;
+	}
+	return ok;
+}
+
+std::size_t LVDFile::DirtyBlockCount( int lod ) const
+{
+	const auto &level = levels[ lod ];
+	std::size_t count = 0;
+	for ( std::size_t w = 0; w < LVDOccupancy::WordCount( BlockCount( level ) ); w++ ) {
+		for ( auto bits = level.dirty[ w ].load(); bits; bits &= bits - 1 ) {
+			count++;
+		}
+	}
+	return count;
+}
+
+void LVDFile::StartBackgroundFlush( std::chrono::milliseconds interval )
+{
+	StopBackgroundFlush();
+	flusherStop = false;
+	flusher = std::thread( [ this, interval ]() {
+		std::unique_lock<std::mutex> lk( flusherMutex );
+		while ( flusherCV.wait_for( lk, interval, [ this ]() { return flusherStop; } ) == false ) {
+			lk.unlock();
+			Flush();
+			lk.lock();
+		}
+	} );
+}
+
+void LVDFile::StopBackgroundFlush()
+{
+	if ( flusher.joinable() ) {
+		{
+			std::lock_guard<std::mutex> lk( flusherMutex );
+			flusherStop = true;
+		}
+		flusherCV.notify_all();
+		flusher.join();
+	}
 }
 
 void LVDFile::Close()
 {
-	lvdIO = nullptr;
+	StopBackgroundFlush();
+	CloseDirectIO();
+	FinalizeLevels();
+	levels.clear();
+}
+
+unsigned char *LVDFile::ReadBlock( std::size_t blockId, int lod )
+{
+	const size_t blockCount = BlockBytes( lod );
+	const auto &level = levels[ lod ];
+	if ( directIO ) {
+		return nullptr;
+	}
+	if ( level.blockTable == nullptr ) {
+		const auto d = level.dataPtr;
+		return d + blockCount * blockId;
+	}
+	const auto entry = FindBlock( level, blockId );
+	if ( entry && entry->codec == LVD_CODEC_RAW && entry->length == blockCount ) {
+		return level.levelPtr + entry->offset;
+	}
+	return nullptr;
 }
 
-unsigned char *LVDFile::ReadBlock( int blockId, int lod )
+bool LVDFile::BlockOccupied( std::size_t blockId, int lod ) const
 {
-	const size_t blockCount = BlockDataCount();
-	const auto d = lvdPtr + LVD_HEADER_SIZE;
-	return d + blockCount * blockId;
+	const auto &level = levels[ lod ];
+	return level.blockTable == nullptr || FindBlock( level, blockId ) != nullptr;
+}
+
+std::size_t LVDFile::OccupiedBlockCount( int lod ) const
+{
+	const auto &level = levels[ lod ];
+	if ( level.blockTable == nullptr ) {
+		return BlockCount( lod );
+	}
+	if ( level.occupancy.Valid() ) {
+		return level.occupancy.Count();
+	}
+	return std::count_if( level.blockTable, level.blockTable + BlockCount( level ), []( const LVDBlockEntry &e ) { return e.length != 0; } );
+}
+
+const unsigned char *LVDFile::ZeroBlock( int lod ) const
+{
+	// shared by every file and plugin, the pages are never freed and never written
+	static std::mutex mutex;
+	static std::map<std::size_t, std::unique_ptr<unsigned char[]>> pages;
+	const std::size_t bytes = BlockBytes( lod );
+	std::lock_guard<std::mutex> lk( mutex );
+	auto &page = pages[ bytes ];
+	if ( page == nullptr ) {
+		page.reset( new unsigned char[ bytes ]() );
+	}
+	return page.get();
+}
+
+const LVDBlockStats *LVDFile::BlockStats( std::size_t blockId, int lod ) const
+{
+	const auto &level = levels[ lod ];
+	const auto slot = Slot( level, blockId );
+	if ( level.stats == nullptr || level.stats[ slot ].valid == 0 ) {
+		return nullptr;
+	}
+	return level.stats + slot;
+}
+
+std::size_t LVDFile::BlockInstance( std::size_t blockId, int lod ) const
+{
+	const auto &level = levels[ lod ];
+	if ( ( level.absentOnce || level.absentInstance != UINT64_MAX ) && FindBlock( level, blockId ) == nullptr ) {
+		if ( level.absentOnce ) {
+			std::call_once( *level.absentOnce, [ &level ]() {
+				// the table of a dense level has an entry per block in storage order
+				for ( std::size_t slot = 0; slot < BlockCount( level ); slot++ ) {
+					if ( level.blockTable[ slot ].length == 0 ) {
+						level.absentInstance = SlotBlock( level, slot );
+						break;
+					}
+				}
+			} );
+		}
+		return level.absentInstance;
+	}
+	return level.instances.empty() ? blockId : level.instances[ blockId ];
+}
+
+std::vector<uint64_t> LVDFile::StorageOrder( int lod ) const
+{
+	const auto &level = levels[ lod ];
+	if ( level.slots.empty() == false ) {
+		return LVDMortonOrder( level.bSize );
+	}
+	std::vector<uint64_t> order( BlockCount( level ) );
+	for ( std::size_t i = 0; i < order.size(); i++ ) {
+		order[ i ] = i;
+	}
+	return order;
+}
+
+LVDBlockLocation LVDFile::LocateBlock( std::size_t blockId, int lod ) const
+{
+	const auto &level = levels[ lod ];
+	LVDBlockLocation location;
+	location.fileName = &level.fileName;
+	if ( level.blockTable == nullptr ) {
+		location.length = BlockBytes( lod );
+		location.offset = level.levelOffset + level.header.payloadOffset + uint64_t( location.length ) * blockId;
+	} else if ( const auto entry = FindBlock( level, blockId ) ) {
+		location.offset = level.levelOffset + entry->offset;
+		location.length = entry->length;
+		location.codec = LVDBlockCodec( entry->codec );
+	}
+	return location;
+}
+
+void LVDFile::ComputeBlockStats( const unsigned char *src, std::size_t count, LVDVoxelType type, LVDBlockStats &stats )
+{
+	if ( type != LVD_VOXEL_UINT8 ) {
+		// the bins cover [0, 65535] for 16-bit voxels and [0, 1] for float ones
+		double sum = 0;
+		float lo = 0, hi = 0;
+		std::size_t bins[ LVD_STATS_HISTOGRAM_BINS ] = { 0 };
+		for ( std::size_t i = 0; i < count; i++ ) {
+			float v;
+			int bin;
+			if ( type == LVD_VOXEL_UINT16 ) {
+				uint16_t u;
+				memcpy( &u, src + i * 2, 2 );
+				v = u;
+				bin = u * LVD_STATS_HISTOGRAM_BINS / 65536;
+			} else {
+				memcpy( &v, src + i * 4, 4 );
+				const float clamped = v > 0.f ? ( v < 1.f ? v : 1.f ) : 0.f;  // NaN goes to the first bin
+				bin = ( std::min )( int( clamped * LVD_STATS_HISTOGRAM_BINS ), LVD_STATS_HISTOGRAM_BINS - 1 );
+			}
+			lo = i ? ( std::min )( lo, v ) : v;
+			hi = i ? ( std::max )( hi, v ) : v;
+			sum += v;
+			bins[ bin ]++;
+		}
+		stats.min = lo;
+		stats.max = hi;
+		stats.mean = count ? float( sum / count ) : 0.f;
+		for ( int b = 0; b < LVD_STATS_HISTOGRAM_BINS; b++ ) {
+			stats.histogram[ b ] = count ? uint16_t( ( bins[ b ] * 65535 + count / 2 ) / count ) : 0;
+		}
+		stats.valid = 1;
+		return;
+	}
+	std::size_t counts[ 256 ] = { 0 };
+	for ( std::size_t i = 0; i < count; i++ ) {
+		counts[ src[ i ] ]++;
+	}
+	int lo = 0, hi = 255;
+	while ( lo < 255 && counts[ lo ] == 0 ) lo++;
+	while ( hi > 0 && counts[ hi ] == 0 ) hi--;
+	uint64_t sum = 0;
+	std::size_t bins[ LVD_STATS_HISTOGRAM_BINS ] = { 0 };
+	for ( int v = 0; v < 256; v++ ) {
+		sum += uint64_t( v ) * counts[ v ];
+		bins[ v * LVD_STATS_HISTOGRAM_BINS / 256 ] += counts[ v ];
+	}
+	stats.min = lo;
+	stats.max = hi;
+	stats.mean = count ? float( double( sum ) / count ) : 0.f;
+	for ( int b = 0; b < LVD_STATS_HISTOGRAM_BINS; b++ ) {
+		stats.histogram[ b ] = count ? uint16_t( ( bins[ b ] * 65535 + count / 2 ) / count ) : 0;
+	}
+	stats.valid = 1;
+}
+
+bool LVDFile::IsZeroBlock( const char *src, std::size_t bytes )
+{
+	std::size_t i = 0;
+	for ( ; i + sizeof( uint64_t ) <= bytes; i += sizeof( uint64_t ) ) {
+		uint64_t v;
+		memcpy( &v, src + i, sizeof( v ) );
+		if ( v ) return false;
+	}
+	for ( ; i < bytes; i++ ) {
+		if ( src[ i ] ) return false;
+	}
+	return true;
 }
 
 LVDFile::~LVDFile()
 {
-	//delete lvdIO;
+	StopBackgroundFlush();
+	CloseDirectIO();
+	FinalizeLevels();
 }
 }  // namespace ysl
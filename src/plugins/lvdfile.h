@@ -1,14 +1,25 @@
-
 #pragma once
 
 
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <unordered_map>
 #include <VMFoundation/blockarray.h>
 #include <vector>
 #include <VMUtils/ref.hpp>
 #include <VMCoreExtension/ifilemappingplugininterface.h>
 
 #include "lvdfileheader.h"
+#include "lvdoccupancy.h"
+#include "lvdalignedbufferpool.h"
+#include "lvdmorton.h"
 
 
 /**
@@ -17,22 +28,103 @@
 
 namespace vm
 {
+class LVDPageReader;
+
+/**
+ * \brief Kernel paging advice for the mapping of a LVD file, see madvise(2)
+ */
+enum LVDAccessAdvice
+{
+	LVD_ADVICE_NORMAL = 0,
+	LVD_ADVICE_RANDOM = 1,	// the render path, blocks are fetched in no order so read-ahead is a waste
+	LVD_ADVICE_SEQUENTIAL = 2,
+	LVD_ADVICE_WILLNEED = 3,
+	LVD_ADVICE_DONTNEED = 4
+};
+
+/**
+ * \brief Where a block is stored in its file, for readers that do not go through the mapping
+ */
+struct LVDBlockLocation
+{
+	const std::string *fileName = nullptr;
+	uint64_t offset = 0;  // from the beginning of the file
+	uint32_t length = 0;  // 0 if the block is absent and reads as zero
+	LVDBlockCodec codec = LVD_CODEC_RAW;
+};
 
 class LVDFile
 {
+	/**
+	 * \brief The stored extents of a writable LVD_FLAG_DEDUP level by the hash of their encoded bytes
+	 */
+	struct DedupIndex
+	{
+		struct Extent
+		{
+			uint64_t hash = 0;
+			uint32_t length = 0;
+			uint8_t codec = LVD_CODEC_RAW;
+			uint32_t refs = 0;	// table entries pointing to the extent
+		};
+		std::mutex mutex;
+		std::unordered_multimap<uint64_t, uint64_t> offsets;  // hash -> offset of the extent in the level
+		std::unordered_map<uint64_t, Extent> extents;		  // offset -> extent
+	};
+	/**
+	 * \brief Geometry of a single level of detail.
+	 *
+	 * A level is a complete single-level LVD (header + bricks). Several levels are either
+	 * concatenated in one container file or come from separate files.
+	 */
+	struct LODLevel
+	{
+		LVDFileHeader header;
+		vm::Size3 vSize;
+		vm::Size3 bSize;
+		vm::Size3 oSize;
+		int logBlockSize = 0;
+		int padding = 0;
+		std::string fileName;
+		std::size_t levelOffset = 0;		  // offset of the level in its file
+		unsigned char *levelPtr = nullptr;	  // points to the header of the level
+		unsigned char *dataPtr = nullptr;	  // points to the first brick (v1) or the payload (v2) of the level
+		LVDBlockEntry *blockTable = nullptr;  // v2 only
+		LVDBlockStats *stats = nullptr;		  // indexed by block id, null for levels without the stats section
+		LVDOccupancy occupancy;				  // valid if the table of a sparse level is compacted
+		uint64_t mappedBytes = 0;			  // bytes of the level that are mapped, the v2 payload grows up to it
+		bool lastInFile = true;
+		Ref<IMappingFile> io;  // the mapping that owns levelPtr
+		std::unique_ptr<std::atomic<uint64_t>[]> dirty;	 // one bit per block written since the last Flush()
+		int directFd = -1;								 // O_DIRECT descriptor of the file, owned by LVDFile::directFds
+		std::vector<uint64_t> slots;					 // Morton levels only, the table slot of each block id
+		std::unique_ptr<DedupIndex> dedup;				 // writable LVD_FLAG_DEDUP levels only
+		std::vector<uint64_t> instances;				 // read-only LVD_FLAG_DEDUP levels, the lowest block id stored at the extent of each block
+		mutable uint64_t absentInstance = UINT64_MAX;	 // read-only levels, the first absent block in storage order, UINT64_MAX if every block is stored
+		std::unique_ptr<std::once_flag> absentOnce;		 // read-only dense levels, absentInstance is searched on the first absent block asked for
+	};
+
 	std::string fileName;
-	LVDFileHeader header;
-	//AbstraFileMap* lvdIO;
-	unsigned char *lvdPtr;
-	vm::Size3 vSize;
-	vm::Size3 bSize;
-	vm::Size3 oSize;
-	int logBlockSize;
-	int padding;
+	std::vector<LODLevel> levels;
 	bool validFlag;
+	std::atomic<bool> writable{ false };  // created, or written to since opened
+	bool readOnly = false;
+	std::mutex writeMutex;	// guards the payload allocation of v2 levels
+	std::vector<Ref<IMappingFile>> retiredMappings;  // replaced by GrowLevel, closed with the file
+	std::mutex flushMutex;
+	std::thread flusher;
+	std::mutex flusherMutex;
+	std::condition_variable flusherCV;
+	bool flusherStop = false;
+	bool directIO = false;
+	std::map<std::string, int> directFds;
+	std::unique_ptr<LVDAlignedBufferPool> directBuffers;  // bounce buffers of the O_DIRECT reads
+	std::unique_ptr<LVDPageReader> directReader;		  // reads the blocks of ForEachBlock with direct I/O, made on first use
+	std::mutex directReaderMutex;						  // one ForEachBlock reads through it at a time
 	enum
 	{
-		LVDFileMagicNumber = 277536
+		LVDFileMagicNumber = LVD_MAGIC_NUMBER_V1,
+		LVDFileMagicNumberV2 = LVD_MAGIC_NUMBER_V2
 	};
 	enum
 	{
@@ -45,43 +137,254 @@ class LVDFile
 		LVDHeaderSize = 24
 	};
 
-	void InitLVDIO();
-	void InitInfoByHeader(const LVDFileHeader & header);
+	Ref<IMappingFile> InitLVDIO();
+	bool InitInfoByHeader( const LVDFileHeader &header, LODLevel &level );
+	bool MapLevels( const std::string &fileName, std::vector<LODLevel> &lods );
+	void BindLevel( LODLevel &level, unsigned char *levelPtr, Ref<IMappingFile> io );
+	void FinalizeLevels();
+	void CompactLevel( LODLevel &level );
+	/**
+	 * \brief Builds the dedup index of a writable LVD_FLAG_DEDUP level or the block instances of a read-only level
+	 */
+	void IndexLevel( LODLevel &level );
+	/**
+	 * \brief Reserves \a bytes at the end of the payload of a v2 level being written and returns their offset
+	 */
+	uint64_t AllocatePayload( LODLevel &level, std::size_t bytes );
+	/**
+	 * \brief Extends the last level of a file to at least \a bytes and maps the file again, the caller holds
+	 * the write mutex. Returns false if the level is followed by another one or the file can not grow.
+	 */
+	bool GrowLevel( LODLevel &level, uint64_t bytes );
+	/**
+	 * \brief Points \a entry to an extent holding \a encoded, an equal stored extent is shared instead of storing it again
+	 */
+	void WriteDeduplicated( LODLevel &level, LVDBlockEntry &entry, const std::vector<unsigned char> &encoded, LVDBlockCodec codec );
+	/**
+	 * \brief Drops the reference of \a entry to its extent, the caller holds the mutex of the index
+	 */
+	static void ReleaseExtent( DedupIndex &index, const LVDBlockEntry &entry );
+	static void MarkDirty( LODLevel &level, std::size_t blockId );
+	bool FlushLevel( LODLevel &level, int lod );
+	void AddBlockRange( const LODLevel &level, int lod, std::size_t blockId, std::vector<std::pair<unsigned char *, std::size_t>> &ranges ) const;
+	/**
+	 * \brief Sorts the byte ranges and calls \a fn once per group of ranges sharing or touching pages
+	 */
+	static void MergePageRanges( const LODLevel &level, std::vector<std::pair<unsigned char *, std::size_t>> &ranges,
+								 const std::function<void( unsigned char *, std::size_t )> &fn );
+	static void Advise( unsigned char *begin, std::size_t bytes, LVDAccessAdvice advice );
+	void CloseDirectIO();
+	/**
+	 * \brief Reads \a length bytes at \a offset of the level with O_DIRECT and decodes them into \a dest
+	 */
+	void ReadDirect( const LODLevel &level, uint64_t offset, uint32_t length, LVDBlockCodec codec, char *dest, std::size_t blockBytes );
+	/**
+	 * \brief Copies the voxels [begin, begin + size) of \a lod into \a dst, whose rows and slices are
+	 * \a rowStride and \a sliceStride bytes apart. The region must be inside OriginalDataSize( lod ).
+	 * With \a prefetch the mapping is advised to read the covering blocks ahead (madvise WILLNEED) before they are copied.
+	 */
+	void DebrickRegion( const Vec3i &begin, const Vec3i &size, unsigned char *dst, std::size_t rowStride, std::size_t sliceStride, int lod, int threadCount, bool prefetch,
+						const std::function<bool( std::size_t )> &blockFilter = nullptr );
+	/**
+	 * \brief Returns the blocks whose interior overlaps the voxels [begin, end) of \a lod, in the order they
+	 * are stored. Only the blocks of the region are visited.
+	 */
+	std::vector<uint64_t> CoveringBlocks( const Vec3i &begin, const Vec3i &end, int lod ) const;
+	/**
+	 * \brief Calls \a fn with the id and the voxels of every block of \a ids on \a threadCount threads (0 means the
+	 * hardware concurrency), which take the blocks in the order of \a ids. The voxels are only valid during the call.
+	 * With direct I/O the blocks are read in batches by the page reader of the file, which is kept for the next
+	 * calls, and each batch is passed to \a fn while the next one is read.
+	 */
+	void ForEachBlock( const std::vector<uint64_t> &ids, int lod, int threadCount, const std::function<void( std::size_t, const unsigned char * )> &fn );
+	/**
+	 * \brief Returns the table entry of a stored block or nullptr if the block is absent
+	 */
+	static LVDBlockEntry *FindBlock( const LODLevel &level, std::size_t blockId );
+	static bool IsZeroBlock( const char *src, std::size_t bytes );
+	static void ComputeBlockStats( const unsigned char *src, std::size_t count, LVDVoxelType type, LVDBlockStats &stats );
+	static std::size_t BlockCount( const LODLevel &level ) { return level.bSize.x * level.bSize.y * level.bSize.z; }
+	static std::size_t Slot( const LODLevel &level, std::size_t blockId ) { return level.slots.empty() ? blockId : level.slots[ blockId ]; }
+	/**
+	 * \brief Returns the block id stored at \a slot, Morton levels search their slots
+	 */
+	static std::size_t SlotBlock( const LODLevel &level, std::size_t slot );
 
 public:
-	explicit LVDFile( const std::string &fileName );
-	LVDFile( const std::vector<std::string> &fileName, const std::vector<int> &lods = std::vector<int>{} );
-	LVDFile(const std::string & fileName,int BlockSideInLog,const Vec3i& dataSize, int padding );
+	/**
+	 * \brief Opens a LVD file. A read-only file is mapped private and read-only, so it could be on a
+	 * read-only share, and its pages are advised random access.
+	 *
+	 * A file that is only read is left as it is. Blocks of a writable v2 file rewritten larger than their
+	 * extent are appended, the file is extended for them on demand and trimmed again on close.
+	 */
+	explicit LVDFile( const std::string &fileName, bool readOnly = false );
+	LVDFile( const std::vector<std::string> &fileName, const std::vector<int> &lods = std::vector<int>{}, bool readOnly = false );
+	/**
+	 * \brief Creates a LVD file. A v2 file stores every block with the smallest of the lossless codecs,
+	 * a v1 file stores the raw blocks at fixed offsets.
+	 *
+	 * With LVD_FLAG_SPARSE in \a flags, blocks that are all zero are not stored at all and the file size only
+	 * depends on the occupied blocks. The occupancy of a sparse level is fixed once the file is closed: opened
+	 * again, only its stored blocks could be rewritten and only in their extents. So sparse is opt-in, for
+	 * files written once like the ones of lvdconvert.
+	 */
+	LVDFile( const std::string &fileName, int BlockSideInLog, const Vec3i &dataSize, int padding, int version = LVD_VERSION_2, uint32_t flags = 0, LVDVoxelType voxelType = LVD_VOXEL_UINT8 );
+	/**
+	 * \brief Creates a multi-level container. Level i has the size \a lodDataSize[i], all levels
+	 * share one file and one mapping.
+	 *
+	 * Voxels other than LVD_VOXEL_UINT8 need a v2 file.
+	 */
+	LVDFile( const std::string &fileName, int BlockSideInLog, const std::vector<Vec3i> &lodDataSize, int padding, int version = LVD_VERSION_2, uint32_t flags = 0, LVDVoxelType voxelType = LVD_VOXEL_UINT8 );
 	bool Valid() const { return validFlag; }
-	Size3 Size( int lod = 0 ) const { return vSize; }
-	Size3 SizeByBlock( int lod = 0 ) const { return bSize; }
-	int GetBlockPadding( int lod = 0 ) const { return padding; }
-	int BlockSizeInLog( int lod = 0 ) const { return logBlockSize; }
-	int BlockSize( int lod = 0 ) const { return 1 << BlockSizeInLog(); }
-	int BlockDataCount( int lod = 0 ) const { return BlockSize() * BlockSize() * BlockSize(); }
-	int BlockCount( int lod = 0 ) const { return bSize.x * bSize.y * bSize.z; }
-	Size3 OriginalDataSize( int lod = 0 ) const { return oSize; }
+	int LODCount() const { return levels.size(); }
+	Size3 Size( int lod = 0 ) const { return levels[ lod ].vSize; }
+	Size3 SizeByBlock( int lod = 0 ) const { return levels[ lod ].bSize; }
+	int GetBlockPadding( int lod = 0 ) const { return levels[ lod ].padding; }
+	int BlockSizeInLog( int lod = 0 ) const { return levels[ lod ].logBlockSize; }
+	int BlockSize( int lod = 0 ) const { return 1 << BlockSizeInLog( lod ); }
+	/**
+	 * \brief Voxels of a block, see BlockBytes() for its size
+	 */
+	std::size_t BlockDataCount( int lod = 0 ) const { return std::size_t( 1 ) << ( 3 * BlockSizeInLog( lod ) ); }
+	LVDVoxelType VoxelType( int lod = 0 ) const { return levels[ lod ].header.voxelType; }
+	int VoxelBytes( int lod = 0 ) const { return int( LVDVoxelBytes( VoxelType( lod ) ) ); }
+	std::size_t BlockBytes( int lod = 0 ) const { return BlockDataCount( lod ) * VoxelBytes( lod ); }
+	std::size_t BlockCount( int lod = 0 ) const { return BlockCount( levels[ lod ] ); }
+	Size3 OriginalDataSize( int lod = 0 ) const { return levels[ lod ].oSize; }
+	/**
+	 * \brief Reads the whole level without the padding into \a dst, x fastest and VoxelBytes( lod ) per voxel.
+	 *
+	 * \a threadCount threads (0 means the hardware concurrency) decode the blocks in their storage order and
+	 * scatter them, an output larger than the caches is written with streaming stores.
+	 */
+	void ReadAll( void *dst, int lod = 0, int threadCount = 0 );
+	/**
+	 * \brief Reads the voxels of \a bound (max exclusive, without the padding) of \a lod into \a dst, x fastest.
+	 *
+	 * Rows and slices of \a dst are \a rowStride and \a sliceStride bytes apart, 0 means tightly packed.
+	 * Only the blocks covering the region are read and their interiors are copied in parallel. From the mapping
+	 * the blocks are only hinted to the kernel for readahead, with direct I/O they are read in batches
+	 * through the page reader of the file (io_uring if available), which later calls reuse, so a region read
+	 * in a loop does not start threads or set up a ring each time. Returns false if \a bound is empty or not
+	 * inside OriginalDataSize( lod ).
+	 *
+	 * The voxels of the blocks for which \a blockFilter returns false are not read and left as they are in \a dst.
+	 */
+	bool ReadRegion( const Bound3i &bound, int lod, void *dst, std::size_t rowStride = 0, std::size_t sliceStride = 0, int threadCount = 0,
+					 const std::function<bool( std::size_t )> &blockFilter = nullptr );
+	/**
+	 * \brief Returns nullptr if T is not the size of the voxels of \a lod.
+	 *
+	 * If the level has no padding and its blocks are the bricks of the array (2^nLogBlockSize voxels a side),
+	 * the bricks are filled from the blocks in parallel. Otherwise the level is read into a linear buffer
+	 * first and bricked again by the array on one thread, which takes twice the memory: callers that only
+	 * need the voxels should use ReadAll( void *, lod, threadCount ) then.
+	 */
 	template <typename T, int nLogBlockSize>
 	std::shared_ptr<Block3DArray<T, nLogBlockSize>> ReadAll( int lod = 0 );
-	void ReadBlock( char *dest, int blockId, int lod = 0 );
-	void WriteBlock( const char *src, int blockId, int lod );
-	bool Flush( int blockId, int lod );
+	int Version( int lod = 0 ) const { return levels[ lod ].header.version; }
+	bool MortonOrder( int lod = 0 ) const { return levels[ lod ].slots.empty() == false; }
+	/**
+	 * \brief Returns the block ids in the order they are stored, the order to write them in
+	 */
+	std::vector<uint64_t> StorageOrder( int lod = 0 ) const;
+	/**
+	 * \brief Reads the block into \a dest, decoding it if it is compressed. The caller
+	 * could call it from several threads.
+	 */
+	void ReadBlock( char *dest, std::size_t blockId, int lod = 0 );
+	/**
+	 * \brief Writes the block. v2 levels encode it and append it to the payload, it is safe
+	 * to write different blocks from several threads.
+	 */
+	void WriteBlock( const char *src, std::size_t blockId, int lod = 0 );
+	bool Flush( std::size_t blockId, int lod = 0 );
+	/**
+	 * \brief Flushes every block written since the last call. The dirty blocks are merged into
+	 * page aligned contiguous ranges, so a bulk write costs a few msyncs instead of one per block.
+	 */
 	bool Flush();
+	std::size_t DirtyBlockCount( int lod = 0 ) const;
+	/**
+	 * \brief Calls Flush() every \a interval on a background thread until StopBackgroundFlush() or Close()
+	 */
+	void StartBackgroundFlush( std::chrono::milliseconds interval );
+	void StopBackgroundFlush();
+	bool ReadOnly() const { return readOnly; }
+	void SetAccessPattern( LVDAccessAdvice advice );
+	/**
+	 * \brief Advises the pages of the listed blocks, LVD_ADVICE_WILLNEED starts reading them in the
+	 * background and LVD_ADVICE_DONTNEED drops them from the mapping
+	 */
+	void AdviseBlocks( const std::vector<std::size_t> &blockIds, int lod, LVDAccessAdvice advice );
+	/**
+	 * \brief Reads the blocks of a read-only file with O_DIRECT instead of through the mapping, so they
+	 * are not cached by the kernel a second time next to the cache of the application. Only the header
+	 * and the tables stay mapped. Returns false if the file is writable or the file system or the
+	 * platform does not support direct I/O.
+	 *
+	 * Levels written with LVD_FLAG_ALIGNED are read block by block, others read the aligned pages
+	 * around a block.
+	 */
+	bool SetDirectIO( bool enable );
+	bool DirectIO() const { return directIO; }
 	void Close();
-	unsigned char *ReadBlock( int blockId, int lod = 0 );
-	const LVDFileHeader &GetHeader() const { return header; }
+	/**
+	 * \brief Returns the pointer to the block in the mapping if it is stored raw, otherwise returns
+	 * nullptr and the block must be read by ReadBlock( char *dest, ... ). Always nullptr with direct I/O.
+	 */
+	unsigned char *ReadBlock( std::size_t blockId, int lod = 0 );
+	const LVDFileHeader &GetHeader( int lod = 0 ) const { return levels[ lod ].header; }
+	/**
+	 * \brief Returns false if the block is not stored, it reads as zero. Only v2 levels have absent blocks.
+	 */
+	bool BlockOccupied( std::size_t blockId, int lod = 0 ) const;
+	std::size_t OccupiedBlockCount( int lod = 0 ) const;
+	/**
+	 * \brief The rank/select index of a sparse level, it is invalid for dense levels and levels being written
+	 */
+	const LVDOccupancy &Occupancy( int lod = 0 ) const { return levels[ lod ].occupancy; }
+	/**
+	 * \brief Returns a zero block of the size of the blocks of \a lod, it is the page of every absent block
+	 */
+	const unsigned char *ZeroBlock( int lod = 0 ) const;
+	/**
+	 * \brief Returns the min/max/mean/histogram of a block written by WriteBlock, or nullptr if the level
+	 * has no stats section (v1) or the block has never been written
+	 */
+	const LVDBlockStats *BlockStats( std::size_t blockId, int lod = 0 ) const;
+	/**
+	 * \brief Returns a block id with the same voxels as \a blockId as far as the file tells: the lowest of the
+	 * blocks sharing an extent of a LVD_FLAG_DEDUP level, or the first absent block in storage order for all absent
+	 * blocks. Blocks with the same instance could share one slot of a cache. Blocks of a writable file are their
+	 * own instances.
+	 */
+	std::size_t BlockInstance( std::size_t blockId, int lod = 0 ) const;
+	LVDBlockLocation LocateBlock( std::size_t blockId, int lod = 0 ) const;
 	~LVDFile();
-
-private:
-	Ref<IMappingFile> lvdIO;
 };
 
 template <typename T, int nLogBlockSize>
 std::shared_ptr<Block3DArray<T, nLogBlockSize>> LVDFile::ReadAll( int lod )
 {
-	const auto s = Size();
-	const size_t bytes = s.x * s.y * s.z * sizeof( T );
-	auto ptr = std::make_shared<vm::Block3DArray<T, nLogBlockSize>>( s.x, s.y, s.z, nullptr );
-	return ptr;
+	if ( sizeof( T ) != std::size_t( VoxelBytes( lod ) ) ) {
+		return nullptr;
+	}
+	const auto s = OriginalDataSize( lod );
+	if ( nLogBlockSize != BlockSizeInLog( lod ) || GetBlockPadding( lod ) != 0 ) {
+		std::unique_ptr<T[]> linear( new T[ s.x * s.y * s.z ] );
+		ReadAll( linear.get(), lod );
+		// the array bricks the volume in its own block size
+		return std::make_shared<vm::Block3DArray<T, nLogBlockSize>>( s.x, s.y, s.z, linear.get() );
+	}
+	auto array = std::make_shared<vm::Block3DArray<T, nLogBlockSize>>( s.x, s.y, s.z, nullptr );
+	const auto dim = SizeByBlock( lod );
+	const std::size_t blockBytes = BlockBytes( lod );
+	ForEachBlock( CoveringBlocks( Vec3i( 0, 0, 0 ), Vec3i( s.x, s.y, s.z ), lod ), lod, 0, [ & ]( std::size_t id, const unsigned char *block ) {
+		memcpy( array->BlockData( int( id % dim.x ), int( id / dim.x % dim.y ), int( id / ( dim.x * dim.y ) ) ), block, blockBytes );
+	} );
+	return array;
 }
 }  // namespace ysl
@@ -1,9 +1,29 @@
 
 #include "lvdfileheader.h"
+#include <cstdint>
 #include <cstring>
 
 namespace vm
 {
+namespace
+{
+/**
+ * \brief A half of a 64-bit dimension
+ */
+uint64_t DecodeDim32( const unsigned char *src )
+{
+	uint32_t v;
+	memcpy( &v, src, sizeof( v ) );
+	return v;
+}
+
+void EncodeDim32( unsigned char *dst, uint64_t half )
+{
+	const uint32_t v = uint32_t( half );
+	memcpy( dst, &v, sizeof( v ) );
+}
+}  // namespace
+
 vm::LVDFileHeader::LVDFileHeader() :
   buf( new unsigned char[ BufSize ] )
 {
@@ -11,34 +31,79 @@ vm::LVDFileHeader::LVDFileHeader() :
 
 int LVDFileHeader::HeaderSize() const
 {
-	return LVD_HEADER_SIZE;
+	return magicNum == LVD_MAGIC_NUMBER_V2 ? LVD_V2_HEADER_SIZE : LVD_HEADER_SIZE;
 }
 
 void LVDFileHeader::Decode( unsigned char *p )
 {
 	memcpy( ( &magicNum ), p + ( LVD_HEADER_MAGIC_FILED_OFFSET ), ( LVD_HEADER_MAGIC_FILED_SIZE ) );
-	memcpy( &dataDim[ 0 ], p + LVD_DATA_WIDTH_FIELD_OFFSET, LVD_DATA_WIDTH_FIELD_SIZE );
-	memcpy( &dataDim[ 1 ], p + LVD_DATA_HEIGHT_FIELD_OFFSET, LVD_DATA_HEIGHT_FIELD_SIZE );
-	memcpy( &dataDim[ 2 ], p + LVD_DATA_DEPTH_FIELD_OFFSET, LVD_DATA_DEPTH_FIELD_SIZE );
+	dataDim[ 0 ] = DecodeDim32( p + LVD_DATA_WIDTH_FIELD_OFFSET );
+	dataDim[ 1 ] = DecodeDim32( p + LVD_DATA_HEIGHT_FIELD_OFFSET );
+	dataDim[ 2 ] = DecodeDim32( p + LVD_DATA_DEPTH_FIELD_OFFSET );
 	memcpy( &blockLengthInLog, p + LVD_BLOCK_LOG_FILED_OFFSET, LVD_DATA_BLOCK_LENGTH_IN_LOG_FILED_SIZE );
 	memcpy( &padding, p + LVD_BLOCK_PADDING_FIELD_OFFSET, LVD_DATA_PADDING_FIELD_SIZE );
-	memcpy( &originalDataDim[ 0 ], p + LVD_DATA_ORIGINAL_WIDTH_FIELD_OFFSET, LVD_DATA_ORIGINAL_WIDTH_FIELD_OFFSET );
-	memcpy( &originalDataDim[ 1 ], p + LVD_DATA_ORIGINAL_HEIGHT_FIELD_OFFSET, LVD_DATA_ORIGINAL_HEIGHT_FIELD_OFFSET );
-	memcpy( &originalDataDim[ 2 ], p + LVD_DATA_ORIGINAL_DEPTH_FIELD_OFFSET, LVD_DATA_ORIGINAL_DEPTH_FIELD_OFFSET );
+	originalDataDim[ 0 ] = DecodeDim32( p + LVD_DATA_ORIGINAL_WIDTH_FIELD_OFFSET );
+	originalDataDim[ 1 ] = DecodeDim32( p + LVD_DATA_ORIGINAL_HEIGHT_FIELD_OFFSET );
+	originalDataDim[ 2 ] = DecodeDim32( p + LVD_DATA_ORIGINAL_DEPTH_FIELD_OFFSET );
+	if ( magicNum == LVD_MAGIC_NUMBER_V2 ) {
+		memcpy( &version, p + LVD_VERSION_FIELD_OFFSET, LVD_VERSION_FIELD_SIZE );
+		memcpy( &flags, p + LVD_FLAGS_FIELD_OFFSET, LVD_FLAGS_FIELD_SIZE );
+		memcpy( &voxelType, p + LVD_VOXEL_TYPE_FIELD_OFFSET, LVD_VOXEL_TYPE_FIELD_SIZE );
+		memcpy( &levelBytes, p + LVD_LEVEL_BYTES_FIELD_OFFSET, LVD_LEVEL_BYTES_FIELD_SIZE );
+		memcpy( &blockTableOffset, p + LVD_BLOCK_TABLE_OFFSET_FIELD_OFFSET, LVD_BLOCK_TABLE_OFFSET_FIELD_SIZE );
+		memcpy( &payloadOffset, p + LVD_PAYLOAD_OFFSET_FIELD_OFFSET, LVD_PAYLOAD_OFFSET_FIELD_SIZE );
+		memcpy( &payloadEnd, p + LVD_PAYLOAD_END_FIELD_OFFSET, LVD_PAYLOAD_END_FIELD_SIZE );
+		memcpy( &statsOffset, p + LVD_STATS_OFFSET_FIELD_OFFSET, LVD_STATS_OFFSET_FIELD_SIZE );
+		memcpy( &revision, p + LVD_HEADER_REVISION_FIELD_OFFSET, LVD_HEADER_REVISION_FIELD_SIZE );
+		if ( revision >= 1 ) {
+			for ( int i = 0; i < 3; i++ ) {
+				dataDim[ i ] |= DecodeDim32( p + LVD_DATA_DIM_HIGH_FIELD_OFFSET + 4 * i ) << 32;
+				originalDataDim[ i ] |= DecodeDim32( p + LVD_ORIGINAL_DATA_DIM_HIGH_FIELD_OFFSET + 4 * i ) << 32;
+			}
+		}
+	} else {
+		const uint64_t dataBytes = dataDim[ 0 ] * dataDim[ 1 ] * dataDim[ 2 ];
+		version = LVD_VERSION_1;
+		revision = 0;
+		flags = 0;
+		voxelType = LVD_VOXEL_UINT8;
+		levelBytes = LVD_HEADER_SIZE + dataBytes;
+		blockTableOffset = 0;
+		payloadOffset = LVD_HEADER_SIZE;
+		payloadEnd = levelBytes;
+		statsOffset = 0;
+	}
 }
 
 unsigned char *LVDFileHeader::Encode()
 {
 	const auto p = buf.get();
 	memcpy( p + ( LVD_HEADER_MAGIC_FILED_OFFSET ), ( &magicNum ), ( LVD_HEADER_MAGIC_FILED_SIZE ) );
-	memcpy( p + LVD_DATA_WIDTH_FIELD_OFFSET, &dataDim[ 0 ], LVD_DATA_WIDTH_FIELD_SIZE );
-	memcpy( p + LVD_DATA_HEIGHT_FIELD_OFFSET, &dataDim[ 1 ], LVD_DATA_HEIGHT_FIELD_SIZE );
-	memcpy( p + LVD_DATA_DEPTH_FIELD_OFFSET, &dataDim[ 2 ], LVD_DATA_DEPTH_FIELD_SIZE );
+	EncodeDim32( p + LVD_DATA_WIDTH_FIELD_OFFSET, dataDim[ 0 ] );
+	EncodeDim32( p + LVD_DATA_HEIGHT_FIELD_OFFSET, dataDim[ 1 ] );
+	EncodeDim32( p + LVD_DATA_DEPTH_FIELD_OFFSET, dataDim[ 2 ] );
 	memcpy( p + LVD_BLOCK_LOG_FILED_OFFSET, &blockLengthInLog, LVD_DATA_BLOCK_LENGTH_IN_LOG_FILED_SIZE );
 	memcpy( p + LVD_BLOCK_PADDING_FIELD_OFFSET, &padding, LVD_DATA_PADDING_FIELD_SIZE );
-	memcpy( p + LVD_DATA_ORIGINAL_WIDTH_FIELD_OFFSET, &originalDataDim[ 0 ], LVD_DATA_ORIGINAL_WIDTH_FIELD_OFFSET );
-	memcpy( p + LVD_DATA_ORIGINAL_HEIGHT_FIELD_OFFSET, &originalDataDim[ 1 ], LVD_DATA_ORIGINAL_HEIGHT_FIELD_OFFSET );
-	memcpy( p + LVD_DATA_ORIGINAL_DEPTH_FIELD_OFFSET, &originalDataDim[ 2 ], LVD_DATA_ORIGINAL_DEPTH_FIELD_OFFSET );
+	EncodeDim32( p + LVD_DATA_ORIGINAL_WIDTH_FIELD_OFFSET, originalDataDim[ 0 ] );
+	EncodeDim32( p + LVD_DATA_ORIGINAL_HEIGHT_FIELD_OFFSET, originalDataDim[ 1 ] );
+	EncodeDim32( p + LVD_DATA_ORIGINAL_DEPTH_FIELD_OFFSET, originalDataDim[ 2 ] );
+	if ( magicNum == LVD_MAGIC_NUMBER_V2 ) {
+		memset( p + LVD_HEADER_SIZE, 0, LVD_V2_HEADER_SIZE - LVD_HEADER_SIZE );
+		memcpy( p + LVD_VERSION_FIELD_OFFSET, &version, LVD_VERSION_FIELD_SIZE );
+		memcpy( p + LVD_FLAGS_FIELD_OFFSET, &flags, LVD_FLAGS_FIELD_SIZE );
+		memcpy( p + LVD_VOXEL_TYPE_FIELD_OFFSET, &voxelType, LVD_VOXEL_TYPE_FIELD_SIZE );
+		memcpy( p + LVD_LEVEL_BYTES_FIELD_OFFSET, &levelBytes, LVD_LEVEL_BYTES_FIELD_SIZE );
+		memcpy( p + LVD_BLOCK_TABLE_OFFSET_FIELD_OFFSET, &blockTableOffset, LVD_BLOCK_TABLE_OFFSET_FIELD_SIZE );
+		memcpy( p + LVD_PAYLOAD_OFFSET_FIELD_OFFSET, &payloadOffset, LVD_PAYLOAD_OFFSET_FIELD_SIZE );
+		memcpy( p + LVD_PAYLOAD_END_FIELD_OFFSET, &payloadEnd, LVD_PAYLOAD_END_FIELD_SIZE );
+		memcpy( p + LVD_STATS_OFFSET_FIELD_OFFSET, &statsOffset, LVD_STATS_OFFSET_FIELD_SIZE );
+		const uint32_t rev = LVD_HEADER_REVISION;
+		memcpy( p + LVD_HEADER_REVISION_FIELD_OFFSET, &rev, LVD_HEADER_REVISION_FIELD_SIZE );
+		for ( int i = 0; i < 3; i++ ) {
+			EncodeDim32( p + LVD_DATA_DIM_HIGH_FIELD_OFFSET + 4 * i, dataDim[ i ] >> 32 );
+			EncodeDim32( p + LVD_ORIGINAL_DATA_DIM_HIGH_FIELD_OFFSET + 4 * i, originalDataDim[ i ] >> 32 );
+		}
+	}
 	return p;
 }
 }  // namespace ysl
@@ -3,6 +3,8 @@
 
 #include <cstdint>
 #include <memory>
+#include <lvdblockstats.hpp>
+#include <lvdvoxeltype.hpp>
 
 #define LVD_HEADER_BUF_ORIGIN_OFFSET 0
 
@@ -44,23 +46,174 @@
 
 #define LVD_HEADER_SIZE ( ( LVD_DATA_ORIGINAL_DEPTH_FIELD_OFFSET ) + ( LVD_DATA_ORIGINAL_DEPTH_FIELD_SIZE ) )
 
+/*
+ * LVD v2 extends the v1 header. A v2 level is laid out as
+ * [header (LVD_V2_HEADER_SIZE)][block table (LVDBlockEntry per block)][block stats (LVDBlockStats per block)][payload]
+ * and every offset stored in it is relative to the beginning of the level.
+ */
+
+#define LVD_VERSION_FIELD_SIZE 4
+
+#define LVD_FLAGS_FIELD_SIZE 4
+
+#define LVD_VOXEL_TYPE_FIELD_SIZE 4  // reserved and zero (LVD_VOXEL_UINT8) in the first v2 files
+
+#define LVD_LEVEL_BYTES_FIELD_SIZE 8
+
+#define LVD_BLOCK_TABLE_OFFSET_FIELD_SIZE 8
+
+#define LVD_PAYLOAD_OFFSET_FIELD_SIZE 8
+
+#define LVD_PAYLOAD_END_FIELD_SIZE 8
+
+#define LVD_STATS_OFFSET_FIELD_SIZE 8
+
+#define LVD_HEADER_REVISION_FIELD_SIZE 4  // zero in the files written before the 64-bit dimensions
+
+#define LVD_DATA_DIM_HIGH_FIELD_SIZE 12  // the high 32 bits of x, y, z
+
+#define LVD_ORIGINAL_DATA_DIM_HIGH_FIELD_SIZE 12
+
+#define LVD_VERSION_FIELD_OFFSET ( LVD_HEADER_SIZE )
+
+#define LVD_FLAGS_FIELD_OFFSET ( ( LVD_VERSION_FIELD_OFFSET ) + ( LVD_VERSION_FIELD_SIZE ) )
+
+#define LVD_VOXEL_TYPE_FIELD_OFFSET ( ( LVD_FLAGS_FIELD_OFFSET ) + ( LVD_FLAGS_FIELD_SIZE ) )
+
+#define LVD_LEVEL_BYTES_FIELD_OFFSET ( ( LVD_VOXEL_TYPE_FIELD_OFFSET ) + ( LVD_VOXEL_TYPE_FIELD_SIZE ) )
+
+#define LVD_BLOCK_TABLE_OFFSET_FIELD_OFFSET ( ( LVD_LEVEL_BYTES_FIELD_OFFSET ) + ( LVD_LEVEL_BYTES_FIELD_SIZE ) )
+
+#define LVD_PAYLOAD_OFFSET_FIELD_OFFSET ( ( LVD_BLOCK_TABLE_OFFSET_FIELD_OFFSET ) + ( LVD_BLOCK_TABLE_OFFSET_FIELD_SIZE ) )
+
+#define LVD_PAYLOAD_END_FIELD_OFFSET ( ( LVD_PAYLOAD_OFFSET_FIELD_OFFSET ) + ( LVD_PAYLOAD_OFFSET_FIELD_SIZE ) )
+
+#define LVD_STATS_OFFSET_FIELD_OFFSET ( ( LVD_PAYLOAD_END_FIELD_OFFSET ) + ( LVD_PAYLOAD_END_FIELD_SIZE ) )
+
+#define LVD_HEADER_REVISION_FIELD_OFFSET ( ( LVD_STATS_OFFSET_FIELD_OFFSET ) + ( LVD_STATS_OFFSET_FIELD_SIZE ) )
+
+#define LVD_DATA_DIM_HIGH_FIELD_OFFSET ( ( LVD_HEADER_REVISION_FIELD_OFFSET ) + ( LVD_HEADER_REVISION_FIELD_SIZE ) )
+
+#define LVD_ORIGINAL_DATA_DIM_HIGH_FIELD_OFFSET ( ( LVD_DATA_DIM_HIGH_FIELD_OFFSET ) + ( LVD_DATA_DIM_HIGH_FIELD_SIZE ) )
+
+#define LVD_V2_HEADER_SIZE 128  // the rest of the header is reserved and zero
+
+/*
+ * Revision 1 of the v2 header widens the dimensions to 64 bits, the 32-bit fields of the v1 part hold
+ * the low halves and the high halves follow the stats offset. Older readers only see the low halves,
+ * which are the dimensions of every level smaller than 2^32 voxels along each axis.
+ */
+
+#define LVD_HEADER_REVISION 1
+
+#define LVD_MAGIC_NUMBER_V1 277536
+
+#define LVD_MAGIC_NUMBER_V2 277537
+
+#define LVD_VERSION_1 1
+
+#define LVD_VERSION_2 2
+
+/*
+ * A sparse v2 level only stores the occupied (non-zero) blocks:
+ * [header][occupancy bitmap][rank directory][block table][payload]
+ * The bitmap has one bit per block in uint64 words starting at LVD_V2_HEADER_SIZE, the rank
+ * directory holds the number of set bits before each word in uint32, and the block table has
+ * one entry per occupied block in block id order.
+ */
+
+#define LVD_FLAG_SPARSE 0x1
+
+/*
+ * Every block of an aligned v2 level starts at a multiple of LVD_BLOCK_ALIGNMENT in the file and
+ * its slot is padded to it, so a block is read by O_DIRECT without touching its neighbours. The
+ * payload of every v2 level starts at such a boundary anyway.
+ */
+
+#define LVD_FLAG_ALIGNED 0x2
+
+#define LVD_BLOCK_ALIGNMENT 4096
+
+/*
+ * The block table, the occupancy index and the stats of a Morton level are in the Morton (Z-order) of
+ * the block coordinates instead of the linear x fastest order, see LVDMortonOrder. Block ids are linear
+ * in the API either way. Writers store the payload in the same order, so bricks that are neighbours in
+ * 3D are neighbouring extents in the file.
+ */
+
+#define LVD_FLAG_MORTON 0x4
+
+/*
+ * Blocks of a dedup v2 level that encode to the same bytes share one stored copy: their table entries
+ * point to the same payload extent. Readers need nothing more to read them, the shared extent only
+ * tells a cache that the blocks could share one slot (see LVDFile::BlockInstance).
+ */
+
+#define LVD_FLAG_DEDUP 0x8
+
+/*
+ * A delta v2 level is a timestep of a series (see LVDSeriesFile) that only stores the blocks changed since
+ * its keyframe, the absent blocks are the ones of the keyframe rather than zero. Delta levels are dense, so
+ * a block changed to zero is stored like any other.
+ */
+
+#define LVD_FLAG_DELTA 0x10
+
 namespace vm
 {
+/**
+ * \brief Codec of a block stored in a v2 level
+ */
+enum LVDBlockCodec : uint8_t
+{
+	LVD_CODEC_RAW = 0,
+	LVD_CODEC_RLE = 1,
+	LVD_CODEC_DELTA_BITPACK = 2
+};
+
+/**
+ * \brief An entry of the v2 block table. A zero length means the block has never been written.
+ */
+struct LVDBlockEntry
+{
+	uint64_t offset;  // relative to the beginning of the level
+	uint32_t length;  // stored (encoded) bytes
+	uint8_t codec;
+	uint8_t reserved[ 3 ];
+};
+static_assert( sizeof( LVDBlockEntry ) == 16, "LVDBlockEntry is a part of the file format" );
+static_assert( sizeof( LVDBlockStats ) == 48, "LVDBlockStats is a part of the file format" );
+static_assert( LVD_ORIGINAL_DATA_DIM_HIGH_FIELD_OFFSET + LVD_ORIGINAL_DATA_DIM_HIGH_FIELD_SIZE <= LVD_V2_HEADER_SIZE, "the v2 header is full" );
+
 class LVDFileHeader
 {
 	std::unique_ptr<unsigned char[]> buf;
-	static constexpr int BufSize = 64;
+	static constexpr int BufSize = LVD_V2_HEADER_SIZE;
 
 public:
 	uint32_t magicNum;
-	uint32_t dataDim[ 3 ];
+	uint64_t dataDim[ 3 ];	// 32-bit before revision 1
 	uint32_t blockLengthInLog;
 	uint32_t padding;
-	uint32_t originalDataDim[ 3 ];
+	uint64_t originalDataDim[ 3 ];
+
+	// v2 only, Decode sets them for a v1 header as if it is a raw v2 one
+	uint32_t version = LVD_VERSION_1;
+	uint32_t flags = 0;
+	LVDVoxelType voxelType = LVD_VOXEL_UINT8;
+	uint64_t levelBytes = 0;
+	uint64_t blockTableOffset = 0;
+	uint64_t payloadOffset = 0;
+	uint64_t payloadEnd = 0;
+	uint64_t statsOffset = 0;  // 0 if the level has no block stats, they are indexed by block id (Morton rank) even for sparse levels
+	uint32_t revision = 0;	   // of a decoded v2 header, Encode always writes LVD_HEADER_REVISION
 
 public:
 	LVDFileHeader();
 	int HeaderSize() const;
+	/**
+	 * \brief \a buf must hold HeaderSize() bytes of the header it contains. LVD_V2_HEADER_SIZE is always enough.
+	 */
 	void Decode( unsigned char *buf );
 	unsigned char *Encode();
 };
@@ -2,48 +2,240 @@
 namespace vm
 {
 inline LVDFilePlugin::LVDFilePlugin( ::vm::IRefCnt *cnt ) :
-  vm::EverythingBase<I3DBlockFilePluginInterface>( cnt )
+  vm::EverythingBase<ILVDFilePluginInterface>( cnt )
+{
+}
+
+LVDFilePlugin::LVDFilePlugin( ::vm::IRefCnt *cnt, std::shared_ptr<LVDFile> file, int lod ) :
+  vm::EverythingBase<ILVDFilePluginInterface>( cnt ),
+  lvdReader( std::move( file ) ),
+  lod( lod ),
+  readOnly( lvdReader->ReadOnly() ),
+  directIO( lvdReader->DirectIO() )
+{
+}
+
+LVDFilePlugin::LVDFilePlugin( ::vm::IRefCnt *cnt, std::shared_ptr<LVDShardedFile> file, int lod ) :
+  vm::EverythingBase<ILVDFilePluginInterface>( cnt ),
+  lvdReader( file->Shard( 0 ) ),
+  shardedReader( std::move( file ) ),
+  lod( lod ),
+  readOnly( lvdReader->ReadOnly() ),
+  directIO( lvdReader->DirectIO() )
+{
+}
+
+LVDFilePlugin::LVDFilePlugin( ::vm::IRefCnt *cnt, std::shared_ptr<LVDSeriesFile> file, int lod ) :
+  vm::EverythingBase<ILVDFilePluginInterface>( cnt ),
+  lvdReader( file->Timestep( 0 ) ),
+  seriesReader( std::move( file ) ),
+  lod( lod ),
+  readOnly( true ),
+  directIO( lvdReader->DirectIO() )
 {
 }
 
 bool LVDFilePlugin::Create( const Block3DDataFileDesc *desc ){
-	lvdReader = std::make_unique<LVDFile>(
+	lvdReader = std::make_shared<LVDFile>(
 		desc->FileName,
 		desc->BlockSideInLog,
 		vm::Vec3i(desc->DataSize[0],desc->DataSize[1],desc->DataSize[2]),
-		desc->Padding);
+		desc->Padding,
+		LVD_VERSION_2,
+		0 );  // dense, the pages could be written again in any order after the file is opened again
+	shardedReader = nullptr;
+	seriesReader = nullptr;
+	lod = 0;
     return lvdReader != nullptr;
 }
 void LVDFilePlugin::Close()
 {
+	pageReader = nullptr;
 	lvdReader = nullptr;
+	shardedReader = nullptr;
+	seriesReader = nullptr;
 }
 inline void LVDFilePlugin::Open( const std::string &fileName )
 {
-	lvdReader = std::make_unique<LVDFile>( fileName );
-	if ( lvdReader == nullptr ) {
+	pageReader = nullptr;
+	shardedReader = nullptr;
+	seriesReader = nullptr;
+	lod = 0;
+	if ( LVDSeriesFile::IsManifest( fileName ) ) {
+		seriesReader = std::make_shared<LVDSeriesFile>( fileName );
+		if ( seriesReader->Valid() == false ) {
+			seriesReader = nullptr;
+			throw std::runtime_error( "failed to open lvd series" );
+		}
+		lvdReader = seriesReader->Timestep( 0 );
+		if ( directIO ) {
+			seriesReader->SetDirectIO( true );
+		}
+		return;
+	}
+	if ( LVDShardedFile::IsManifest( fileName ) ) {
+		shardedReader = std::make_shared<LVDShardedFile>( fileName, readOnly );
+		if ( shardedReader->Valid() == false ) {
+			shardedReader = nullptr;
+			throw std::runtime_error( "failed to open sharded lvd file" );
+		}
+		lvdReader = shardedReader->Shard( 0 );
+		if ( directIO ) {
+			shardedReader->SetDirectIO( true );
+		}
+		return;
+	}
+	lvdReader = std::make_shared<LVDFile>( fileName, readOnly );
+	if ( lvdReader == nullptr || lvdReader->Valid() == false ) {
 		throw std::runtime_error( "failed to open lvd file" );
 	}
+	if ( directIO ) {
+		lvdReader->SetDirectIO( true );	 // stays mapped if it fails
+	}
+}
+void LVDFilePlugin::OpenLODs( const std::vector<std::string> &fileNames )
+{
+	pageReader = nullptr;
+	shardedReader = nullptr;
+	seriesReader = nullptr;
+	lvdReader = std::make_shared<LVDFile>( fileNames, std::vector<int>{}, readOnly );
+	lod = 0;
+	if ( lvdReader == nullptr || lvdReader->Valid() == false || lvdReader->LODCount() == 0 ) {
+		throw std::runtime_error( "failed to open lvd files" );
+	}
+	if ( directIO ) {
+		lvdReader->SetDirectIO( true );
+	}
+}
+Ref<I3DBlockFilePluginInterface> LVDFilePlugin::GetLODView( int lod )
+{
+	if ( lvdReader == nullptr || lod < 0 || lod >= lvdReader->LODCount() ) {
+		return nullptr;
+	}
+	if ( seriesReader ) {
+		return VM_NEW<LVDFilePlugin>( seriesReader, lod );
+	}
+	if ( shardedReader ) {
+		return VM_NEW<LVDFilePlugin>( shardedReader, lod );
+	}
+	return VM_NEW<LVDFilePlugin>( lvdReader, lod );
+}
+const void *LVDFilePlugin::GetPage( size_t pageID, int lod )
+{
+	auto &file = File( pageID, lod );
+	if ( file.BlockOccupied( pageID, lod ) == false ) {
+		return file.ZeroBlock( lod );
+	}
+	if ( const auto page = file.ReadBlock( pageID, lod ) ) {
+		return page;
+	}
+	// the block is compressed in the file
+	pageBuffer.resize( file.BlockBytes( lod ) );
+	file.ReadBlock( (char *)pageBuffer.data(), pageID, lod );
+	return pageBuffer.data();
 }
 inline Size3 LVDFilePlugin::Get3DPageSize() const
 {
-	const std::size_t len = lvdReader->BlockSize();
+	const std::size_t len = lvdReader->BlockSize( lod );
 	return Size3{ len, len, len };
 }
 void LVDFilePlugin::Flush()
 {
+	if ( shardedReader ) {
+		shardedReader->Flush();
+	} else if ( lvdReader ) {
+		lvdReader->Flush();
+	}
 }
 void LVDFilePlugin::Write( const void *page, size_t pageID, bool flush )
 {
-	lvdReader->WriteBlock((const char*)page,pageID,0);
-	if(flush){
-		lvdReader->Flush(pageID,0);
+	auto &file = File( pageID, lod );
+	file.WriteBlock( (const char *)page, pageID, lod );
+	if ( flush ) {
+		file.Flush( pageID, lod );
+	}
+}
+size_t LVDFilePlugin::GetPageInstance( size_t pageID, int lod )
+{
+	// the pages of a series change with the timestep, they are not shared
+	if ( seriesReader ) {
+		return pageID;
+	}
+	return shardedReader ? shardedReader->BlockInstance( pageID, lod ) : lvdReader->BlockInstance( pageID, lod );
+}
+void LVDFilePlugin::SetDirectIO( bool enable )
+{
+	directIO = enable;
+	if ( seriesReader ) {
+		seriesReader->SetDirectIO( enable );
+	} else if ( shardedReader ) {
+		shardedReader->SetDirectIO( enable );
+	} else if ( lvdReader ) {
+		lvdReader->SetDirectIO( enable );
+	}
+}
+void LVDFilePlugin::SetPageIOMode( LVDPageIOMode mode, int threadCount )
+{
+	pageIOMode = mode;
+	pageIOThreads = threadCount;
+	pageReader = nullptr;
+	if ( ( mode == LVD_PAGE_IO_URING || mode == LVD_PAGE_IO_URING_DIRECT ) && LVDIOUring::Supported() == false ) {
+		pageIOMode = LVD_PAGE_IO_MMAP;
+	}
+}
+void LVDFilePlugin::SubmitPages( const std::vector<LVDPageRequest> &requests )
+{
+	if ( pageReader == nullptr ) {
+		if ( seriesReader ) {
+			pageReader.reset( new LVDPageReader( seriesReader, pageIOMode, pageIOThreads ) );
+		} else {
+			pageReader.reset( shardedReader ? new LVDPageReader( shardedReader, pageIOMode, pageIOThreads ) : new LVDPageReader( lvdReader, pageIOMode, pageIOThreads ) );
+		}
+	}
+	pageReader->Submit( requests );
+}
+size_t LVDFilePlugin::CollectPages( std::vector<LVDPageRequest> &completed, size_t minCount )
+{
+	return pageReader ? pageReader->Collect( completed, minCount ) : 0;
+}
+bool LVDFilePlugin::ReadRegion( const Bound3i &bound, int lod, void *dst, size_t rowStride, size_t sliceStride )
+{
+	if ( seriesReader ) {
+		return seriesReader->ReadRegion( bound, lod, dst, rowStride, sliceStride );
+	}
+	if ( shardedReader ) {
+		return shardedReader->ReadRegion( bound, lod, dst, rowStride, sliceStride );
+	}
+	return lvdReader ? lvdReader->ReadRegion( bound, lod, dst, rowStride, sliceStride ) : false;
+}
+bool LVDFilePlugin::SetTimestep( int timestep )
+{
+	if ( seriesReader == nullptr ) {
+		return timestep == 0;
+	}
+	return seriesReader->SetTimestep( timestep );
+}
+std::vector<size_t> LVDFilePlugin::GetChangedPages( int from, int to, int lod )
+{
+	if ( seriesReader == nullptr || from < 0 || to < 0 || from >= seriesReader->TimestepCount() || to >= seriesReader->TimestepCount() ) {
+		return {};
+	}
+	return seriesReader->ChangedBlocks( from, to, lod );
+}
+void LVDFilePlugin::Advise( const std::vector<size_t> &pageIDs, int lod, LVDAccessAdvice advice )
+{
+	if ( seriesReader ) {
+		seriesReader->AdviseBlocks( pageIDs, lod, advice );
+	} else if ( shardedReader ) {
+		shardedReader->AdviseBlocks( pageIDs, lod, advice );
+	} else {
+		lvdReader->AdviseBlocks( pageIDs, lod, advice );
 	}
 }
 void LVDFilePlugin::Flush( size_t pageID )
 {
-	lvdReader->Flush(pageID,0);
+	File( pageID, lod ).Flush( pageID, lod );
 }
 }  // namespace vm
 VM_REGISTER_PLUGIN_FACTORY_IMPL( LVDFilePluginFactory )
-EXPORT_PLUGIN_FACTORY_IMPLEMENT( LVDFilePluginFactory )
\ No newline at end of file
+EXPORT_PLUGIN_FACTORY_IMPLEMENT( LVDFilePluginFactory )
@@ -4,28 +4,47 @@
 #include <VMUtils/ieverything.hpp>
 #include <VMCoreExtension/plugin.h>
 #include <VMCoreExtension/i3dblockfileplugininterface.h>
+#include <ilvdfileplugininterface.hpp>
+#include "lvdpagereader.h"
+#include "lvdshardedfile.h"
+#include "lvdseriesfile.h"
 
 namespace vm
 {
-class LVDFilePlugin : public vm::EverythingBase<I3DBlockFilePluginInterface>
+class LVDFilePlugin : public vm::EverythingBase<ILVDFilePluginInterface>
 {
-	std::unique_ptr<LVDFile> lvdReader;
+	std::shared_ptr<LVDFile> lvdReader;	 // the first shard of a sharded file, it has the geometry of all of them
+	std::shared_ptr<LVDShardedFile> shardedReader;
+	std::shared_ptr<LVDSeriesFile> seriesReader;  // lvdReader is its first timestep
+	int lod = 0;  // the level served by the I3DBlockFilePluginInterface part
+	std::vector<unsigned char> pageBuffer;	// decoded page of compressed blocks, valid until the next GetPage
+	bool readOnly = false;
+	bool directIO = false;
+	LVDPageIOMode pageIOMode = LVD_PAGE_IO_PREAD;
+	int pageIOThreads = 16;
+	std::unique_ptr<LVDPageReader> pageReader;	// created by the first SubmitPages
 
 public:
 	LVDFilePlugin( ::vm::IRefCnt *cnt );
+	/**
+	 * @brief Creates a view of level \a lod of an opened file
+	 */
+	LVDFilePlugin( ::vm::IRefCnt *cnt, std::shared_ptr<LVDFile> file, int lod );
+	LVDFilePlugin( ::vm::IRefCnt *cnt, std::shared_ptr<LVDShardedFile> file, int lod );
+	LVDFilePlugin( ::vm::IRefCnt *cnt, std::shared_ptr<LVDSeriesFile> file, int lod );
 	void Open( const std::string &fileName ) override;
 	bool Create( const Block3DDataFileDesc *desc ) override;
 	void Close() override;
-	const void *GetPage( size_t pageID ) override { return lvdReader->ReadBlock( pageID ); }
-	size_t GetPageSize() const override { return lvdReader->BlockSize(); }
-	size_t GetPhysicalPageCount() const override { return lvdReader->BlockCount(); }
-	size_t GetVirtualPageCount() const override { return lvdReader->BlockCount(); }
+	const void *GetPage( size_t pageID ) override { return GetPage( pageID, lod ); }
+	size_t GetPageSize() const override { return lvdReader->BlockSize( lod ); }
+	size_t GetPhysicalPageCount() const override { return lvdReader->BlockCount( lod ); }
+	size_t GetVirtualPageCount() const override { return lvdReader->BlockCount( lod ); }
 
-	int GetPadding() const override { return lvdReader->GetBlockPadding(); }
-	Size3 GetDataSizeWithoutPadding() const override { return lvdReader->OriginalDataSize(); }
+	int GetPadding() const override { return lvdReader->GetBlockPadding( lod ); }
+	Size3 GetDataSizeWithoutPadding() const override { return lvdReader->OriginalDataSize( lod ); }
 	Size3 Get3DPageSize() const override;
-	int Get3DPageSizeInLog() const override { return lvdReader->BlockSizeInLog(); }
-	Size3 Get3DPageCount() const override { return lvdReader->SizeByBlock(); }
+	int Get3DPageSizeInLog() const override { return lvdReader->BlockSizeInLog( lod ); }
+	Size3 Get3DPageCount() const override { return lvdReader->SizeByBlock( lod ); }
 
 	void Flush() override;
 
@@ -33,7 +52,38 @@ public:
 
 	 void Flush( size_t pageID ) override;
 
+	void OpenLODs( const std::vector<std::string> &fileNames ) override;
+	int GetLODCount() const override { return lvdReader->LODCount(); }
+	int GetLOD() const override { return lod; }
+	const void *GetPage( size_t pageID, int lod ) override;
+	Ref<I3DBlockFilePluginInterface> GetLODView( int lod ) override;
+	LVDVoxelType GetVoxelType( int lod ) const override { return lvdReader->VoxelType( lod ); }
+	const LVDBlockStats *GetPageStats( size_t pageID, int lod ) override { return File( pageID, lod ).BlockStats( pageID, lod ); }
+	size_t GetPageInstance( size_t pageID, int lod ) override;
+	void SetReadOnly( bool readOnly ) override { this->readOnly = readOnly; }
+	void Prefetch( const std::vector<size_t> &pageIDs, int lod ) override { Advise( pageIDs, lod, LVD_ADVICE_WILLNEED ); }
+	void Evict( const std::vector<size_t> &pageIDs, int lod ) override { Advise( pageIDs, lod, LVD_ADVICE_DONTNEED ); }
+	void SetDirectIO( bool enable ) override;
+	bool GetDirectIO() const override { return lvdReader ? lvdReader->DirectIO() : false; }
+	void SetPageIOMode( LVDPageIOMode mode, int threadCount ) override;
+	LVDPageIOMode GetPageIOMode() const override { return pageReader ? pageReader->Mode() : pageIOMode; }
+	void SubmitPages( const std::vector<LVDPageRequest> &requests ) override;
+	size_t CollectPages( std::vector<LVDPageRequest> &completed, size_t minCount ) override;
+	bool ReadRegion( const Bound3i &bound, int lod, void *dst, size_t rowStride, size_t sliceStride ) override;
+	int GetTimestepCount() const override { return seriesReader ? seriesReader->TimestepCount() : 1; }
+	int GetTimestep() const override { return seriesReader ? seriesReader->CurrentTimestep() : 0; }
+	bool SetTimestep( int timestep ) override;
+	std::vector<size_t> GetChangedPages( int from, int to, int lod ) override;
+
 private:
+	/**
+	 * \brief The file holding the page: the shard of a sharded file, the timestep or the keyframe of a series
+	 */
+	LVDFile &File( size_t pageID, int lod ) const
+	{
+		return seriesReader ? seriesReader->FileOf( pageID, lod ) : shardedReader ? shardedReader->FileOf( pageID, lod ) : *lvdReader;
+	}
+	void Advise( const std::vector<size_t> &pageIDs, int lod, LVDAccessAdvice advice );
 };
 
 }  // namespace vm
@@ -42,10 +92,10 @@ class LVDFilePluginFactory : public vm::IPluginFactory
 {
 public:
 	DECLARE_PLUGIN_FACTORY( "visualman.blockdata.io" )
-	std::vector<std::string> Keys() const override { return { ".lvd" }; }
+	std::vector<std::string> Keys() const override { return { ".lvd", ".lvds", ".lvdt" }; }
 	::vm::IEverything *Create( const std::string &key ) override
 	{
-		if ( key == ".lvd" ) {
+		if ( key == ".lvd" || key == ".lvds" || key == ".lvdt" ) {
 			return VM_NEW<vm::LVDFilePlugin>();
 		}
 		return nullptr;
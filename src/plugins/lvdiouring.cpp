@@ -0,0 +1,233 @@
+#include "lvdiouring.h"
+
+#ifdef __linux__
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// older libc headers lack the numbers, they are the same on every architecture but alpha
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+#endif
+
+namespace vm
+{
+#ifdef __linux__
+namespace
+{
+int SysSetup( unsigned entries, io_uring_params *p )
+{
+	return int( syscall( __NR_io_uring_setup, entries, p ) );
+}
+int SysEnter( int fd, unsigned toSubmit, unsigned minComplete, unsigned flags )
+{
+	return int( syscall( __NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0 ) );
+}
+int SysRegister( int fd, unsigned opcode, const void *arg, unsigned count )
+{
+	return int( syscall( __NR_io_uring_register, fd, opcode, arg, count ) );
+}
+template <typename T>
+T *At( void *base, unsigned offset )
+{
+	return reinterpret_cast<T *>( static_cast<unsigned char *>( base ) + offset );
+}
+}  // namespace
+
+LVDIOUring::LVDIOUring( unsigned entries )
+{
+	io_uring_params p;
+	memset( &p, 0, sizeof( p ) );
+	const int fd = SysSetup( entries, &p );
+	if ( fd < 0 ) {
+		return;
+	}
+	sqRingBytes = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+	cqRingBytes = p.cq_off.cqes + p.cq_entries * sizeof( io_uring_cqe );
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		sqRingBytes = cqRingBytes = ( std::max )( sqRingBytes, cqRingBytes );
+	}
+	sqRing = mmap( nullptr, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+	if ( sqRing == MAP_FAILED ) {
+		sqRing = nullptr;
+		close( fd );
+		return;
+	}
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		cqRing = sqRing;
+	} else {
+		cqRing = mmap( nullptr, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING );
+		if ( cqRing == MAP_FAILED ) {
+			cqRing = nullptr;
+			munmap( sqRing, sqRingBytes );
+			sqRing = nullptr;
+			close( fd );
+			return;
+		}
+	}
+	sqesBytes = p.sq_entries * sizeof( io_uring_sqe );
+	sqes = mmap( nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+	if ( sqes == MAP_FAILED ) {
+		sqes = nullptr;
+		if ( cqRing != sqRing ) {
+			munmap( cqRing, cqRingBytes );
+		}
+		munmap( sqRing, sqRingBytes );
+		sqRing = cqRing = nullptr;
+		close( fd );
+		return;
+	}
+	sqHead = At<unsigned>( sqRing, p.sq_off.head );
+	sqTail = At<unsigned>( sqRing, p.sq_off.tail );
+	sqMask = At<unsigned>( sqRing, p.sq_off.ring_mask );
+	sqArray = At<unsigned>( sqRing, p.sq_off.array );
+	cqHead = At<unsigned>( cqRing, p.cq_off.head );
+	cqTail = At<unsigned>( cqRing, p.cq_off.tail );
+	cqMask = At<unsigned>( cqRing, p.cq_off.ring_mask );
+	cqes = At<io_uring_cqe>( cqRing, p.cq_off.cqes );
+	this->entries = p.sq_entries;
+	iovecs = new iovec[ p.sq_entries ];
+	ringFd = fd;
+}
+
+LVDIOUring::~LVDIOUring()
+{
+	if ( ringFd < 0 ) {
+		return;
+	}
+	munmap( sqes, sqesBytes );
+	if ( cqRing != sqRing ) {
+		munmap( cqRing, cqRingBytes );
+	}
+	munmap( sqRing, sqRingBytes );
+	close( ringFd );  // also unregisters the buffers
+	delete[] iovecs;
+}
+
+bool LVDIOUring::RegisterBuffers( void *base, std::size_t bytes, unsigned count )
+{
+	if ( ringFd < 0 ) {
+		return false;
+	}
+	std::unique_ptr<iovec[]> bufs( new iovec[ count ] );
+	for ( unsigned i = 0; i < count; i++ ) {
+		bufs[ i ].iov_base = static_cast<unsigned char *>( base ) + i * bytes;
+		bufs[ i ].iov_len = bytes;
+	}
+	fixedBuffers = SysRegister( ringFd, IORING_REGISTER_BUFFERS, bufs.get(), count ) == 0;
+	return fixedBuffers;
+}
+
+bool LVDIOUring::PrepareRead( int fd, void *dst, unsigned bytes, uint64_t offset, int bufIndex, uint64_t userData )
+{
+	const unsigned tail = *sqTail + queued;
+	if ( tail - __atomic_load_n( sqHead, __ATOMIC_ACQUIRE ) >= entries ) {
+		return false;
+	}
+	const unsigned index = tail & *sqMask;
+	auto sqe = static_cast<io_uring_sqe *>( sqes ) + index;
+	memset( sqe, 0, sizeof( *sqe ) );
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->user_data = userData;
+	if ( bufIndex >= 0 && fixedBuffers ) {
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->addr = reinterpret_cast<uint64_t>( dst );
+		sqe->len = bytes;
+		sqe->buf_index = uint16_t( bufIndex );
+	} else {
+		// IORING_OP_READ needs 5.6, the vectored read is there since 5.1
+		iovecs[ index ].iov_base = dst;
+		iovecs[ index ].iov_len = bytes;
+		sqe->opcode = IORING_OP_READV;
+		sqe->addr = reinterpret_cast<uint64_t>( &iovecs[ index ] );
+		sqe->len = 1;
+	}
+	sqArray[ index ] = index;
+	queued++;
+	return true;
+}
+
+bool LVDIOUring::Submit( unsigned waitCount )
+{
+	if ( queued > 0 ) {
+		__atomic_store_n( sqTail, *sqTail + queued, __ATOMIC_RELEASE );
+	}
+	unsigned toSubmit = queued;
+	queued = 0;
+	while ( true ) {
+		const int r = SysEnter( ringFd, toSubmit, waitCount, waitCount > 0 ? IORING_ENTER_GETEVENTS : 0 );
+		if ( r >= 0 ) {
+			toSubmit -= ( std::min )( unsigned( r ), toSubmit );
+			if ( toSubmit == 0 ) {
+				return true;
+			}
+		} else if ( errno != EINTR && errno != EAGAIN && errno != EBUSY ) {
+			return false;
+		}
+	}
+}
+
+bool LVDIOUring::Reap( uint64_t &userData, int &result )
+{
+	const unsigned head = *cqHead;
+	if ( head == __atomic_load_n( cqTail, __ATOMIC_ACQUIRE ) ) {
+		return false;
+	}
+	const auto cqe = static_cast<io_uring_cqe *>( cqes ) + ( head & *cqMask );
+	userData = cqe->user_data;
+	result = cqe->res;
+	__atomic_store_n( cqHead, head + 1, __ATOMIC_RELEASE );
+	return true;
+}
+
+bool LVDIOUring::Supported()
+{
+	static const bool supported = LVDIOUring( 2 ).Valid();
+	return supported;
+}
+
+#else
+
+LVDIOUring::LVDIOUring( unsigned )
+{
+}
+LVDIOUring::~LVDIOUring()
+{
+}
+bool LVDIOUring::RegisterBuffers( void *, std::size_t, unsigned )
+{
+	return false;
+}
+bool LVDIOUring::PrepareRead( int, void *, unsigned, uint64_t, int, uint64_t )
+{
+	return false;
+}
+bool LVDIOUring::Submit( unsigned )
+{
+	return false;
+}
+bool LVDIOUring::Reap( uint64_t &, int & )
+{
+	return false;
+}
+bool LVDIOUring::Supported()
+{
+	return false;
+}
+
+#endif
+}  // namespace vm
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct iovec;
+
+namespace vm
+{
+/**
+ * \brief A minimal io_uring for reads, set up with the raw syscalls so it needs neither liburing nor
+ * anything newer than the kernel headers.
+ *
+ * The ring is used by a single thread. It is invalid if the kernel has no io_uring (before 5.1, or
+ * disabled by a seccomp filter), and always invalid on other platforms.
+ */
+class LVDIOUring
+{
+	int ringFd = -1;
+	unsigned entries = 0;
+	void *sqRing = nullptr;
+	void *cqRing = nullptr;
+	void *sqes = nullptr;
+	std::size_t sqRingBytes = 0;
+	std::size_t cqRingBytes = 0;
+	std::size_t sqesBytes = 0;
+	// pointers into the shared rings
+	unsigned *sqHead = nullptr;
+	unsigned *sqTail = nullptr;
+	unsigned *sqMask = nullptr;
+	unsigned *sqArray = nullptr;
+	unsigned *cqHead = nullptr;
+	unsigned *cqTail = nullptr;
+	unsigned *cqMask = nullptr;
+	void *cqes = nullptr;
+	iovec *iovecs = nullptr;  // one per submission queue entry, for the vectored reads into unregistered buffers
+	unsigned queued = 0;  // prepared but not submitted
+	bool fixedBuffers = false;
+
+public:
+	explicit LVDIOUring( unsigned entries );
+	~LVDIOUring();
+	LVDIOUring( const LVDIOUring & ) = delete;
+	LVDIOUring &operator=( const LVDIOUring & ) = delete;
+	bool Valid() const { return ringFd >= 0; }
+	unsigned Entries() const { return entries; }
+	/**
+	 * \brief Registers \a count buffers of \a bytes each starting at \a base. Reads into a registered
+	 * buffer skip the page pinning of every request. Fails if the memlock limit is too low.
+	 */
+	bool RegisterBuffers( void *base, std::size_t bytes, unsigned count );
+	bool FixedBuffers() const { return fixedBuffers; }
+	/**
+	 * \brief Queues a read of \a bytes at \a offset. \a bufIndex is the registered buffer \a dst lies in,
+	 * or -1 for an unregistered one. Returns false if the submission queue is full.
+	 */
+	bool PrepareRead( int fd, void *dst, unsigned bytes, uint64_t offset, int bufIndex, uint64_t userData );
+	/**
+	 * \brief Submits the queued reads and waits until at least \a waitCount reads are completed
+	 */
+	bool Submit( unsigned waitCount );
+	/**
+	 * \brief Pops a completion, \a result is the byte count or -errno. Returns false if there is none.
+	 */
+	bool Reap( uint64_t &userData, int &result );
+	/**
+	 * \brief Returns true if a ring could be set up on this kernel
+	 */
+	static bool Supported();
+};
+}  // namespace vm
@@ -0,0 +1,43 @@
+#include "lvdmorton.h"
+#include <algorithm>
+
+namespace vm
+{
+namespace
+{
+inline uint64_t SpreadBits( uint64_t x )
+{
+	// 21 bits to every third bit of 63
+	x &= 0x1fffff;
+	x = ( x | x << 32 ) & 0x1f00000000ffffULL;
+	x = ( x | x << 16 ) & 0x1f0000ff0000ffULL;
+	x = ( x | x << 8 ) & 0x100f00f00f00f00fULL;
+	x = ( x | x << 4 ) & 0x10c30c30c30c30c3ULL;
+	x = ( x | x << 2 ) & 0x1249249249249249ULL;
+	return x;
+}
+}  // namespace
+
+uint64_t LVDMortonEncode( uint32_t x, uint32_t y, uint32_t z )
+{
+	return SpreadBits( x ) | SpreadBits( y ) << 1 | SpreadBits( z ) << 2;
+}
+
+std::vector<uint64_t> LVDMortonOrder( const Size3 &blockDim )
+{
+	const std::size_t count = blockDim.x * blockDim.y * blockDim.z;
+	std::vector<std::pair<uint64_t, uint64_t>> codes;
+	codes.reserve( count );
+	for ( std::size_t z = 0; z < blockDim.z; z++ )
+		for ( std::size_t y = 0; y < blockDim.y; y++ )
+			for ( std::size_t x = 0; x < blockDim.x; x++ ) {
+				codes.emplace_back( LVDMortonEncode( uint32_t( x ), uint32_t( y ), uint32_t( z ) ), codes.size() );
+			}
+	std::sort( codes.begin(), codes.end() );
+	std::vector<uint64_t> order( count );
+	for ( std::size_t i = 0; i < count; i++ ) {
+		order[ i ] = codes[ i ].second;
+	}
+	return order;
+}
+}  // namespace vm
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <VMat/geometry.h>
+
+namespace vm
+{
+/**
+ * \brief Interleaves the bits of a block coordinate into its Morton (Z-order) code, x in the lowest bit.
+ * Each coordinate has 21 bits.
+ */
+uint64_t LVDMortonEncode( uint32_t x, uint32_t y, uint32_t z );
+
+/**
+ * \brief Returns the linear (x fastest) ids of the blocks of a \a blockDim grid sorted by their Morton
+ * code. The grid need not be a power of two, the codes outside of it are skipped, so the position of
+ * a block in the list is its Morton rank.
+ */
+std::vector<uint64_t> LVDMortonOrder( const Size3 &blockDim );
+}  // namespace vm
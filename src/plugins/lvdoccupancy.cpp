@@ -0,0 +1,106 @@
+#include "lvdoccupancy.h"
+#include <algorithm>
+#include <cstring>
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
+
+namespace vm
+{
+namespace
+{
+inline int PopCount( uint64_t x )
+{
+#if defined( _MSC_VER )
+	return int( __popcnt64( x ) );
+#else
+	return __builtin_popcountll( x );
+#endif
+}
+
+inline int CountTrailingZeros( uint64_t x )
+{
+#if defined( _MSC_VER )
+	unsigned long index;
+	_BitScanForward64( &index, x );
+	return int( index );
+#else
+	return __builtin_ctzll( x );
+#endif
+}
+}  // namespace
+
+LVDOccupancy::LVDOccupancy( const unsigned char *levelPtr, size_t blockCount ) :
+  words( (const uint64_t *)( levelPtr + LVD_V2_HEADER_SIZE ) ),
+  ranks( (const uint32_t *)( levelPtr + LVD_V2_HEADER_SIZE + WordCount( blockCount ) * sizeof( uint64_t ) ) ),
+  blockCount( blockCount )
+{
+}
+
+size_t LVDOccupancy::IndexBytes( size_t blockCount )
+{
+	const auto bytes = WordCount( blockCount ) * ( sizeof( uint64_t ) + sizeof( uint32_t ) );
+	return ( bytes + 15 ) / 16 * 16;
+}
+
+size_t LVDOccupancy::Build( const LVDBlockEntry *entries, size_t blockCount, unsigned char *levelPtr )
+{
+	const auto wordCount = WordCount( blockCount );
+	auto words = (uint64_t *)( levelPtr + LVD_V2_HEADER_SIZE );
+	auto ranks = (uint32_t *)( levelPtr + LVD_V2_HEADER_SIZE + wordCount * sizeof( uint64_t ) );
+	memset( words, 0, IndexBytes( blockCount ) );
+	size_t count = 0;
+	for ( size_t w = 0; w < wordCount; w++ ) {
+		ranks[ w ] = uint32_t( count );
+		const auto end = ( std::min )( blockCount, w * 64 + 64 );
+		for ( size_t i = w * 64; i < end; i++ ) {
+			if ( entries[ i ].length != 0 ) {
+				words[ w ] |= uint64_t( 1 ) << ( i % 64 );
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+size_t LVDOccupancy::Rank( size_t blockId ) const
+{
+	const auto bit = blockId % 64;
+	const auto mask = bit ? ( ~uint64_t( 0 ) >> ( 64 - bit ) ) : 0;
+	return ranks[ blockId / 64 ] + PopCount( words[ blockId / 64 ] & mask );
+}
+
+size_t LVDOccupancy::Select( size_t slot ) const
+{
+	// the last word whose rank is not greater than the slot contains it
+	const auto wordCount = WordCount( blockCount );
+	const auto w = size_t( std::upper_bound( ranks, ranks + wordCount, uint32_t( slot ) ) - ranks ) - 1;
+	auto word = words[ w ];
+	for ( auto k = slot - ranks[ w ]; k > 0; k-- ) {
+		word &= word - 1;
+	}
+	return w * 64 + ( word ? CountTrailingZeros( word ) : 64 );
+}
+
+size_t LVDOccupancy::Count() const
+{
+	const auto wordCount = WordCount( blockCount );
+	return wordCount ? ranks[ wordCount - 1 ] + PopCount( words[ wordCount - 1 ] ) : 0;
+}
+
+size_t LVDOccupancy::FirstAbsent() const
+{
+	// the words before the first one with a clear bit are full, which the rank directory tells by bisection
+	const auto wordCount = WordCount( blockCount );
+	size_t lo = 0, hi = wordCount;
+	while ( lo < hi ) {
+		const auto mid = ( lo + hi ) / 2;
+		if ( ranks[ mid ] + PopCount( words[ mid ] ) == ( std::min )( blockCount, mid * 64 + 64 ) ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo == wordCount ? blockCount : lo * 64 + CountTrailingZeros( ~words[ lo ] );
+}
+}  // namespace vm
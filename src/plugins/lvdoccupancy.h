@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lvdfileheader.h"
+
+namespace vm
+{
+/**
+ * \brief Read-only rank/select index over the occupancy bitmap of a sparse LVD level.
+ *
+ * Rank maps a virtual block id to its slot in the block table, select maps a slot back to the block id.
+ * Both only touch the mapped bitmap and the rank directory, so they are safe to call from several threads.
+ */
+class LVDOccupancy
+{
+	const uint64_t *words = nullptr;
+	const uint32_t *ranks = nullptr;
+	size_t blockCount = 0;
+
+public:
+	LVDOccupancy() = default;
+	LVDOccupancy( const unsigned char *levelPtr, size_t blockCount );
+
+	static size_t WordCount( size_t blockCount ) { return ( blockCount + 63 ) / 64; }
+	/**
+	 * \brief Bytes of the bitmap and the rank directory of \a blockCount blocks, rounded up so
+	 * the block table after them stays 16-byte aligned
+	 */
+	static size_t IndexBytes( size_t blockCount );
+	/**
+	 * \brief Builds the bitmap and the rank directory at \a levelPtr from the blocks with a non-zero
+	 * length in \a entries and returns the number of occupied blocks
+	 */
+	static size_t Build( const LVDBlockEntry *entries, size_t blockCount, unsigned char *levelPtr );
+
+	bool Valid() const { return words != nullptr; }
+	bool Test( size_t blockId ) const { return ( words[ blockId / 64 ] >> ( blockId % 64 ) ) & 1; }
+	size_t Rank( size_t blockId ) const;
+	size_t Select( size_t slot ) const;
+	size_t Count() const;
+	/**
+	 * \brief Returns the lowest absent block id, the block count if every block is occupied
+	 */
+	size_t FirstAbsent() const;
+};
+}  // namespace vm
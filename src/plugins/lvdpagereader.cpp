@@ -0,0 +1,429 @@
+#include "lvdpagereader.h"
+#include "lvdcodec.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <VMFoundation/logger.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+namespace vm
+{
+namespace
+{
+enum
+{
+	MaxRunLength = 16,							// blocks read by one preadv
+	DirectIOAlignment = LVD_BLOCK_ALIGNMENT	// offset, length and buffer alignment of O_DIRECT reads
+};
+
+bool RingMode( LVDPageIOMode mode )
+{
+	return mode == LVD_PAGE_IO_URING || mode == LVD_PAGE_IO_URING_DIRECT;
+}
+
+#ifndef _WIN32
+bool PReadFull( int fd, unsigned char *dst, std::size_t bytes, uint64_t offset )
+{
+	while ( bytes > 0 ) {
+		const auto n = pread( fd, dst, bytes, off_t( offset ) );
+		if ( n <= 0 ) {
+			return false;
+		}
+		dst += n;
+		bytes -= n;
+		offset += n;
+	}
+	return true;
+}
+#endif
+}  // namespace
+
+LVDPageReader::LVDPageReader( std::shared_ptr<LVDFile> file, LVDPageIOMode mode, int threadCount ) :
+  file( std::move( file ) ),
+  mode( mode )
+{
+	Start( threadCount );
+}
+
+LVDPageReader::LVDPageReader( std::shared_ptr<LVDShardedFile> file, LVDPageIOMode mode, int threadCount ) :
+  file( file->Shard( 0 ) ),
+  sharded( std::move( file ) ),
+  mode( mode )
+{
+	Start( threadCount );
+}
+
+LVDPageReader::LVDPageReader( std::shared_ptr<LVDSeriesFile> file, LVDPageIOMode mode, int threadCount ) :
+  file( file->Timestep( 0 ) ),
+  series( std::move( file ) ),
+  mode( mode )
+{
+	Start( threadCount );
+}
+
+void LVDPageReader::Start( int threadCount )
+{
+#ifdef _WIN32
+	this->mode = LVD_PAGE_IO_MMAP;
+#endif
+	threadCount = threadCount > 0 ? threadCount : 16;
+	if ( RingMode( this->mode ) ) {
+		if ( SetupRing( threadCount ) ) {
+			workers.emplace_back( &LVDPageReader::WorkRing, this );
+			return;
+		}
+		LOG_WARNING << "LVDPageReader: io_uring is not available, the pages are read through the mapping";
+		this->mode = LVD_PAGE_IO_MMAP;
+	}
+	for ( int i = 0; i < threadCount; i++ ) {
+		workers.emplace_back( &LVDPageReader::Work, this );
+	}
+}
+
+LVDPageReader::~LVDPageReader()
+{
+	{
+		std::lock_guard<std::mutex> lk( mutex );
+		stop = true;
+	}
+	taskCV.notify_all();
+	for ( auto &t : workers ) {
+		t.join();
+	}
+}
+
+void LVDPageReader::Submit( const std::vector<LVDPageRequest> &requests )
+{
+	std::vector<Task> batch;
+	std::vector<LVDPageRequest> invalid;
+	batch.reserve( requests.size() );
+	for ( const auto &r : requests ) {
+		if ( r.buffer == nullptr || r.lod < 0 || r.lod >= file->LODCount() || r.pageID >= file->BlockCount( r.lod ) ) {
+			invalid.push_back( r );
+			invalid.back().ok = false;
+			continue;
+		}
+		const auto f = series ? &series->FileOf( r.pageID, r.lod ) : sharded ? &sharded->FileOf( r.pageID, r.lod ) : file.get();
+		batch.push_back( Task{ r, f->LocateBlock( r.pageID, r.lod ), f } );
+	}
+	// neighbouring blocks in the file end up next to each other in the queue, so they are read together
+	std::sort( batch.begin(), batch.end(), []( const Task &a, const Task &b ) {
+		return a.location.fileName != b.location.fileName ? a.location.fileName < b.location.fileName : a.location.offset < b.location.offset;
+	} );
+	{
+		std::lock_guard<std::mutex> lk( mutex );
+		tasks.insert( tasks.end(), batch.begin(), batch.end() );
+		completed.insert( completed.end(), invalid.begin(), invalid.end() );
+		pending += batch.size();
+	}
+	taskCV.notify_all();
+	if ( invalid.empty() == false ) {
+		doneCV.notify_all();
+	}
+}
+
+std::size_t LVDPageReader::Collect( std::vector<LVDPageRequest> &done, std::size_t minCount )
+{
+	std::unique_lock<std::mutex> lk( mutex );
+	doneCV.wait( lk, [ & ]() { return completed.size() >= minCount || pending == 0; } );
+	const auto count = completed.size();
+	done.insert( done.end(), completed.begin(), completed.end() );
+	completed.clear();
+	return count;
+}
+
+void LVDPageReader::Work()
+{
+	std::vector<unsigned char> scratch;
+	std::map<const std::string *, int> fds;
+	Task run[ MaxRunLength ];
+	while ( true ) {
+		int count = 0;
+		{
+			std::unique_lock<std::mutex> lk( mutex );
+			taskCV.wait( lk, [ this ]() { return stop || tasks.empty() == false; } );
+			if ( stop ) {
+				break;
+			}
+			run[ count++ ] = tasks.front();
+			tasks.pop_front();
+			// a run of raw blocks that follow each other in the file
+			while ( mode == LVD_PAGE_IO_PREAD && run[ 0 ].file->DirectIO() == false && count < MaxRunLength && tasks.empty() == false ) {
+				const auto &last = run[ count - 1 ].location;
+				const auto &next = tasks.front().location;
+				if ( last.codec != LVD_CODEC_RAW || next.codec != LVD_CODEC_RAW || last.length == 0 || next.length == 0 ||
+					 next.fileName != last.fileName || next.offset != last.offset + last.length ) {
+					break;
+				}
+				run[ count++ ] = tasks.front();
+				tasks.pop_front();
+			}
+		}
+
+		if ( mode == LVD_PAGE_IO_MMAP || run[ 0 ].file->DirectIO() ) {
+			run[ 0 ].request.ok = ReadMapped( run[ 0 ] );	// the file reads O_DIRECT itself
+		} else {
+#ifndef _WIN32
+			const int fd = OpenFile( fds, run[ 0 ].location.fileName );
+			const auto ok = fd >= 0 && ReadRun( fd, run, count, scratch );
+			for ( int i = 0; i < count; i++ ) {
+				run[ i ].request.ok = ok;
+			}
+#endif
+		}
+
+		{
+			std::lock_guard<std::mutex> lk( mutex );
+			for ( int i = 0; i < count; i++ ) {
+				completed.push_back( run[ i ].request );
+			}
+			pending -= count;
+		}
+		doneCV.notify_all();
+	}
+#ifndef _WIN32
+	for ( const auto &fd : fds ) {
+		if ( fd.second >= 0 ) {
+			close( fd.second );
+		}
+	}
+#endif
+}
+
+bool LVDPageReader::SetupRing( int depth )
+{
+#ifdef __linux__
+	ring.reset( new LVDIOUring( unsigned( depth ) ) );
+	if ( ring->Valid() == false ) {
+		ring = nullptr;
+		return false;
+	}
+	std::size_t blockBytes = 0;
+	for ( int lod = 0; lod < file->LODCount(); lod++ ) {
+		blockBytes = ( std::max )( blockBytes, std::size_t( file->BlockBytes( lod ) ) );
+	}
+	// an encoded block is never larger than the raw one, the extra page is the O_DIRECT alignment slack
+	slotBytes = ( blockBytes + DirectIOAlignment - 1 ) / DirectIOAlignment * DirectIOAlignment + DirectIOAlignment;
+	void *p = nullptr;
+	if ( posix_memalign( &p, DirectIOAlignment, slotBytes * ring->Entries() ) != 0 ) {
+		ring = nullptr;
+		return false;
+	}
+	bounce = decltype( bounce )( static_cast<unsigned char *>( p ), free );
+	if ( ring->RegisterBuffers( p, slotBytes, ring->Entries() ) == false ) {
+		LOG_DEBUG << "LVDPageReader: failed to register the buffers, check the memlock limit";
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+int LVDPageReader::OpenFile( std::map<const std::string *, int> &fds, const std::string *fileName ) const
+{
+#ifndef _WIN32
+	auto it = fds.find( fileName );
+	if ( it == fds.end() ) {
+		int fd = -1;
+#ifdef O_DIRECT
+		if ( mode == LVD_PAGE_IO_URING_DIRECT ) {
+			fd = open( fileName->c_str(), O_RDONLY | O_DIRECT );  // fails on file systems without direct I/O, e.g. tmpfs
+		}
+#endif
+		if ( fd < 0 ) {
+			fd = open( fileName->c_str(), O_RDONLY );
+		}
+		it = fds.emplace( fileName, fd ).first;
+	}
+	return it->second;
+#else
+	return -1;
+#endif
+}
+
+void LVDPageReader::WorkRing()
+{
+#ifdef __linux__
+	std::map<const std::string *, int> fds;
+	const unsigned depth = ring->Entries();
+	const uint64_t align = mode == LVD_PAGE_IO_URING_DIRECT ? DirectIOAlignment : 1;
+	std::vector<Task> slots( depth );
+	std::vector<uint64_t> slotOffset( depth );	// file offset of the bounce buffer of the slot
+	std::vector<bool> busy( depth, false );
+	std::vector<unsigned> freeSlots;
+	for ( unsigned i = 0; i < depth; i++ ) {
+		freeSlots.push_back( depth - 1 - i );
+	}
+	std::vector<Task> direct;  // absent blocks, or everything once the ring failed
+	std::vector<unsigned> issued;
+	std::vector<LVDPageRequest> finished;
+	unsigned inFlight = 0;
+	bool failed = false;
+
+	const auto complete = [ & ]( unsigned slot, bool ok ) {
+		slots[ slot ].request.ok = ok;
+		finished.push_back( slots[ slot ].request );
+		busy[ slot ] = false;
+		freeSlots.push_back( slot );
+	};
+
+	while ( true ) {
+		direct.clear();
+		issued.clear();
+		{
+			std::unique_lock<std::mutex> lk( mutex );
+			if ( inFlight == 0 ) {
+				taskCV.wait( lk, [ this ]() { return stop || tasks.empty() == false; } );
+			}
+			if ( stop ) {
+				break;
+			}
+			// everything submitted so far that fits in the ring goes to the kernel in one batch
+			while ( tasks.empty() == false && ( failed || tasks.front().location.length == 0 || freeSlots.empty() == false ) ) {
+				if ( failed || tasks.front().location.length == 0 ) {
+					direct.push_back( tasks.front() );
+				} else {
+					issued.push_back( freeSlots.back() );
+					freeSlots.pop_back();
+					slots[ issued.back() ] = tasks.front();
+					busy[ issued.back() ] = true;
+				}
+				tasks.pop_front();
+			}
+		}
+
+		for ( auto &task : direct ) {
+			if ( task.location.length == 0 ) {
+				memset( task.request.buffer, 0, file->BlockBytes( task.request.lod ) );
+				task.request.ok = true;
+			} else {
+				task.request.ok = ReadMapped( task );
+			}
+			finished.push_back( task.request );
+		}
+		for ( const auto slot : issued ) {
+			const auto &loc = slots[ slot ].location;
+			const uint64_t begin = loc.offset / align * align;
+			const uint64_t end = ( loc.offset + loc.length + align - 1 ) / align * align;
+			const int fd = OpenFile( fds, loc.fileName );
+			slotOffset[ slot ] = begin;
+			if ( fd < 0 || ring->PrepareRead( fd, bounce.get() + slot * slotBytes, unsigned( end - begin ), begin, int( slot ), slot ) == false ) {
+				complete( slot, ReadMapped( slots[ slot ] ) );
+				continue;
+			}
+			inFlight++;
+		}
+
+		if ( inFlight > 0 && ring->Submit( 1 ) == false ) {
+			// the state of the ring is unknown, the bounce buffers are left alone from now on
+			LOG_ERROR << "LVDPageReader: io_uring_enter failed, falling back to the mapping";
+			failed = true;
+			for ( unsigned slot = 0; slot < depth; slot++ ) {
+				if ( busy[ slot ] ) {
+					complete( slot, ReadMapped( slots[ slot ] ) );
+				}
+			}
+			freeSlots.clear();
+			inFlight = 0;
+		}
+		uint64_t slot = 0;
+		int result = 0;
+		while ( failed == false && ring->Reap( slot, result ) ) {
+			inFlight--;
+			auto &task = slots[ slot ];
+			const auto skip = task.location.offset - slotOffset[ slot ];
+			const auto src = bounce.get() + slot * slotBytes + skip;
+			bool ok = false;
+			if ( result < 0 || uint64_t( result ) < skip + task.location.length ) {
+				ok = ReadMapped( task );  // short read or I/O error
+			} else if ( task.location.codec == LVD_CODEC_RAW ) {
+				memcpy( task.request.buffer, src, task.location.length );
+				ok = true;
+			} else {
+				ok = LVDCodec::Decode( task.location.codec, src, task.location.length, (unsigned char *)task.request.buffer, file->BlockBytes( task.request.lod ) );
+			}
+			complete( unsigned( slot ), ok );
+		}
+
+		if ( finished.empty() == false ) {
+			{
+				std::lock_guard<std::mutex> lk( mutex );
+				completed.insert( completed.end(), finished.begin(), finished.end() );
+				pending -= finished.size();
+			}
+			finished.clear();
+			doneCV.notify_all();
+		}
+	}
+
+	// the kernel must be done with the bounce buffers before they are freed
+	uint64_t slot = 0;
+	int result = 0;
+	while ( failed == false && inFlight > 0 && ring->Submit( 1 ) ) {
+		while ( ring->Reap( slot, result ) ) {
+			inFlight--;
+		}
+	}
+	for ( const auto &fd : fds ) {
+		if ( fd.second >= 0 ) {
+			close( fd.second );
+		}
+	}
+#endif
+}
+
+bool LVDPageReader::ReadRun( int fd, Task *run, int count, std::vector<unsigned char> &scratch )
+{
+#ifndef _WIN32
+	const auto &first = run[ 0 ];
+	const std::size_t blockBytes = file->BlockBytes( first.request.lod );
+	auto dst = (unsigned char *)first.request.buffer;
+	if ( first.location.length == 0 ) {
+		memset( dst, 0, blockBytes );
+		return true;
+	}
+	if ( first.location.codec != LVD_CODEC_RAW ) {
+		scratch.resize( first.location.length );
+		return PReadFull( fd, scratch.data(), scratch.size(), first.location.offset ) &&
+			   LVDCodec::Decode( first.location.codec, scratch.data(), scratch.size(), dst, blockBytes );
+	}
+
+	iovec iov[ MaxRunLength ] = {};
+	std::size_t total = 0;
+	for ( int i = 0; i < count; i++ ) {
+		iov[ i ].iov_base = run[ i ].request.buffer;
+		iov[ i ].iov_len = run[ i ].location.length;
+		total += run[ i ].location.length;
+	}
+	if ( std::size_t( preadv( fd, iov, count, off_t( first.location.offset ) ) ) == total ) {
+		return true;
+	}
+	// short read, retry block by block
+	for ( int i = 0; i < count; i++ ) {
+		if ( PReadFull( fd, (unsigned char *)run[ i ].request.buffer, run[ i ].location.length, run[ i ].location.offset ) == false ) {
+			return false;
+		}
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool LVDPageReader::ReadMapped( Task &task )
+{
+	try {
+		task.file->ReadBlock( (char *)task.request.buffer, task.request.pageID, task.request.lod );
+		return true;
+	} catch ( std::runtime_error & ) {
+		return false;
+	}
+}
+}  // namespace vm
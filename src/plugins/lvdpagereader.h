@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ilvdfileplugininterface.hpp>
+#include "lvdfile.h"
+#include "lvdiouring.h"
+#include "lvdshardedfile.h"
+#include "lvdseriesfile.h"
+
+namespace vm
+{
+/**
+ * \brief Serves batches of page requests on a pool of worker threads.
+ *
+ * With LVD_PAGE_IO_PREAD every worker reads the blocks with pread from its own descriptor, and runs of
+ * raw blocks that are contiguous in the file are read with one preadv. With LVD_PAGE_IO_MMAP the workers
+ * copy out of the mapping instead, so the page faults are taken by them rather than the caller.
+ *
+ * The io_uring modes have no pool, one thread keeps up to threadCount reads in flight on a ring. Each
+ * read goes to a registered bounce buffer, which is also 4 KiB aligned for O_DIRECT, and is copied or
+ * decoded into the request buffer from there. The requests of one Submit go to the kernel in one batch.
+ *
+ * The pages of a sharded LVD are read from their shards by the same workers, the descriptors are per file.
+ * The pages of a series are read from the timestep that is current when they are submitted.
+ */
+class LVDPageReader
+{
+	struct Task
+	{
+		LVDPageRequest request;
+		LVDBlockLocation location;
+		LVDFile *file = nullptr;  // the file, the shard or the timestep holding the page
+	};
+
+	std::shared_ptr<LVDFile> file;	// the first shard of a sharded file, the first timestep of a series
+	std::shared_ptr<LVDShardedFile> sharded;
+	std::shared_ptr<LVDSeriesFile> series;
+	LVDPageIOMode mode;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable taskCV;
+	std::condition_variable doneCV;
+	std::deque<Task> tasks;
+	std::vector<LVDPageRequest> completed;
+	std::size_t pending = 0;  // submitted but not completed
+	bool stop = false;
+	std::unique_ptr<unsigned char, void ( * )( void * )> bounce{ nullptr, nullptr };	// one slot per ring entry
+	std::unique_ptr<LVDIOUring> ring;  // released before the bounce buffers it reads into
+	std::size_t slotBytes = 0;
+
+	void Work();
+	void WorkRing();
+	bool SetupRing( int depth );
+	int OpenFile( std::map<const std::string *, int> &fds, const std::string *fileName ) const;
+	bool ReadRun( int fd, Task *run, int count, std::vector<unsigned char> &scratch );
+	bool ReadMapped( Task &task );
+	void Start( int threadCount );
+
+public:
+	LVDPageReader( std::shared_ptr<LVDFile> file, LVDPageIOMode mode, int threadCount );
+	LVDPageReader( std::shared_ptr<LVDShardedFile> file, LVDPageIOMode mode, int threadCount );
+	LVDPageReader( std::shared_ptr<LVDSeriesFile> file, LVDPageIOMode mode, int threadCount );
+	~LVDPageReader();
+	void Submit( const std::vector<LVDPageRequest> &requests );
+	std::size_t Collect( std::vector<LVDPageRequest> &done, std::size_t minCount );
+	LVDPageIOMode Mode() const { return mode; }
+};
+}  // namespace vm
@@ -0,0 +1,244 @@
+#include "lvdpyramid.h"
+#include "lvdfile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <type_traits>
+
+#include <VMFoundation/logger.h>
+#include <jsondef.hpp>
+
+namespace vm
+{
+namespace
+{
+/**
+ * \brief Decoded blocks of a level that one thread recently used
+ */
+class BlockReader
+{
+	LVDFile &lvd;
+	std::vector<std::pair<std::size_t, std::vector<unsigned char>>> blocks;	 // most recently used last
+	enum
+	{
+		Capacity = 48
+	};
+
+public:
+	explicit BlockReader( LVDFile &lvd ) :
+	  lvd( lvd ) {}
+	/**
+	 * \brief Returns the block or nullptr if it is absent (zero)
+	 */
+	const unsigned char *Get( std::size_t blockId )
+	{
+		if ( lvd.BlockOccupied( blockId ) == false ) {
+			return nullptr;
+		}
+		for ( std::size_t i = blocks.size(); i-- > 0; ) {
+			if ( blocks[ i ].first == blockId ) {
+				std::rotate( blocks.begin() + i, blocks.begin() + i + 1, blocks.end() );
+				return blocks.back().second.data();
+			}
+		}
+		if ( blocks.size() < Capacity ) {
+			blocks.emplace_back( blockId, std::vector<unsigned char>( lvd.BlockBytes() ) );
+		} else {
+			std::rotate( blocks.begin(), blocks.begin() + 1, blocks.end() );
+		}
+		blocks.back().first = blockId;
+		lvd.ReadBlock( (char *)blocks.back().second.data(), blockId );
+		return blocks.back().second.data();
+	}
+
+	/**
+	 * \brief Copies the voxels [start, start + size) of the level into \a dst from the interior of
+	 * the blocks. The voxels outside of the volume are zero.
+	 */
+	void GatherRegion( const Vec3i &start, const Vec3i &size, unsigned char *dst )
+	{
+		const std::size_t es = lvd.VoxelBytes();
+		memset( dst, 0, std::size_t( size.x ) * size.y * size.z * es );
+		const auto dataSize = lvd.OriginalDataSize();
+		const auto blockDim = lvd.SizeByBlock();
+		const int blockSide = lvd.BlockSize(), padding = lvd.GetBlockPadding(), step = blockSide - 2 * padding;
+		const Vec3i lo( ( std::max )( start.x, 0 ), ( std::max )( start.y, 0 ), ( std::max )( start.z, 0 ) );
+		const Vec3i hi( ( std::min )( start.x + size.x, int( dataSize.x ) ), ( std::min )( start.y + size.y, int( dataSize.y ) ), ( std::min )( start.z + size.z, int( dataSize.z ) ) );
+		if ( lo.x >= hi.x || lo.y >= hi.y || lo.z >= hi.z ) {
+			return;
+		}
+		for ( int bz = lo.z / step; bz <= ( hi.z - 1 ) / step; bz++ )
+			for ( int by = lo.y / step; by <= ( hi.y - 1 ) / step; by++ )
+				for ( int bx = lo.x / step; bx <= ( hi.x - 1 ) / step; bx++ ) {
+					const auto block = Get( ( std::size_t( bz ) * blockDim.y + by ) * blockDim.x + bx );
+					if ( block == nullptr ) {
+						continue;
+					}
+					const int x0 = ( std::max )( lo.x, bx * step ), x1 = ( std::min )( hi.x, bx * step + step );
+					const int y0 = ( std::max )( lo.y, by * step ), y1 = ( std::min )( hi.y, by * step + step );
+					const int z0 = ( std::max )( lo.z, bz * step ), z1 = ( std::min )( hi.z, bz * step + step );
+					for ( int z = z0; z < z1; z++ )
+						for ( int y = y0; y < y1; y++ ) {
+							const auto src = block + ( ( std::size_t( z - bz * step + padding ) * blockSide + ( y - by * step + padding ) ) * blockSide + ( x0 - bx * step + padding ) ) * es;
+							memcpy( dst + ( ( std::size_t( z - start.z ) * size.y + ( y - start.y ) ) * size.x + ( x0 - start.x ) ) * es, src, ( x1 - x0 ) * es );
+						}
+				}
+	}
+};
+
+template <typename T>
+T Average8( typename std::conditional<std::is_floating_point<T>::value, T, unsigned>::type sum )
+{
+	return std::is_floating_point<T>::value ? T( sum / 8 ) : T( ( sum + 4 ) / 8 );
+}
+
+/**
+ * \brief Downsamples the \a fine region of 2 * \a side voxels per axis into \a side voxels per axis.
+ * The inner loop has no branches so it is vectorized by the compiler.
+ */
+template <typename T>
+void Downsample( const T *fine, int side, LVDDownsampleFilter filter, T *coarse )
+{
+	using Sum = typename std::conditional<std::is_floating_point<T>::value, T, unsigned>::type;
+	const std::size_t fineSide = 2 * side;
+	for ( int z = 0; z < side; z++ )
+		for ( int y = 0; y < side; y++ ) {
+			const auto r00 = fine + ( 2 * z * fineSide + 2 * y ) * fineSide;
+			const auto r01 = r00 + fineSide;
+			const auto r10 = r00 + fineSide * fineSide;
+			const auto r11 = r10 + fineSide;
+			auto dst = coarse + ( std::size_t( z ) * side + y ) * side;
+			if ( filter == LVD_FILTER_BOX ) {
+				for ( int x = 0; x < side; x++ ) {
+					const Sum sum = Sum( r00[ 2 * x ] ) + r00[ 2 * x + 1 ] + r01[ 2 * x ] + r01[ 2 * x + 1 ] +
+									r10[ 2 * x ] + r10[ 2 * x + 1 ] + r11[ 2 * x ] + r11[ 2 * x + 1 ];
+					dst[ x ] = Average8<T>( sum );
+				}
+			} else {
+				const bool keepMin = filter == LVD_FILTER_MIN_MAX;
+				for ( int x = 0; x < side; x++ ) {
+					const auto a = ( std::max )( ( std::max )( r00[ 2 * x ], r00[ 2 * x + 1 ] ), ( std::max )( r01[ 2 * x ], r01[ 2 * x + 1 ] ) );
+					const auto b = ( std::max )( ( std::max )( r10[ 2 * x ], r10[ 2 * x + 1 ] ), ( std::max )( r11[ 2 * x ], r11[ 2 * x + 1 ] ) );
+					const auto c = ( std::min )( ( std::min )( r00[ 2 * x ], r00[ 2 * x + 1 ] ), ( std::min )( r01[ 2 * x ], r01[ 2 * x + 1 ] ) );
+					const auto d = ( std::min )( ( std::min )( r10[ 2 * x ], r10[ 2 * x + 1 ] ), ( std::min )( r11[ 2 * x ], r11[ 2 * x + 1 ] ) );
+					const bool useMin = keepMin && ( ( x + y + z ) & 1 );
+					dst[ x ] = useMin ? ( std::min )( c, d ) : ( std::max )( a, b );
+				}
+			}
+		}
+}
+
+void Downsample( const unsigned char *fine, int side, LVDDownsampleFilter filter, LVDVoxelType type, unsigned char *coarse )
+{
+	switch ( type ) {
+	case LVD_VOXEL_UINT16: Downsample( (const uint16_t *)fine, side, filter, (uint16_t *)coarse ); break;
+	case LVD_VOXEL_FLOAT32: Downsample( (const float *)fine, side, filter, (float *)coarse ); break;
+	default: Downsample( fine, side, filter, coarse ); break;
+	}
+}
+
+/**
+ * \brief The last coarse voxel of an odd fine size only covers one fine voxel, the voxel after the end
+ * of the volume is made a copy of the last one so it does not darken (or is not lost by) the filter
+ */
+void ReplicateOddEdge( unsigned char *region, int side, const Vec3i &start, const Size3 &fineSize, std::size_t es )
+{
+	const std::size_t s = side;
+	const int ex = int( fineSize.x ) - start.x, ey = int( fineSize.y ) - start.y, ez = int( fineSize.z ) - start.z;
+	if ( fineSize.x % 2 && ex > 0 && ex < side ) {
+		for ( std::size_t zy = 0; zy < s * s; zy++ ) memcpy( region + ( zy * s + ex ) * es, region + ( zy * s + ex - 1 ) * es, es );
+	}
+	if ( fineSize.y % 2 && ey > 0 && ey < side ) {
+		for ( std::size_t z = 0; z < s; z++ ) memcpy( region + ( z * s + ey ) * s * es, region + ( z * s + ey - 1 ) * s * es, s * es );
+	}
+	if ( fineSize.z % 2 && ez > 0 && ez < side ) {
+		memcpy( region + ez * s * s * es, region + ( ez - 1 ) * s * s * es, s * s * es );
+	}
+}
+
+bool BuildLevel( LVDFile &fine, const std::string &fileName, const LVDPyramidOptions &options )
+{
+	const auto fineSize = fine.OriginalDataSize();
+	const Vec3i size( int( fineSize.x + 1 ) / 2, int( fineSize.y + 1 ) / 2, int( fineSize.z + 1 ) / 2 );
+	LVDFile coarse( fileName, fine.BlockSizeInLog(), size, fine.GetBlockPadding(), LVD_VERSION_2, options.flags, fine.VoxelType() );
+	if ( coarse.Valid() == false ) {
+		return false;
+	}
+	const int blockSide = coarse.BlockSize(), padding = coarse.GetBlockPadding(), step = blockSide - 2 * padding;
+	const auto blockDim = coarse.SizeByBlock();
+	// a thread takes a run of blocks in the storage order, a row of a linear level or a 2x2x2 Morton cell,
+	// so the fine blocks it reads are shared by the run and the file is written about in order
+	const auto order = coarse.StorageOrder();
+	const std::size_t runLength = coarse.MortonOrder() ? 8 : blockDim.x;
+	const std::size_t runCount = ( order.size() + runLength - 1 ) / runLength;
+
+	std::atomic<std::size_t> nextRun{ 0 };
+	auto work = [ & ]() {
+		BlockReader reader( fine );
+		const std::size_t fineSide = 2 * blockSide;
+		const std::size_t es = fine.VoxelBytes();
+		std::vector<unsigned char> region( fineSide * fineSide * fineSide * es ), block( coarse.BlockBytes() );
+		for ( std::size_t run; ( run = nextRun++ ) < runCount; ) {
+			for ( std::size_t i = run * runLength; i < ( std::min )( order.size(), run * runLength + runLength ); i++ ) {
+				const std::size_t id = order[ i ];
+				const int bx = id % blockDim.x, by = id / blockDim.x % blockDim.y, bz = id / ( blockDim.x * blockDim.y );
+				const Vec3i start( bx * step - padding, by * step - padding, bz * step - padding );
+				reader.GatherRegion( start * 2, Vec3i( fineSide, fineSide, fineSide ), region.data() );
+				ReplicateOddEdge( region.data(), int( fineSide ), start * 2, fineSize, es );
+				Downsample( region.data(), blockSide, options.filter, fine.VoxelType(), block.data() );
+				coarse.WriteBlock( (const char *)block.data(), id );
+			}
+		}
+	};
+	const int threadCount = options.threadCount > 0 ? options.threadCount : ( std::max )( 1u, std::thread::hardware_concurrency() );
+	std::vector<std::thread> workers;
+	for ( int t = 1; t < threadCount; t++ ) {
+		workers.emplace_back( work );
+	}
+	work();
+	for ( auto &t : workers ) {
+		t.join();
+	}
+	coarse.Close();
+	return true;
+}
+}  // namespace
+
+std::vector<std::string> BuildLVDPyramid( const LVDPyramidOptions &options )
+{
+	std::vector<std::string> fileNames{ options.lvdFileName };
+	for ( int lod = 1; options.levels <= 0 || lod <= options.levels; lod++ ) {
+		LVDFile fine( fileNames.back(), true );
+		if ( fine.Valid() == false ) {
+			LOG_ERROR << "lvdpyramid: failed to open " << fileNames.back();
+			return {};
+		}
+		const auto blockDim = fine.SizeByBlock();
+		if ( options.levels <= 0 && blockDim.x * blockDim.y * blockDim.z <= 1 ) {
+			break;
+		}
+		const auto fileName = options.outputPrefix + "_lod" + std::to_string( lod ) + ".lvd";
+		if ( BuildLevel( fine, fileName, options ) == false ) {
+			return {};
+		}
+		fileNames.push_back( fileName );
+		LOG_INFO << "lvdpyramid: level " << lod << " written to " << fileName;
+	}
+
+	LVDJSONStruct json;
+	json.fileNames = fileNames;
+	json.samplingRate = options.samplingRate;
+	json.spacing = options.spacing;
+	std::ofstream lodsFile( options.outputPrefix + ".lods" );
+	if ( lodsFile.is_open() == false ) {
+		LOG_ERROR << "lvdpyramid: failed to write the manifest";
+		return {};
+	}
+	vm::json::Writer writer;
+	writer.write( lodsFile, json );
+	return fileNames;
+}
+}  // namespace vm
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "lvdfileheader.h"
+
+namespace vm
+{
+enum LVDDownsampleFilter
+{
+	LVD_FILTER_BOX = 0,	   // average of the 2x2x2 voxels
+	LVD_FILTER_MAX = 1,	   // maximum, keeps thin bright structures
+	LVD_FILTER_MIN_MAX = 2	// minimum and maximum on alternate voxels, keeps both extremes
+};
+
+struct LVDPyramidOptions
+{
+	std::string lvdFileName;  // level 0
+	std::string outputPrefix;  // level i is written to <outputPrefix>_lod<i>.lvd, the manifest to <outputPrefix>.lods
+	int levels = 0;			   // coarser levels to build, 0 builds until a level fits in one block
+	LVDDownsampleFilter filter = LVD_FILTER_BOX;
+	int threadCount = 0;
+	float samplingRate = 0.001f;
+	std::vector<float> spacing{ 1, 1, 1 };
+	uint32_t flags = LVD_FLAG_SPARSE;
+};
+
+/**
+ * \brief Builds the coarser levels of a LVD file and writes the .lods manifest listing all levels.
+ *
+ * Each level is built from the bricks of the previous one. A pool of threads builds the coarse blocks, and
+ * every thread only keeps the few fine blocks its current row of coarse blocks touches, so the volume is
+ * never materialised. Returns the file names of all levels, level 0 included, or an empty list on failure.
+ */
+std::vector<std::string> BuildLVDPyramid( const LVDPyramidOptions &options );
+}  // namespace vm
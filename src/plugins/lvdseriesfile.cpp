@@ -0,0 +1,220 @@
+#include "lvdseriesfile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <numeric>
+
+#include <VMFoundation/logger.h>
+#include <jsondef.hpp>
+
+namespace vm
+{
+LVDSeriesFile::LVDSeriesFile( const std::string &manifestName ) :
+  manifestName( manifestName )
+{
+	LVDSeriesManifest manifest;
+	std::ifstream in( manifestName );
+	if ( in.is_open() == false ) {
+		LOG_ERROR << "LVDSeriesFile: failed to open " << manifestName;
+		return;
+	}
+	in >> manifest;
+	if ( manifest.timesteps.empty() || manifest.keyframes.size() != manifest.timesteps.size() ) {
+		LOG_ERROR << "LVDSeriesFile: " << manifestName << " lists no timesteps or not their keyframes";
+		return;
+	}
+	for ( std::size_t t = 0; t < manifest.timesteps.size(); t++ ) {
+		const int keyframe = manifest.keyframes[ t ];
+		if ( keyframe < 0 || keyframe > int( t ) || manifest.keyframes[ keyframe ] != keyframe ) {
+			LOG_ERROR << "LVDSeriesFile: bad keyframe of timestep " << t;
+			timesteps.clear();
+			return;
+		}
+		auto file = std::make_shared<LVDFile>( PathOf( manifest.timesteps[ t ] ), true );
+		if ( file->Valid() == false || ( timesteps.empty() == false && file->LODCount() != timesteps[ 0 ]->LODCount() ) ) {
+			LOG_ERROR << "LVDSeriesFile: bad timestep " << manifest.timesteps[ t ];
+			timesteps.clear();
+			return;
+		}
+		for ( int lod = 0; lod < file->LODCount(); lod++ ) {
+			const auto s = file->OriginalDataSize( lod ), first = timesteps.empty() ? s : timesteps[ 0 ]->OriginalDataSize( lod );
+			const auto &reference = timesteps.empty() ? *file : *timesteps[ 0 ];
+			const bool delta = file->GetHeader( lod ).flags & LVD_FLAG_DELTA;
+			if ( s.x != first.x || s.y != first.y || s.z != first.z || file->BlockSizeInLog( lod ) != reference.BlockSizeInLog( lod ) ||
+				 file->GetBlockPadding( lod ) != reference.GetBlockPadding( lod ) || file->VoxelType( lod ) != reference.VoxelType( lod ) ||
+				 delta != ( keyframe != int( t ) ) ) {
+				LOG_ERROR << "LVDSeriesFile: timestep " << manifest.timesteps[ t ] << " does not match the series";
+				timesteps.clear();
+				return;
+			}
+		}
+		timesteps.push_back( std::move( file ) );
+	}
+	names = manifest.timesteps;
+	keyframes = manifest.keyframes;
+	validFlag = true;
+}
+
+LVDSeriesFile::LVDSeriesFile( const std::string &manifestName, int keyframeInterval, int blockSideInLog, const Vec3i &dataSize, int padding, uint32_t flags, LVDVoxelType voxelType ) :
+  manifestName( manifestName ),
+  keyframeInterval( ( std::max )( keyframeInterval, 1 ) ),
+  blockSideInLog( blockSideInLog ),
+  dataSize( dataSize ),
+  padding( padding ),
+  flags( flags ),
+  voxelType( voxelType )
+{
+	validFlag = WriteManifest();
+}
+
+bool LVDSeriesFile::IsManifest( const std::string &fileName )
+{
+	return std::filesystem::path( fileName ).extension() == ".lvdt";
+}
+
+std::string LVDSeriesFile::PathOf( const std::string &name ) const
+{
+	return ( std::filesystem::path( manifestName ).parent_path() / name ).string();
+}
+
+bool LVDSeriesFile::WriteManifest() const
+{
+	LVDSeriesManifest manifest;
+	manifest.timesteps = names;
+	manifest.keyframes = keyframes;
+	std::ofstream out( manifestName );
+	if ( out.is_open() == false ) {
+		LOG_ERROR << "LVDSeriesFile: failed to write " << manifestName;
+		return false;
+	}
+	vm::json::Writer writer;
+	writer.write( out, manifest );
+	return true;
+}
+
+int LVDSeriesFile::AppendTimestep()
+{
+	if ( keyframeInterval == 0 ) {
+		LOG_ERROR << "LVDSeriesFile: an opened series is read-only";
+		return -1;
+	}
+	const int t = TimestepCount();
+	if ( t > 0 ) {
+		// the finished timestep is only read from now on, as the keyframe of the next ones or not at all
+		timesteps[ t - 1 ]->Close();
+		timesteps[ t - 1 ] = std::make_shared<LVDFile>( PathOf( names[ t - 1 ] ), true );
+		if ( timesteps[ t - 1 ]->Valid() == false ) {
+			LOG_ERROR << "LVDSeriesFile: failed to reopen " << names[ t - 1 ];
+			return -1;
+		}
+	}
+	const bool keyframe = t % keyframeInterval == 0;
+	const auto name = std::filesystem::path( manifestName ).stem().string() + "." + std::to_string( t ) + ".lvd";
+	auto file = std::make_shared<LVDFile>( PathOf( name ), blockSideInLog, dataSize, padding, LVD_VERSION_2,
+										   keyframe ? flags : ( flags & ~LVD_FLAG_SPARSE ) | LVD_FLAG_DELTA, voxelType );
+	if ( file->Valid() == false ) {
+		return -1;
+	}
+	names.push_back( name );
+	timesteps.push_back( std::move( file ) );
+	keyframes.push_back( keyframe ? t : keyframes.back() );
+	return WriteManifest() ? t : -1;
+}
+
+bool LVDSeriesFile::SetTimestep( int timestep )
+{
+	if ( timestep < 0 || timestep >= TimestepCount() ) {
+		LOG_ERROR << "LVDSeriesFile: no timestep " << timestep;
+		return false;
+	}
+	current = timestep;
+	return true;
+}
+
+LVDFile &LVDSeriesFile::FileOf( int timestep, std::size_t blockId, int lod ) const
+{
+	auto &file = *timesteps[ timestep ];
+	return keyframes[ timestep ] == timestep || file.BlockOccupied( blockId, lod ) ? file : *timesteps[ keyframes[ timestep ] ];
+}
+
+std::vector<std::size_t> LVDSeriesFile::ChangedBlocks( int from, int to, int lod ) const
+{
+	std::vector<std::size_t> changed;
+	if ( from == to ) {
+		return changed;
+	}
+	if ( keyframes[ from ] != keyframes[ to ] ) {
+		changed.resize( BlockCount( lod ) );
+		std::iota( changed.begin(), changed.end(), std::size_t( 0 ) );
+		return changed;
+	}
+	const auto stored = [ this, lod ]( int t, std::size_t id ) { return keyframes[ t ] != t && timesteps[ t ]->BlockOccupied( id, lod ); };
+	for ( std::size_t id = 0; id < BlockCount( lod ); id++ ) {
+		if ( stored( from, id ) || stored( to, id ) ) {
+			changed.push_back( id );
+		}
+	}
+	return changed;
+}
+
+void LVDSeriesFile::WriteBlock( const char *src, std::size_t blockId, int lod )
+{
+	const int t = TimestepCount() - 1;
+	if ( t < 0 ) {
+		throw std::runtime_error( "LVDSeriesFile: no timestep to write, call AppendTimestep first" );
+	}
+	if ( keyframes[ t ] != t ) {
+		thread_local std::vector<char> keyframe;
+		keyframe.resize( timesteps[ t ]->BlockBytes( lod ) );
+		timesteps[ keyframes[ t ] ]->ReadBlock( keyframe.data(), blockId, lod );
+		if ( memcmp( keyframe.data(), src, keyframe.size() ) == 0 ) {
+			return;
+		}
+	}
+	timesteps[ t ]->WriteBlock( src, blockId, lod );
+}
+
+void LVDSeriesFile::AdviseBlocks( const std::vector<std::size_t> &blockIds, int lod, LVDAccessAdvice advice )
+{
+	std::map<LVDFile *, std::vector<std::size_t>> perFile;
+	for ( const auto id : blockIds ) {
+		if ( id < BlockCount( lod ) ) {
+			perFile[ &FileOf( id, lod ) ].push_back( id );
+		}
+	}
+	for ( const auto &each : perFile ) {
+		each.first->AdviseBlocks( each.second, lod, advice );
+	}
+}
+
+bool LVDSeriesFile::SetDirectIO( bool enable )
+{
+	bool ok = true;
+	for ( const auto &file : timesteps ) {
+		ok = file->SetDirectIO( enable ) && ok;
+	}
+	return ok;
+}
+
+bool LVDSeriesFile::ReadRegion( const Bound3i &bound, int lod, void *dst, std::size_t rowStride, std::size_t sliceStride, int threadCount )
+{
+	const int t = current;
+	if ( keyframes[ t ] == t ) {
+		return timesteps[ t ]->ReadRegion( bound, lod, dst, rowStride, sliceStride, threadCount );
+	}
+	// the unchanged blocks from the keyframe, then the changed ones over them
+	const auto &delta = *timesteps[ t ];
+	return timesteps[ keyframes[ t ] ]->ReadRegion( bound, lod, dst, rowStride, sliceStride, threadCount, [ & ]( std::size_t id ) { return delta.BlockOccupied( id, lod ) == false; } ) &&
+		   timesteps[ t ]->ReadRegion( bound, lod, dst, rowStride, sliceStride, threadCount, [ & ]( std::size_t id ) { return delta.BlockOccupied( id, lod ); } );
+}
+
+void LVDSeriesFile::Close()
+{
+	for ( const auto &file : timesteps ) {
+		file->Close();
+	}
+}
+}  // namespace vm
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lvdfile.h"
+
+namespace vm
+{
+/**
+ * \brief A time series of volumes of one geometry, where a timestep only stores the blocks that changed
+ * since its keyframe, so playing it back reads as much as the data changes.
+ *
+ * The manifest (".lvdt", JSON) lists the timestep files, relative to its own directory, and the keyframe of
+ * each timestep. A keyframe is a complete LVD. Every other timestep is a LVD_FLAG_DELTA level whose block
+ * table is the index of the blocks changed since the keyframe, its absent blocks are read from the keyframe.
+ *
+ * The block calls read the current timestep (SetTimestep), ChangedBlocks tells a cache which of its blocks
+ * to reload when the timestep changes. A series is written once by the creating constructor and
+ * AppendTimestep, an opened series is read-only.
+ */
+class LVDSeriesFile
+{
+	std::string manifestName;
+	std::vector<std::string> names;	 // of the timestep files, relative to the manifest
+	std::vector<std::shared_ptr<LVDFile>> timesteps;
+	std::vector<int> keyframes;	 // the keyframe of each timestep, a keyframe is its own
+	std::atomic<int> current{ 0 };
+	// the geometry of the timesteps being created, keyframeInterval is 0 for an opened series
+	int keyframeInterval = 0;
+	int blockSideInLog = 0;
+	Vec3i dataSize;
+	int padding = 0;
+	uint32_t flags = 0;
+	LVDVoxelType voxelType = LVD_VOXEL_UINT8;
+	bool validFlag = false;
+
+	bool WriteManifest() const;
+	std::string PathOf( const std::string &name ) const;
+
+public:
+	/**
+	 * \brief Opens the manifest \a manifestName and all of its timesteps read-only
+	 */
+	explicit LVDSeriesFile( const std::string &manifestName );
+	/**
+	 * \brief Creates an empty series, see AppendTimestep. Every \a keyframeInterval timesteps a keyframe is
+	 * stored, a larger interval stores less but reloads everything less often.
+	 */
+	LVDSeriesFile( const std::string &manifestName, int keyframeInterval, int blockSideInLog, const Vec3i &dataSize, int padding, uint32_t flags = LVD_FLAG_SPARSE, LVDVoxelType voxelType = LVD_VOXEL_UINT8 );
+	/**
+	 * \brief Returns true if \a fileName names a series manifest rather than a LVD file
+	 */
+	static bool IsManifest( const std::string &fileName );
+
+	bool Valid() const { return validFlag; }
+	int TimestepCount() const { return int( timesteps.size() ); }
+	int KeyframeOf( int timestep ) const { return keyframes[ timestep ]; }
+	const std::shared_ptr<LVDFile> &Timestep( int timestep ) const { return timesteps[ timestep ]; }
+	/**
+	 * \brief Finishes the last timestep and starts the next one, which is then written by WriteBlock.
+	 * Returns the new timestep or -1 if its file could not be created.
+	 */
+	int AppendTimestep();
+	/**
+	 * \brief Makes the block calls read \a timestep, returns false if there is no such timestep
+	 */
+	bool SetTimestep( int timestep );
+	int CurrentTimestep() const { return current; }
+	/**
+	 * \brief The file holding the block in \a timestep: the timestep itself or its keyframe
+	 */
+	LVDFile &FileOf( int timestep, std::size_t blockId, int lod = 0 ) const;
+	LVDFile &FileOf( std::size_t blockId, int lod = 0 ) const { return FileOf( current, blockId, lod ); }
+	/**
+	 * \brief Returns the blocks that may differ between \a from and \a to: the blocks stored by either of them
+	 * if they share the keyframe, otherwise all the blocks, the keyframes are not compared with each other
+	 */
+	std::vector<std::size_t> ChangedBlocks( int from, int to, int lod = 0 ) const;
+
+	int LODCount() const { return timesteps[ 0 ]->LODCount(); }
+	Size3 SizeByBlock( int lod = 0 ) const { return timesteps[ 0 ]->SizeByBlock( lod ); }
+	Size3 OriginalDataSize( int lod = 0 ) const { return timesteps[ 0 ]->OriginalDataSize( lod ); }
+	std::size_t BlockCount( int lod = 0 ) const { return timesteps[ 0 ]->BlockCount( lod ); }
+	std::size_t BlockBytes( int lod = 0 ) const { return timesteps[ 0 ]->BlockBytes( lod ); }
+
+	void ReadBlock( char *dest, std::size_t blockId, int lod = 0 ) { FileOf( blockId, lod ).ReadBlock( dest, blockId, lod ); }
+	unsigned char *ReadBlock( std::size_t blockId, int lod = 0 ) { return FileOf( blockId, lod ).ReadBlock( blockId, lod ); }
+	/**
+	 * \brief Writes the block of the last timestep. A delta timestep skips the blocks equal to the ones of its
+	 * keyframe, so the whole volume could be written every timestep. Write a block once per timestep.
+	 */
+	void WriteBlock( const char *src, std::size_t blockId, int lod = 0 );
+	bool BlockOccupied( std::size_t blockId, int lod = 0 ) const { return FileOf( blockId, lod ).BlockOccupied( blockId, lod ); }
+	const LVDBlockStats *BlockStats( std::size_t blockId, int lod = 0 ) const { return FileOf( blockId, lod ).BlockStats( blockId, lod ); }
+	/**
+	 * \brief Advises the files of the current timestep holding the listed blocks
+	 */
+	void AdviseBlocks( const std::vector<std::size_t> &blockIds, int lod, LVDAccessAdvice advice );
+	/**
+	 * \brief Returns true if every timestep is read with direct I/O
+	 */
+	bool SetDirectIO( bool enable );
+	/**
+	 * \brief See LVDFile::ReadRegion, reads the current timestep
+	 */
+	bool ReadRegion( const Bound3i &bound, int lod, void *dst, std::size_t rowStride = 0, std::size_t sliceStride = 0, int threadCount = 0 );
+	void Close();
+};
+}  // namespace vm
@@ -0,0 +1,238 @@
+#include "lvdshardedfile.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#include <VMFoundation/logger.h>
+#include <jsondef.hpp>
+
+namespace vm
+{
+namespace
+{
+enum
+{
+	MaxShardCount = 0xffff	// the routing tables hold 16-bit shard indices
+};
+}  // namespace
+
+LVDShardedFile::LVDShardedFile( const std::string &manifestName, bool readOnly ) :
+  manifestName( manifestName )
+{
+	LVDShardManifest manifest;
+	std::ifstream in( manifestName );
+	if ( in.is_open() == false ) {
+		LOG_ERROR << "LVDShardedFile: failed to open " << manifestName;
+		return;
+	}
+	in >> manifest;
+	if ( manifest.shards.empty() || manifest.shards.size() > MaxShardCount ) {
+		LOG_ERROR << "LVDShardedFile: " << manifestName << " lists no or too many shards";
+		return;
+	}
+	if ( manifest.striping == StripingName( LVD_STRIPING_MORTON_RANGE ) ) {
+		striping = LVD_STRIPING_MORTON_RANGE;
+	} else if ( manifest.striping != StripingName( LVD_STRIPING_ROUND_ROBIN ) ) {
+		LOG_ERROR << "LVDShardedFile: unknown striping " << manifest.striping;
+		return;
+	}
+	const auto dir = std::filesystem::path( manifestName ).parent_path();
+	for ( const auto &name : manifest.shards ) {
+		auto shard = std::make_shared<LVDFile>( ( dir / name ).string(), readOnly );
+		if ( shard->Valid() == false || ( shards.empty() == false && shard->LODCount() != shards[ 0 ]->LODCount() ) ) {
+			LOG_ERROR << "LVDShardedFile: bad shard " << name;
+			return;
+		}
+		shards.push_back( std::move( shard ) );
+	}
+	for ( const auto &shard : shards ) {
+		for ( int lod = 0; lod < shard->LODCount(); lod++ ) {
+			const auto s = shard->OriginalDataSize( lod ), first = shards[ 0 ]->OriginalDataSize( lod );
+			if ( s.x != first.x || s.y != first.y || s.z != first.z || shard->BlockSizeInLog( lod ) != shards[ 0 ]->BlockSizeInLog( lod ) ||
+				 shard->GetBlockPadding( lod ) != shards[ 0 ]->GetBlockPadding( lod ) || shard->VoxelType( lod ) != shards[ 0 ]->VoxelType( lod ) ||
+				 shard->MortonOrder( lod ) != shards[ 0 ]->MortonOrder( lod ) ) {
+				LOG_ERROR << "LVDShardedFile: the shards of " << manifestName << " differ in geometry";
+				shards.clear();
+				return;
+			}
+		}
+	}
+	BuildRouting();
+	if ( readOnly ) {
+		// every shard has the blocks of the others absent, the zero blocks are the ones absent in their own shard
+		absentInstances.assign( LODCount(), UINT64_MAX );
+		for ( int lod = 0; lod < LODCount(); lod++ ) {
+			for ( std::size_t id = 0; id < BlockCount( lod ); id++ ) {
+				if ( BlockOccupied( id, lod ) == false ) {
+					absentInstances[ lod ] = id;
+					break;
+				}
+			}
+		}
+	}
+	validFlag = true;
+}
+
+LVDShardedFile::LVDShardedFile( const std::string &manifestName, int shardCount, LVDStriping striping, int blockSideInLog, const Vec3i &dataSize, int padding, uint32_t flags, LVDVoxelType voxelType ) :
+  manifestName( manifestName ),
+  striping( striping )
+{
+	if ( shardCount <= 0 || shardCount > MaxShardCount ) {
+		LOG_ERROR << "LVDShardedFile: bad shard count " << shardCount;
+		return;
+	}
+	const std::filesystem::path path( manifestName );
+	std::vector<std::string> shardNames;
+	for ( int i = 0; i < shardCount; i++ ) {
+		shardNames.push_back( path.stem().string() + "." + std::to_string( i ) + ".lvd" );
+		auto shard = std::make_shared<LVDFile>( ( path.parent_path() / shardNames.back() ).string(), blockSideInLog, dataSize, padding, LVD_VERSION_2, flags | LVD_FLAG_SPARSE, voxelType );
+		if ( shard->Valid() == false ) {
+			shards.clear();
+			return;
+		}
+		shards.push_back( std::move( shard ) );
+	}
+	if ( WriteManifest( shardNames ) == false ) {
+		shards.clear();
+		return;
+	}
+	BuildRouting();
+	validFlag = true;
+}
+
+bool LVDShardedFile::IsManifest( const std::string &fileName )
+{
+	return std::filesystem::path( fileName ).extension() == ".lvds";
+}
+
+const char *LVDShardedFile::StripingName( LVDStriping striping )
+{
+	return striping == LVD_STRIPING_MORTON_RANGE ? "morton-range" : "round-robin";
+}
+
+bool LVDShardedFile::WriteManifest( const std::vector<std::string> &shardNames ) const
+{
+	LVDShardManifest manifest;
+	manifest.shards = shardNames;
+	manifest.striping = StripingName( striping );
+	std::ofstream out( manifestName );
+	if ( out.is_open() == false ) {
+		LOG_ERROR << "LVDShardedFile: failed to write " << manifestName;
+		return false;
+	}
+	vm::json::Writer writer;
+	writer.write( out, manifest );
+	return true;
+}
+
+void LVDShardedFile::BuildRouting()
+{
+	// a table is only needed when the rank of a block in the striped order is not its id
+	shardOfBlock.assign( LODCount(), {} );
+	const std::size_t n = shards.size();
+	for ( int lod = 0; lod < LODCount(); lod++ ) {
+		if ( n == 1 || ( striping == LVD_STRIPING_ROUND_ROBIN && MortonOrder( lod ) == false ) ) {
+			continue;
+		}
+		const auto order = LVDMortonOrder( SizeByBlock( lod ) );
+		auto &table = shardOfBlock[ lod ];
+		table.resize( order.size() );
+		for ( std::size_t rank = 0; rank < order.size(); rank++ ) {
+			table[ order[ rank ] ] = uint16_t( striping == LVD_STRIPING_ROUND_ROBIN ? rank % n : rank * n / order.size() );
+		}
+	}
+}
+
+int LVDShardedFile::ShardOf( std::size_t blockId, int lod ) const
+{
+	const auto &table = shardOfBlock[ lod ];
+	return table.empty() ? int( blockId % shards.size() ) : table[ blockId ];
+}
+
+std::size_t LVDShardedFile::BlockInstance( std::size_t blockId, int lod ) const
+{
+	const auto &file = FileOf( blockId, lod );
+	if ( absentInstances.empty() == false && file.BlockOccupied( blockId, lod ) == false ) {
+		return absentInstances[ lod ];
+	}
+	return file.BlockInstance( blockId, lod );
+}
+
+bool LVDShardedFile::Flush()
+{
+	bool ok = true;
+	for ( const auto &shard : shards ) {
+		ok = shard->Flush() && ok;
+	}
+	return ok;
+}
+
+void LVDShardedFile::StartBackgroundFlush( std::chrono::milliseconds interval )
+{
+	for ( const auto &shard : shards ) {
+		shard->StartBackgroundFlush( interval );
+	}
+}
+
+std::size_t LVDShardedFile::OccupiedBlockCount( int lod ) const
+{
+	std::size_t count = 0;
+	for ( const auto &shard : shards ) {
+		count += shard->OccupiedBlockCount( lod );
+	}
+	return count;
+}
+
+void LVDShardedFile::AdviseBlocks( const std::vector<std::size_t> &blockIds, int lod, LVDAccessAdvice advice )
+{
+	std::vector<std::vector<std::size_t>> perShard( shards.size() );
+	for ( const auto id : blockIds ) {
+		if ( id < BlockCount( lod ) ) {
+			perShard[ ShardOf( id, lod ) ].push_back( id );
+		}
+	}
+	for ( std::size_t i = 0; i < shards.size(); i++ ) {
+		if ( perShard[ i ].empty() == false ) {
+			shards[ i ]->AdviseBlocks( perShard[ i ], lod, advice );
+		}
+	}
+}
+
+bool LVDShardedFile::SetDirectIO( bool enable )
+{
+	bool ok = true;
+	for ( const auto &shard : shards ) {
+		ok = shard->SetDirectIO( enable ) && ok;
+	}
+	return ok;
+}
+
+bool LVDShardedFile::ReadRegion( const Bound3i &bound, int lod, void *dst, std::size_t rowStride, std::size_t sliceStride, int threadCount )
+{
+	if ( threadCount <= 0 ) {
+		threadCount = ( std::max )( 1u, std::thread::hardware_concurrency() );
+	}
+	// every shard copies its own blocks, the blocks do not overlap in the region
+	const int perShard = ( std::max )( 1, threadCount / ShardCount() );
+	std::vector<char> ok( shards.size(), 0 );
+	std::vector<std::thread> readers;
+	for ( int i = 0; i < ShardCount(); i++ ) {
+		readers.emplace_back( [ &, i ]() {
+			ok[ i ] = shards[ i ]->ReadRegion( bound, lod, dst, rowStride, sliceStride, perShard, [ &, i ]( std::size_t id ) { return ShardOf( id, lod ) == i; } );
+		} );
+	}
+	for ( auto &t : readers ) {
+		t.join();
+	}
+	return std::find( ok.begin(), ok.end(), 0 ) == ok.end();
+}
+
+void LVDShardedFile::Close()
+{
+	for ( const auto &shard : shards ) {
+		shard->Close();
+	}
+}
+}  // namespace vm
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lvdfile.h"
+
+namespace vm
+{
+/**
+ * \brief How the blocks of a sharded LVD are distributed over its shards
+ */
+enum LVDStriping
+{
+	LVD_STRIPING_ROUND_ROBIN = 0,  // consecutive blocks in the storage order go to consecutive shards
+	LVD_STRIPING_MORTON_RANGE = 1  // each shard holds one contiguous range of the Morton order
+};
+
+/**
+ * \brief A LVD split over several data files, so the reads and writes of the blocks are spread over the
+ * storage targets of a parallel file system instead of serializing on one file.
+ *
+ * The manifest (".lvds", JSON) lists the shards, relative to its own directory, and the striping. Every
+ * shard is a complete sparse v2 LVD of the whole volume holding only its own blocks, the other blocks
+ * are absent in it. The shards are independent files, so a single shard can be read by any LVD tool.
+ *
+ * The block calls are routed to the shard of the block, the geometry is the one of the first shard.
+ */
+class LVDShardedFile
+{
+	std::string manifestName;
+	std::vector<std::shared_ptr<LVDFile>> shards;
+	LVDStriping striping = LVD_STRIPING_ROUND_ROBIN;
+	std::vector<std::vector<uint16_t>> shardOfBlock;  // per level, empty if the shard follows from the block id
+	std::vector<uint64_t> absentInstances;			  // per level of a read-only file, the lowest block absent in its own shard
+	bool validFlag = false;
+
+	bool WriteManifest( const std::vector<std::string> &shardNames ) const;
+	void BuildRouting();
+
+public:
+	/**
+	 * \brief Opens the manifest \a manifestName and all of its shards
+	 */
+	explicit LVDShardedFile( const std::string &manifestName, bool readOnly = false );
+	/**
+	 * \brief Creates a sharded LVD of \a shardCount shards, named after the manifest. LVD_FLAG_SPARSE is
+	 * always set, the shards rely on the absent blocks.
+	 */
+	LVDShardedFile( const std::string &manifestName, int shardCount, LVDStriping striping, int BlockSideInLog, const Vec3i &dataSize, int padding, uint32_t flags = LVD_FLAG_SPARSE, LVDVoxelType voxelType = LVD_VOXEL_UINT8 );
+	/**
+	 * \brief Returns true if \a fileName names a manifest rather than a LVD file
+	 */
+	static bool IsManifest( const std::string &fileName );
+	static const char *StripingName( LVDStriping striping );
+
+	bool Valid() const { return validFlag; }
+	int ShardCount() const { return int( shards.size() ); }
+	LVDStriping Striping() const { return striping; }
+	const std::shared_ptr<LVDFile> &Shard( int index ) const { return shards[ index ]; }
+	int ShardOf( std::size_t blockId, int lod = 0 ) const;
+	LVDFile &FileOf( std::size_t blockId, int lod = 0 ) const { return *shards[ ShardOf( blockId, lod ) ]; }
+
+	int LODCount() const { return shards[ 0 ]->LODCount(); }
+	Size3 SizeByBlock( int lod = 0 ) const { return shards[ 0 ]->SizeByBlock( lod ); }
+	Size3 OriginalDataSize( int lod = 0 ) const { return shards[ 0 ]->OriginalDataSize( lod ); }
+	std::size_t BlockCount( int lod = 0 ) const { return shards[ 0 ]->BlockCount( lod ); }
+	std::size_t BlockBytes( int lod = 0 ) const { return shards[ 0 ]->BlockBytes( lod ); }
+	bool MortonOrder( int lod = 0 ) const { return shards[ 0 ]->MortonOrder( lod ); }
+
+	void ReadBlock( char *dest, std::size_t blockId, int lod = 0 ) { FileOf( blockId, lod ).ReadBlock( dest, blockId, lod ); }
+	unsigned char *ReadBlock( std::size_t blockId, int lod = 0 ) { return FileOf( blockId, lod ).ReadBlock( blockId, lod ); }
+	/**
+	 * \brief Writes the block to its shard, blocks of different shards are written in parallel
+	 */
+	void WriteBlock( const char *src, std::size_t blockId, int lod = 0 ) { FileOf( blockId, lod ).WriteBlock( src, blockId, lod ); }
+	bool Flush( std::size_t blockId, int lod = 0 ) { return FileOf( blockId, lod ).Flush( blockId, lod ); }
+	bool Flush();
+	void StartBackgroundFlush( std::chrono::milliseconds interval );
+	bool BlockOccupied( std::size_t blockId, int lod = 0 ) const { return FileOf( blockId, lod ).BlockOccupied( blockId, lod ); }
+	std::size_t OccupiedBlockCount( int lod = 0 ) const;
+	const LVDBlockStats *BlockStats( std::size_t blockId, int lod = 0 ) const { return FileOf( blockId, lod ).BlockStats( blockId, lod ); }
+	/**
+	 * \brief See LVDFile::BlockInstance, blocks only share extents with blocks of the same shard
+	 */
+	std::size_t BlockInstance( std::size_t blockId, int lod = 0 ) const;
+	/**
+	 * \brief Advises every shard of its own blocks among \a blockIds
+	 */
+	void AdviseBlocks( const std::vector<std::size_t> &blockIds, int lod, LVDAccessAdvice advice );
+	/**
+	 * \brief Returns true if every shard is read with direct I/O
+	 */
+	bool SetDirectIO( bool enable );
+	/**
+	 * \brief See LVDFile::ReadRegion, the shards are read in parallel
+	 */
+	bool ReadRegion( const Bound3i &bound, int lod, void *dst, std::size_t rowStride = 0, std::size_t sliceStride = 0, int threadCount = 0 );
+	void Close();
+};
+}  // namespace vm
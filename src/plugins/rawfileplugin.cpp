@@ -0,0 +1,196 @@
+#include "rawfileplugin.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <VMFoundation/pluginloader.h>
+#include <VMFoundation/logger.h>
+#include <VMUtils/vmnew.hpp>
+#include <jsondef.hpp>
+
+namespace vm
+{
+RawFilePlugin::~RawFilePlugin()
+{
+	Close();
+}
+
+void RawFilePlugin::Open( const std::string &fileName )
+{
+	Close();
+	RawJSONStruct sidecar;
+	std::ifstream json( fileName + ".json" );
+	if ( json.is_open() == false ) {
+		throw std::runtime_error( "missing sidecar " + fileName + ".json" );
+	}
+	json >> sidecar;
+	if ( sidecar.dataSize.size() != 3 || sidecar.dataSize[ 0 ] <= 0 || sidecar.dataSize[ 1 ] <= 0 || sidecar.dataSize[ 2 ] <= 0 ) {
+		throw std::runtime_error( "bad data size in " + fileName + ".json" );
+	}
+	if ( sidecar.type != "uint8" ) {
+		throw std::runtime_error( "only 8-bit raws are served, convert " + fileName + " with lvdconvert" );
+	}
+	dataSize = Size3( sidecar.dataSize[ 0 ], sidecar.dataSize[ 1 ], sidecar.dataSize[ 2 ] );
+	const std::size_t bytes = dataSize.x * dataSize.y * dataSize.z;
+	std::error_code ec;
+	const auto fileBytes = std::filesystem::file_size( fileName, ec );
+	if ( ec || fileBytes < bytes ) {
+		throw std::runtime_error( fileName + " is smaller than its sidecar says" );
+	}
+
+#ifdef _WIN32
+	io = PluginLoader::GetPluginLoader()->CreatePlugin<IMappingFile>( "windows" );
+#else
+	io = PluginLoader::GetPluginLoader()->CreatePlugin<IMappingFile>( "linux" );
+#endif
+	if ( io == nullptr ) {
+		throw std::runtime_error( "can not load ioplugin" );
+	}
+	if ( io->Open( fileName, bytes, FileAccess::Read, MapAccess::ReadOnly ) == false || ( raw = io->MemoryMap( 0, bytes ) ) == nullptr ) {
+		io = nullptr;
+		throw std::runtime_error( "failed to map " + fileName );
+	}
+
+	const std::size_t step = Step();
+	blockDim = Size3( ( dataSize.x + step - 1 ) / step, ( dataSize.y + step - 1 ) / step, ( dataSize.z + step - 1 ) / step );
+	capacity = ( std::max )( std::size_t( 1 ), std::size_t( CacheBytes ) >> ( 3 * BlockSideInLog ) );
+	stop = false;
+	for ( int i = 0; i < ReadAheadThreads; i++ ) {
+		workers.emplace_back( &RawFilePlugin::ReadAhead, this );
+	}
+}
+
+bool RawFilePlugin::Create( const Block3DDataFileDesc * /*desc*/ )
+{
+	LOG_ERROR << "RawFilePlugin: raw files are read-only";
+	return false;
+}
+
+void RawFilePlugin::Close()
+{
+	{
+		std::lock_guard<std::mutex> lk( mutex );
+		stop = true;
+		readAhead.clear();
+	}
+	readAheadCV.notify_all();
+	for ( auto &t : workers ) {
+		t.join();
+	}
+	workers.clear();
+	lru.clear();
+	cached.clear();
+	page = nullptr;
+	if ( io ) {
+		io->MemoryUnmap( const_cast<unsigned char *>( raw ) );
+		io->Close();
+		io = nullptr;
+	}
+	raw = nullptr;
+}
+
+const void *RawFilePlugin::GetPage( size_t pageID )
+{
+	if ( raw == nullptr || pageID >= GetVirtualPageCount() ) {
+		return nullptr;
+	}
+	page = Fetch( pageID ).get();
+	QueueNeighbours( pageID );
+	return page->data();
+}
+
+void RawFilePlugin::Write( const void * /*page*/, size_t /*pageID*/, bool /*flush*/ )
+{
+	LOG_ERROR << "RawFilePlugin: raw files are read-only";
+}
+
+RawFilePlugin::Brick RawFilePlugin::Fetch( std::size_t pageID )
+{
+	std::promise<BrickData> promise;
+	Brick brick;
+	{
+		std::lock_guard<std::mutex> lk( mutex );
+		const auto it = cached.find( pageID );
+		if ( it != cached.end() ) {
+			lru.splice( lru.begin(), lru, it->second );
+			return it->second->second;
+		}
+		// other requests of the brick wait for this one to assemble it
+		brick = promise.get_future().share();
+		lru.emplace_front( pageID, brick );
+		cached[ pageID ] = lru.begin();
+		while ( lru.size() > capacity ) {
+			cached.erase( lru.back().first );
+			lru.pop_back();
+		}
+	}
+	promise.set_value( Assemble( pageID ) );
+	return brick;
+}
+
+RawFilePlugin::BrickData RawFilePlugin::Assemble( std::size_t pageID ) const
+{
+	const int side = 1 << BlockSideInLog, step = Step();
+	auto brick = std::make_shared<std::vector<unsigned char>>( std::size_t( side ) * side * side, 0 );
+	const long long bx = pageID % blockDim.x, by = pageID / blockDim.x % blockDim.y, bz = pageID / ( blockDim.x * blockDim.y );
+	const long long x0 = bx * step - Padding, y0 = by * step - Padding, z0 = bz * step - Padding;
+	// the part of the brick inside the volume, the rest stays zero
+	const long long xBegin = ( std::max )( x0, 0LL ), xEnd = ( std::min )( x0 + side, (long long)dataSize.x );
+	if ( xBegin >= xEnd ) {
+		return brick;
+	}
+	for ( long long z = ( std::max )( z0, 0LL ); z < ( std::min )( z0 + side, (long long)dataSize.z ); z++ ) {
+		for ( long long y = ( std::max )( y0, 0LL ); y < ( std::min )( y0 + side, (long long)dataSize.y ); y++ ) {
+			memcpy( brick->data() + ( ( z - z0 ) * side + ( y - y0 ) ) * side + ( xBegin - x0 ),
+					raw + ( z * dataSize.y + y ) * dataSize.x + xBegin, xEnd - xBegin );
+		}
+	}
+	return brick;
+}
+
+void RawFilePlugin::QueueNeighbours( std::size_t pageID )
+{
+	const long long bx = pageID % blockDim.x, by = pageID / blockDim.x % blockDim.y, bz = pageID / ( blockDim.x * blockDim.y );
+	const long long neighbours[ 6 ][ 3 ] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+	{
+		std::lock_guard<std::mutex> lk( mutex );
+		for ( const auto &d : neighbours ) {
+			const long long x = bx + d[ 0 ], y = by + d[ 1 ], z = bz + d[ 2 ];
+			if ( x < 0 || y < 0 || z < 0 || x >= (long long)blockDim.x || y >= (long long)blockDim.y || z >= (long long)blockDim.z ) {
+				continue;
+			}
+			const std::size_t id = ( z * blockDim.y + y ) * blockDim.x + x;
+			if ( cached.count( id ) == 0 ) {
+				readAhead.push_back( id );
+			}
+		}
+		while ( readAhead.size() > MaxPendingReadAhead ) {
+			readAhead.pop_front();
+		}
+	}
+	readAheadCV.notify_all();
+}
+
+void RawFilePlugin::ReadAhead()
+{
+	while ( true ) {
+		std::size_t id = 0;
+		{
+			std::unique_lock<std::mutex> lk( mutex );
+			readAheadCV.wait( lk, [ this ]() { return stop || readAhead.empty() == false; } );
+			if ( stop ) {
+				return;
+			}
+			// the latest requests first, they are the neighbours of what is being rendered now
+			id = readAhead.back();
+			readAhead.pop_back();
+		}
+		Fetch( id );
+	}
+}
+}  // namespace vm
+
+VM_REGISTER_PLUGIN_FACTORY_IMPL( RawFilePluginFactory )
+EXPORT_PLUGIN_FACTORY_IMPLEMENT( RawFilePluginFactory )
@@ -0,0 +1,109 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <VMUtils/vmnew.hpp>
+#include <VMUtils/ieverything.hpp>
+#include <VMCoreExtension/plugin.h>
+#include <VMCoreExtension/i3dblockfileplugininterface.h>
+#include <VMCoreExtension/ifilemappingplugininterface.h>
+
+namespace vm
+{
+/**
+ * \brief Serves a raw volume as blocks, so it could be viewed without converting it to LVD first.
+ *
+ * The raw needs a sidecar "<raw>.json" with its size and voxel type: {"dataSize": [x, y, z], "type": "uint8"}.
+ * The raw is mapped read-only and a block, with its padding and zero outside of the volume, is assembled
+ * from it when it is requested. An LRU keeps the assembled blocks, and worker threads assemble the face
+ * neighbours of every requested block ahead of the requests, since the rays go on into them.
+ *
+ * Only 8-bit raws are served, the pages of a I3DBlockFilePluginInterface are 8-bit for Block3DCache.
+ * Wider raws must be converted with lvdconvert.
+ */
+class RawFilePlugin : public vm::EverythingBase<I3DBlockFilePluginInterface>
+{
+	using BrickData = std::shared_ptr<const std::vector<unsigned char>>;
+	using Brick = std::shared_future<BrickData>;  // ready once assembled
+	enum
+	{
+		BlockSideInLog = 6,
+		Padding = 2,
+		CacheBytes = 512 << 20,
+		ReadAheadThreads = 4,
+		MaxPendingReadAhead = 256  // older read-ahead requests are dropped beyond
+	};
+
+	Ref<IMappingFile> io;
+	const unsigned char *raw = nullptr;
+	Size3 dataSize;
+	Size3 blockDim;
+	std::size_t capacity = 0;  // bricks of the LRU
+	std::mutex mutex;
+	std::list<std::pair<std::size_t, Brick>> lru;  // most recently used first
+	std::unordered_map<std::size_t, std::list<std::pair<std::size_t, Brick>>::iterator> cached;
+	std::deque<std::size_t> readAhead;
+	std::condition_variable readAheadCV;
+	std::vector<std::thread> workers;
+	bool stop = false;
+	BrickData page;	 // returned by the last GetPage, valid until the next one even if it is evicted
+
+	/**
+	 * \brief Returns the brick from the LRU, or assembles it on the calling thread and caches it
+	 */
+	Brick Fetch( std::size_t pageID );
+	BrickData Assemble( std::size_t pageID ) const;
+	void QueueNeighbours( std::size_t pageID );
+	void ReadAhead();
+	int Step() const { return ( 1 << BlockSideInLog ) - 2 * Padding; }
+
+public:
+	RawFilePlugin( ::vm::IRefCnt *cnt ) :
+	  vm::EverythingBase<I3DBlockFilePluginInterface>( cnt ) {}
+	~RawFilePlugin();
+	void Open( const std::string &fileName ) override;
+	/**
+	 * \brief Raws are read-only, fails
+	 */
+	bool Create( const Block3DDataFileDesc *desc ) override;
+	void Close() override;
+	const void *GetPage( size_t pageID ) override;
+	size_t GetPageSize() const override { return std::size_t( 1 ) << BlockSideInLog; }
+	size_t GetPhysicalPageCount() const override { return blockDim.x * blockDim.y * blockDim.z; }
+	size_t GetVirtualPageCount() const override { return blockDim.x * blockDim.y * blockDim.z; }
+
+	int GetPadding() const override { return Padding; }
+	Size3 GetDataSizeWithoutPadding() const override { return dataSize; }
+	Size3 Get3DPageSize() const override { return Size3{ GetPageSize(), GetPageSize(), GetPageSize() }; }
+	int Get3DPageSizeInLog() const override { return BlockSideInLog; }
+	Size3 Get3DPageCount() const override { return blockDim; }
+
+	void Flush() override {}
+	void Write( const void *page, size_t pageID, bool flush ) override;
+	void Flush( size_t /*pageID*/ ) override {}
+};
+
+}  // namespace vm
+
+class RawFilePluginFactory : public vm::IPluginFactory
+{
+public:
+	DECLARE_PLUGIN_FACTORY( "visualman.blockdata.io" )
+	std::vector<std::string> Keys() const override { return { ".raw" }; }
+	::vm::IEverything *Create( const std::string &key ) override
+	{
+		if ( key == ".raw" ) {
+			return VM_NEW<vm::RawFilePlugin>();
+		}
+		return nullptr;
+	}
+};
+
+VM_REGISTER_PLUGIN_FACTORY_DECL( RawFilePluginFactory )
+EXPORT_PLUGIN_FACTORY( RawFilePluginFactory )
@@ -0,0 +1,69 @@
+#include <iostream>
+#include <VMUtils/cmdline.hpp>
+#include <VMFoundation/pluginloader.h>
+#include <lvdconverter.h>
+
+int main( int argc, char **argv )
+{
+	cmdline::parser a;
+	a.add<std::string>( "in", 'i', "input raw file", true );
+	a.add<std::string>( "type", '\0', "voxel type of the raw: uint8, uint16 or float", false, "uint8" );
+	a.add<std::string>( "out", 'o', "output lvd file, or the .lvds manifest of a sharded lvd", true );
+	a.add<int>( "x", 'x', "width of the raw", true );
+	a.add<int>( "y", 'y', "height of the raw", true );
+	a.add<int>( "z", 'z', "depth of the raw", true );
+	a.add<int>( "log", 'l', "block side in log, 5 to 7", false, 6 );
+	a.add<int>( "padding", 'p', "padding (ghost voxels) of a block", false, 2 );
+	a.add<int>( "threads", 't', "worker threads, 0 means the hardware concurrency", false, 0 );
+	a.add<size_t>( "mem", '\0', "memory budget of the raw slabs in MB", false, 4096 );
+	a.add( "dense", '\0', "store all-zero blocks" );
+	a.add( "aligned", '\0', "align every block to 4 KiB for O_DIRECT reads" );
+	a.add( "morton", '\0', "store the blocks in Morton (Z-order) instead of x fastest" );
+	a.add( "dedup", '\0', "store equal blocks once" );
+	a.add<int>( "shards", '\0', "number of data files of a sharded lvd", false, 1 );
+	a.add<std::string>( "striping", '\0', "striping of the shards: round-robin or morton-range", false, "round-robin" );
+	a.add<int>( "flush", '\0', "interval of the background flush in ms, 0 only flushes at the end", false, 0 );
+	a.add<std::string>( "pd", '\0', "specifies plugin load directoy", false, "plugins" );
+	a.parse_check( argc, argv );
+
+	vm::PluginLoader::LoadPlugins( a.get<std::string>( "pd" ) );
+
+	vm::LVDConvertOptions options;
+	options.rawFileName = a.get<std::string>( "in" );
+	options.lvdFileName = a.get<std::string>( "out" );
+	options.dataSize = vm::Vec3i( a.get<int>( "x" ), a.get<int>( "y" ), a.get<int>( "z" ) );
+	options.blockSideInLog = a.get<int>( "log" );
+	options.padding = a.get<int>( "padding" );
+	options.threadCount = a.get<int>( "threads" );
+	options.memoryBudget = a.get<size_t>( "mem" ) * 1024 * 1024;
+	options.flags = ( a.exist( "dense" ) ? 0 : LVD_FLAG_SPARSE ) | ( a.exist( "aligned" ) ? LVD_FLAG_ALIGNED : 0 ) |
+					( a.exist( "morton" ) ? LVD_FLAG_MORTON : 0 ) | ( a.exist( "dedup" ) ? LVD_FLAG_DEDUP : 0 );
+	options.flushInterval = a.get<int>( "flush" );
+	options.shardCount = a.get<int>( "shards" );
+	const auto striping = a.get<std::string>( "striping" );
+	if ( striping == "morton-range" ) {
+		options.striping = vm::LVD_STRIPING_MORTON_RANGE;
+	} else if ( striping != "round-robin" ) {
+		std::cout << "Unknown striping " << striping << std::endl;
+		return 1;
+	}
+	if ( options.shardCount > 1 && vm::LVDShardedFile::IsManifest( options.lvdFileName ) == false ) {
+		std::cout << "The output of a sharded lvd must be a .lvds manifest" << std::endl;
+		return 1;
+	}
+	const auto type = a.get<std::string>( "type" );
+	if ( type == "uint16" ) {
+		options.voxelType = vm::LVD_VOXEL_UINT16;
+	} else if ( type == "float" ) {
+		options.voxelType = vm::LVD_VOXEL_FLOAT32;
+	} else if ( type != "uint8" ) {
+		std::cout << "Unknown voxel type " << type << std::endl;
+		return 1;
+	}
+
+	if ( vm::ConvertRawToLVD( options ) == false ) {
+		std::cout << "Failed to convert " << options.rawFileName << std::endl;
+		return 1;
+	}
+	return 0;
+}
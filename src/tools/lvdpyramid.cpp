@@ -0,0 +1,54 @@
+#include <iostream>
+#include <VMUtils/cmdline.hpp>
+#include <VMFoundation/pluginloader.h>
+#include <lvdpyramid.h>
+
+int main( int argc, char **argv )
+{
+	cmdline::parser a;
+	a.add<std::string>( "in", 'i', "level 0 lvd file", true );
+	a.add<std::string>( "out", 'o', "output prefix of the levels and the .lods manifest", true );
+	a.add<int>( "levels", 'n', "coarser levels to build, 0 builds until a level fits in one block", false, 0 );
+	a.add<std::string>( "filter", 'f', "downsampling filter: box, max or minmax", false, "box" );
+	a.add<int>( "threads", 't', "worker threads, 0 means the hardware concurrency", false, 0 );
+	a.add<float>( "rate", 'r', "sampling rate written to the manifest", false, 0.001f );
+	a.add<float>( "spacing", 's', "voxel spacing written to the manifest", false, 1.0f );
+	a.add( "aligned", '\0', "align every block to 4 KiB for O_DIRECT reads" );
+	a.add( "morton", '\0', "store the blocks in Morton (Z-order) instead of x fastest" );
+	a.add<std::string>( "pd", '\0', "specifies plugin load directoy", false, "plugins" );
+	a.parse_check( argc, argv );
+
+	vm::PluginLoader::LoadPlugins( a.get<std::string>( "pd" ) );
+
+	vm::LVDPyramidOptions options;
+	options.lvdFileName = a.get<std::string>( "in" );
+	options.outputPrefix = a.get<std::string>( "out" );
+	options.levels = a.get<int>( "levels" );
+	options.threadCount = a.get<int>( "threads" );
+	options.samplingRate = a.get<float>( "rate" );
+	if ( a.exist( "aligned" ) ) {
+		options.flags |= LVD_FLAG_ALIGNED;
+	}
+	if ( a.exist( "morton" ) ) {
+		options.flags |= LVD_FLAG_MORTON;
+	}
+	const auto spacing = a.get<float>( "spacing" );
+	options.spacing = { spacing, spacing, spacing };
+	const auto filter = a.get<std::string>( "filter" );
+	if ( filter == "max" ) {
+		options.filter = vm::LVD_FILTER_MAX;
+	} else if ( filter == "minmax" ) {
+		options.filter = vm::LVD_FILTER_MIN_MAX;
+	} else if ( filter != "box" ) {
+		std::cout << "Unknown filter " << filter << std::endl;
+		return 1;
+	}
+
+	const auto fileNames = vm::BuildLVDPyramid( options );
+	if ( fileNames.empty() ) {
+		std::cout << "Failed to build the levels of " << options.lvdFileName << std::endl;
+		return 1;
+	}
+	std::cout << fileNames.size() << " levels written to " << options.outputPrefix << ".lods" << std::endl;
+	return 0;
+}
@@ -1,10 +1,17 @@
 #include <gtest/gtest.h>
 #include <random>
+#include <set>
 #include <fstream>
 #include <sstream>
 
 #include <lvdfile.h>
+#include <lvdcodec.h>
+#include <lvdconverter.h>
+#include <lvdpyramid.h>
+#include <lvdpagereader.h>
+#include <lvdshardedfile.h>
 #include <jsondef.hpp>
+#include <ilvdfileplugininterface.hpp>
 #include <VMUtils/vmnew.hpp>
 #include <VMat/numeric.h>
 
@@ -274,3 +281,1184 @@ TEST( test, test_cachewrite_abcflow )
 TEST( test_lvdwr, basic )
 {
 }
+
+TEST( test_lvdwr, multi_lod_container )
+{
+	using namespace vm;
+	const char *fileName = "test_multi_lod.lvd";
+	const int blockSideInLog = 5;
+	const int padding = 1;
+	const std::vector<Vec3i> lodDataSize{ { 100, 90, 80 }, { 50, 45, 40 }, { 25, 23, 20 } };
+	auto value = []( int lod, int blockId ) { return char( lod * 16 + blockId % 16 ); };
+
+	{
+		LVDFile writer( fileName, blockSideInLog, lodDataSize, padding );
+		ASSERT_TRUE( writer.Valid() );
+		ASSERT_EQ( writer.LODCount(), lodDataSize.size() );
+		std::vector<char> block( writer.BlockDataCount() );
+		for ( int lod = 0; lod < writer.LODCount(); lod++ ) {
+			for ( std::size_t i = 0; i < writer.BlockCount( lod ); i++ ) {
+				memset( block.data(), value( lod, i ), block.size() );
+				writer.WriteBlock( block.data(), i, lod );
+			}
+		}
+		writer.Close();
+	}
+
+	PluginLoader::LoadPlugins( "plugins" );
+	Ref<I3DBlockFilePluginInterface> p = PluginLoader::GetPluginLoader()->CreatePlugin<I3DBlockFilePluginInterface>( ".lvd" );
+	ASSERT_TRUE( p != nullptr );
+	auto lvd = dynamic_cast<ILVDFilePluginInterface *>( p.Get() );
+	ASSERT_TRUE( lvd != nullptr );
+	p->Open( fileName );
+	ASSERT_EQ( lvd->GetLODCount(), lodDataSize.size() );
+
+	const size_t blockBytes = size_t( 1 ) << ( 3 * blockSideInLog );
+	for ( int lod = 0; lod < lvd->GetLODCount(); lod++ ) {
+		auto view = lvd->GetLODView( lod );
+		ASSERT_TRUE( view != nullptr );
+		const auto size = view->GetDataSizeWithoutPadding();
+		ASSERT_EQ( size.x, lodDataSize[ lod ].x );
+		ASSERT_EQ( size.y, lodDataSize[ lod ].y );
+		ASSERT_EQ( size.z, lodDataSize[ lod ].z );
+		for ( std::size_t i = 0; i < view->GetVirtualPageCount(); i++ ) {
+			auto page = (const char *)view->GetPage( i );
+			ASSERT_EQ( memcmp( page, lvd->GetPage( i, lod ), blockBytes ), 0 );
+			ASSERT_EQ( page[ 0 ], value( lod, i ) );
+			ASSERT_EQ( page[ blockBytes - 1 ], value( lod, i ) );
+		}
+	}
+}
+
+TEST( test_lvdwr, codec_roundtrip )
+{
+	using namespace vm;
+	const size_t count = 32 * 32 * 32;
+	std::default_random_engine e;
+	std::uniform_int_distribution<int> u( 0, 255 );
+	std::vector<unsigned char> constant( count, 42 ), noise( count ), smooth( count );
+	for ( size_t i = 0; i < count; i++ ) {
+		noise[ i ] = u( e );
+		smooth[ i ] = (unsigned char)( 128 + 100 * std::sin( i * 0.01 ) );
+	}
+
+	std::vector<unsigned char> encoded, decoded( count );
+	for ( const auto *data : { &constant, &noise, &smooth } ) {
+		const auto codec = LVDCodec::Encode( data->data(), count, encoded );
+		ASSERT_LE( encoded.size(), count );
+		ASSERT_TRUE( LVDCodec::Decode( codec, encoded.data(), encoded.size(), decoded.data(), count ) );
+		ASSERT_EQ( decoded, *data );
+	}
+	ASSERT_NE( LVDCodec::Encode( smooth.data(), count, encoded ), LVD_CODEC_RAW );
+	ASSERT_LT( encoded.size(), count / 2 );
+	ASSERT_EQ( LVDCodec::Encode( noise.data(), count, encoded ), LVD_CODEC_RAW );
+	ASSERT_FALSE( LVDCodec::Decode( LVD_CODEC_RLE, encoded.data(), 7, decoded.data(), count ) );
+}
+
+TEST( test_lvdwr, v2_compressed_and_v1_compat )
+{
+	using namespace vm;
+	const Vec3i dataSize{ 120, 120, 120 };
+	const int blockSideInLog = 5;
+	for ( int version : { LVD_VERSION_1, LVD_VERSION_2 } ) {
+		const std::string fileName = "test_v" + std::to_string( version ) + ".lvd";
+		std::vector<std::vector<char>> blocks;
+		{
+			LVDFile writer( fileName, blockSideInLog, dataSize, 1, version );
+			ASSERT_TRUE( writer.Valid() );
+			std::vector<char> block( writer.BlockDataCount() );
+			for ( std::size_t i = 0; i < writer.BlockCount(); i++ ) {
+				for ( size_t j = 0; j < block.size(); j++ ) {
+					block[ j ] = char( ( i + j / 64 ) % 7 );
+				}
+				writer.WriteBlock( block.data(), i );
+				blocks.push_back( block );
+			}
+			// rewriting a block keeps the other ones
+			std::fill( blocks[ 3 ].begin(), blocks[ 3 ].end(), char( 9 ) );
+			writer.WriteBlock( blocks[ 3 ].data(), 3 );
+			writer.Close();
+		}
+
+		LVDFile reader( fileName, true );
+		ASSERT_TRUE( reader.Valid() );
+		ASSERT_EQ( reader.Version(), version );
+		std::vector<char> block( reader.BlockDataCount() );
+		for ( std::size_t i = 0; i < reader.BlockCount(); i++ ) {
+			reader.ReadBlock( block.data(), i );
+			ASSERT_EQ( block, blocks[ i ] );
+		}
+
+		std::ifstream in( fileName, std::ios::binary | std::ios::ate );
+		const size_t rawBytes = blocks.size() * block.size();
+		if ( version == LVD_VERSION_2 ) {
+			ASSERT_LT( size_t( in.tellg() ), rawBytes / 4 );
+		} else {
+			ASSERT_EQ( size_t( in.tellg() ), rawBytes + LVD_HEADER_SIZE );
+		}
+	}
+
+	// a closed v2 file opened for writing again takes blocks that no longer fit in their extents
+	const std::string fileName = "test_v2_reopen.lvd";
+	std::default_random_engine e;
+	std::uniform_int_distribution<int> u( 0, 255 );
+	std::vector<char> constant( 32 * 32 * 32, char( 7 ) ), noise( constant.size() );
+	for ( auto &v : noise ) {
+		v = char( u( e ) );
+	}
+	{
+		LVDFile writer( fileName, blockSideInLog, dataSize, 1, LVD_VERSION_2, 0 );
+		ASSERT_TRUE( writer.Valid() );
+		for ( std::size_t i = 0; i < writer.BlockCount(); i++ ) {
+			writer.WriteBlock( constant.data(), i );
+		}
+	}
+	// opened writable but only read, the file is not touched
+	auto contents = [ &fileName ]() {
+		std::ifstream in( fileName, std::ios::binary );
+		return std::vector<char>( std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() );
+	};
+	const auto written = contents();
+	{
+		LVDFile writer( fileName );
+		ASSERT_TRUE( writer.Valid() );
+		std::vector<char> block( writer.BlockDataCount() );
+		writer.ReadBlock( block.data(), 0 );
+		ASSERT_EQ( block, constant );
+	}
+	ASSERT_EQ( contents(), written );
+	{
+		LVDFile writer( fileName );
+		ASSERT_TRUE( writer.Valid() );
+		for ( std::size_t i = 0; i < writer.BlockCount(); i += 5 ) {
+			writer.WriteBlock( noise.data(), i );
+		}
+	}
+	LVDFile reader( fileName, true );
+	ASSERT_TRUE( reader.Valid() );
+	std::vector<char> block( reader.BlockDataCount() );
+	for ( std::size_t i = 0; i < reader.BlockCount(); i++ ) {
+		reader.ReadBlock( block.data(), i );
+		ASSERT_EQ( block, i % 5 ? constant : noise );
+	}
+	std::ifstream in( fileName, std::ios::binary | std::ios::ate );
+	ASSERT_LT( size_t( in.tellg() ), reader.BlockCount() * block.size() / 2 );  // trimmed again
+}
+
+TEST( test_lvdwr, sparse )
+{
+	using namespace vm;
+	const char *fileName = "test_sparse.lvd";
+	const Vec3i dataSize{ 300, 300, 300 };
+	const int blockSideInLog = 5;
+	auto occupied = []( int blockId ) { return blockId % 5 == 1; };
+	std::size_t blockBytes = 0, blockCount = 0;
+	{
+		LVDFile writer( fileName, blockSideInLog, dataSize, 1, LVD_VERSION_2, LVD_FLAG_SPARSE );
+		ASSERT_TRUE( writer.Valid() );
+		blockBytes = writer.BlockDataCount();
+		blockCount = writer.BlockCount();
+		std::vector<char> block( blockBytes );
+		std::default_random_engine e;
+		std::uniform_int_distribution<int> u( 0, 255 );
+		for ( std::size_t i = 0; i < blockCount; i++ ) {
+			for ( auto &v : block ) {
+				v = occupied( i ) ? u( e ) : 0;
+			}
+			writer.WriteBlock( block.data(), i );
+		}
+		ASSERT_EQ( writer.OccupiedBlockCount(), ( blockCount + 3 ) / 5 );
+		writer.Close();
+	}
+	const std::size_t occupiedCount = ( blockCount + 3 ) / 5;
+	{
+		std::ifstream in( fileName, std::ios::binary | std::ios::ate );
+		// the payload of the occupied blocks and the per-block index and stats
+		ASSERT_LT( size_t( in.tellg() ), occupiedCount * blockBytes + blockCount * 128 + 8192 );
+	}
+
+	PluginLoader::LoadPlugins( "plugins" );
+	Ref<I3DBlockFilePluginInterface> p = PluginLoader::GetPluginLoader()->CreatePlugin<I3DBlockFilePluginInterface>( ".lvd" );
+	ASSERT_TRUE( p != nullptr );
+	p->Open( fileName );
+	LVDFile reader( fileName );
+	ASSERT_TRUE( reader.GetHeader().flags & LVD_FLAG_SPARSE );
+	ASSERT_EQ( reader.OccupiedBlockCount(), occupiedCount );
+
+	const void *zeroPage = nullptr;
+	std::vector<char> block( blockBytes );
+	for ( std::size_t i = 0; i < blockCount; i++ ) {
+		auto page = (const char *)p->GetPage( i );
+		reader.ReadBlock( block.data(), i );
+		ASSERT_EQ( memcmp( page, block.data(), blockBytes ), 0 );
+		ASSERT_EQ( reader.BlockOccupied( i ), occupied( i ) );
+		if ( occupied( i ) == false ) {
+			ASSERT_EQ( page[ 0 ], 0 );
+			zeroPage = zeroPage ? zeroPage : page;
+			ASSERT_EQ( page, zeroPage );
+		}
+	}
+
+	const auto &index = reader.Occupancy();
+	ASSERT_TRUE( index.Valid() );
+	for ( size_t slot = 0; slot < occupiedCount; slot++ ) {
+		ASSERT_EQ( index.Select( slot ), slot * 5 + 1 );
+		ASSERT_EQ( index.Rank( slot * 5 + 1 ), slot );
+	}
+
+	// the occupancy of a closed sparse level is fixed, the stored blocks are still rewritten in place
+	std::fill( block.begin(), block.end(), char( 3 ) );
+	ASSERT_THROW( reader.WriteBlock( block.data(), 0 ), std::runtime_error );
+	reader.WriteBlock( block.data(), 1 );
+	std::fill( block.begin(), block.end(), char( 0 ) );
+	ASSERT_THROW( reader.WriteBlock( block.data(), 6 ), std::runtime_error );
+	ASSERT_TRUE( reader.BlockOccupied( 6 ) );
+	ASSERT_TRUE( reader.Flush( blockCount - 1 ) );	// absent, past the end of the compacted table
+
+	// sparse is opt-in, zero blocks of other files are stored and could be written over later
+	{
+		LVDFile dense( "test_dense.lvd", blockSideInLog, Vec3i{ 60, 60, 60 }, 1 );
+		ASSERT_TRUE( dense.Valid() );
+		for ( std::size_t i = 0; i < dense.BlockCount(); i++ ) {
+			dense.WriteBlock( block.data(), i );
+		}
+	}
+	LVDFile dense( "test_dense.lvd" );
+	ASSERT_FALSE( dense.GetHeader().flags & LVD_FLAG_SPARSE );
+	ASSERT_EQ( dense.OccupiedBlockCount(), dense.BlockCount() );
+	std::fill( block.begin(), block.end(), char( 3 ) );
+	dense.WriteBlock( block.data(), 0 );
+	dense.ReadBlock( block.data(), 0 );
+	ASSERT_EQ( block[ 0 ], char( 3 ) );
+
+	// the blocks never written to a dense level share the first of them as their instance
+	{
+		LVDFile partial( "test_dense_partial.lvd", blockSideInLog, Vec3i{ 60, 60, 60 }, 1 );
+		for ( std::size_t i = 0; i < partial.BlockCount(); i++ ) {
+			if ( i != 3 && i != 5 ) {
+				partial.WriteBlock( block.data(), i );
+			}
+		}
+	}
+	LVDFile partial( "test_dense_partial.lvd", true );
+	ASSERT_EQ( partial.BlockInstance( 2 ), 2 );
+	ASSERT_EQ( partial.BlockInstance( 5 ), 3 );
+	ASSERT_EQ( partial.BlockInstance( 3 ), 3 );
+}
+
+TEST( test_lvdwr, block_stats )
+{
+	using namespace vm;
+	const char *fileName = "test_block_stats.lvd";
+	const int blockSideInLog = 5;
+	std::size_t blockCount = 0;
+	{
+		LVDFile writer( fileName, blockSideInLog, Vec3i{ 60, 60, 60 }, 1 );
+		std::vector<char> block( writer.BlockDataCount() );
+		blockCount = writer.BlockCount();
+		for ( std::size_t i = 0; i < blockCount; i++ ) {
+			// half of the voxels are i, the other half are 100 + i
+			for ( size_t j = 0; j < block.size(); j++ ) {
+				block[ j ] = char( j % 2 ? 100 + i : i );
+			}
+			writer.WriteBlock( block.data(), i );
+		}
+		writer.Close();
+	}
+
+	PluginLoader::LoadPlugins( "plugins" );
+	Ref<I3DBlockFilePluginInterface> p = PluginLoader::GetPluginLoader()->CreatePlugin<I3DBlockFilePluginInterface>( ".lvd" );
+	auto lvd = dynamic_cast<ILVDFilePluginInterface *>( p.Get() );
+	ASSERT_TRUE( lvd != nullptr );
+	p->Open( fileName );
+	for ( std::size_t i = 0; i < blockCount; i++ ) {
+		const auto stats = lvd->GetPageStats( i, 0 );
+		ASSERT_TRUE( stats != nullptr );
+		ASSERT_EQ( stats->min, i );
+		ASSERT_EQ( stats->max, 100 + i );
+		ASSERT_FLOAT_EQ( stats->mean, 50 + i );
+		int total = 0;
+		for ( auto h : stats->histogram ) total += h;
+		ASSERT_NEAR( total, 65535, LVD_STATS_HISTOGRAM_BINS );
+		ASSERT_NEAR( stats->histogram[ i / 16 ], 65535 / 2, 1 );
+	}
+}
+
+TEST( test_lvdwr, raw_to_lvd )
+{
+	using namespace vm;
+	const Vec3i dataSize{ 150, 130, 170 };
+	const char *rawFileName = "test_convert.raw";
+	std::vector<unsigned char> raw( std::size_t( dataSize.x ) * dataSize.y * dataSize.z );
+	for ( int z = 0; z < dataSize.z; z++ )
+		for ( int y = 0; y < dataSize.y; y++ )
+			for ( int x = 0; x < dataSize.x; x++ )
+				raw[ ( std::size_t( z ) * dataSize.y + y ) * dataSize.x + x ] = x < 40 ? 0 : ( x + 3 * y + 7 * z ) % 251 + 1;
+	{
+		std::ofstream out( rawFileName, std::ios::binary );
+		out.write( (const char *)raw.data(), raw.size() );
+	}
+
+	LVDConvertOptions options;
+	options.rawFileName = rawFileName;
+	options.lvdFileName = "test_convert.lvd";
+	options.dataSize = dataSize;
+	options.blockSideInLog = 5;
+	options.padding = 2;
+	options.threadCount = 4;
+	ASSERT_TRUE( ConvertRawToLVD( options ) );
+
+	LVDFile lvd( options.lvdFileName );
+	ASSERT_TRUE( lvd.Valid() );
+	const int blockSide = lvd.BlockSize(), step = blockSide - 2 * options.padding;
+	const auto blockDim = lvd.SizeByBlock();
+	std::vector<unsigned char> block( lvd.BlockDataCount() );
+	for ( std::size_t i = 0; i < lvd.BlockCount(); i++ ) {
+		lvd.ReadBlock( (char *)block.data(), i );
+		const auto b = Dim( i, { blockDim.x, blockDim.y } );
+		for ( int z = 0; z < blockSide; z++ )
+			for ( int y = 0; y < blockSide; y++ )
+				for ( int x = 0; x < blockSide; x++ ) {
+					const int gx = b.x * step - options.padding + x, gy = b.y * step - options.padding + y, gz = b.z * step - options.padding + z;
+					const bool inside = gx >= 0 && gy >= 0 && gz >= 0 && gx < dataSize.x && gy < dataSize.y && gz < dataSize.z;
+					const auto expected = inside ? raw[ ( std::size_t( gz ) * dataSize.y + gy ) * dataSize.x + gx ] : 0;
+					ASSERT_EQ( block[ ( std::size_t( z ) * blockSide + y ) * blockSide + x ], expected );
+				}
+	}
+	ASSERT_LT( lvd.OccupiedBlockCount(), lvd.BlockCount() );
+}
+
+TEST( test_lvdwr, lod_pyramid )
+{
+	using namespace vm;
+	const Vec3i dataSize{ 101, 70, 64 };
+	const int blockSideInLog = 5, padding = 1, step = ( 1 << blockSideInLog ) - 2 * padding;
+	auto value = []( int x, int y, int z ) { return (unsigned char)( x > 80 ? 0 : ( x * 2 + y + z ) % 200 ); };
+	{
+		LVDFile writer( "test_pyramid.lvd", blockSideInLog, dataSize, padding );
+		const int blockSide = writer.BlockSize();
+		const auto blockDim = writer.SizeByBlock();
+		std::vector<unsigned char> block( writer.BlockDataCount() );
+		for ( std::size_t i = 0; i < writer.BlockCount(); i++ ) {
+			const auto b = Dim( i, { blockDim.x, blockDim.y } );
+			for ( int z = 0; z < blockSide; z++ )
+				for ( int y = 0; y < blockSide; y++ )
+					for ( int x = 0; x < blockSide; x++ ) {
+						const int gx = b.x * step - padding + x, gy = b.y * step - padding + y, gz = b.z * step - padding + z;
+						const bool inside = gx >= 0 && gy >= 0 && gz >= 0 && gx < dataSize.x && gy < dataSize.y && gz < dataSize.z;
+						block[ ( z * blockSide + y ) * blockSide + x ] = inside ? value( gx, gy, gz ) : 0;
+					}
+			writer.WriteBlock( (const char *)block.data(), i );
+		}
+	}
+
+	LVDPyramidOptions options;
+	options.lvdFileName = "test_pyramid.lvd";
+	options.outputPrefix = "test_pyramid";
+	options.levels = 2;
+	options.filter = LVD_FILTER_MAX;
+	options.threadCount = 3;
+	const auto fileNames = BuildLVDPyramid( options );
+	ASSERT_EQ( fileNames.size(), 3 );
+	ASSERT_TRUE( std::ifstream( "test_pyramid.lods" ).is_open() );
+
+	LVDFile lod1( fileNames[ 1 ] );
+	ASSERT_TRUE( lod1.Valid() );
+	ASSERT_EQ( lod1.OriginalDataSize().x, 51 );
+	ASSERT_EQ( lod1.OriginalDataSize().y, 35 );
+	ASSERT_EQ( lod1.OriginalDataSize().z, 32 );
+	const int blockSide = lod1.BlockSize();
+	const auto blockDim = lod1.SizeByBlock();
+	std::vector<unsigned char> block( lod1.BlockDataCount() );
+	for ( std::size_t i = 0; i < lod1.BlockCount(); i++ ) {
+		lod1.ReadBlock( (char *)block.data(), i );
+		const auto b = Dim( i, { blockDim.x, blockDim.y } );
+		for ( int z = padding; z < blockSide - padding; z++ )
+			for ( int y = padding; y < blockSide - padding; y++ )
+				for ( int x = padding; x < blockSide - padding; x++ ) {
+					const int cx = b.x * step - padding + x, cy = b.y * step - padding + y, cz = b.z * step - padding + z;
+					if ( cx >= 51 || cy >= 35 || cz >= 32 ) continue;
+					unsigned char expected = 0;
+					for ( int k = 0; k < 8; k++ ) {
+						const int fx = ( std::min )( 2 * cx + ( k & 1 ), dataSize.x - 1 );
+						const int fy = ( std::min )( 2 * cy + ( k >> 1 & 1 ), dataSize.y - 1 );
+						expected = ( std::max )( expected, value( fx, fy, 2 * cz + ( k >> 2 ) ) );
+					}
+					ASSERT_EQ( block[ ( z * blockSide + y ) * blockSide + x ], expected );
+				}
+	}
+	LVDFile lod2( fileNames[ 2 ] );
+	ASSERT_EQ( lod2.OriginalDataSize().x, 26 );
+}
+
+TEST( test_lvdwr, dirty_flush )
+{
+	using namespace vm;
+	for ( int version : { LVD_VERSION_1, LVD_VERSION_2 } ) {
+		LVDFile writer( "test_dirty_flush.lvd", 5, Vec3i{ 200, 200, 100 }, 1, version );
+		std::vector<char> block( writer.BlockDataCount(), 7 );
+		for ( std::size_t i = 0; i < writer.BlockCount(); i += 2 ) {
+			writer.WriteBlock( block.data(), i );
+		}
+		ASSERT_EQ( writer.DirtyBlockCount(), ( writer.BlockCount() + 1 ) / 2 );
+		ASSERT_TRUE( writer.Flush() );
+		ASSERT_EQ( writer.DirtyBlockCount(), 0 );
+
+		writer.StartBackgroundFlush( std::chrono::milliseconds( 5 ) );
+		for ( std::size_t i = 1; i < writer.BlockCount(); i += 2 ) {
+			writer.WriteBlock( block.data(), i );
+		}
+		for ( int retry = 0; retry < 200 && writer.DirtyBlockCount(); retry++ ) {
+			std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+		}
+		ASSERT_EQ( writer.DirtyBlockCount(), 0 );
+		writer.Close();
+
+		LVDFile reader( "test_dirty_flush.lvd" );
+		std::vector<char> read( reader.BlockDataCount() );
+		reader.ReadBlock( read.data(), reader.BlockCount() - 1 );
+		ASSERT_EQ( read, block );
+	}
+}
+
+TEST( test_lvdwr, read_only_prefetch )
+{
+	using namespace vm;
+	const char *fileName = "test_read_only.lvd";
+	{
+		LVDFile writer( fileName, 5, Vec3i{ 100, 100, 100 }, 1 );
+		std::vector<char> block( writer.BlockDataCount() );
+		for ( std::size_t i = 0; i < writer.BlockCount(); i++ ) {
+			for ( size_t j = 0; j < block.size(); j++ ) block[ j ] = char( i * 7 + j % 13 );
+			writer.WriteBlock( block.data(), i );
+		}
+	}
+
+	PluginLoader::LoadPlugins( "plugins" );
+	Ref<I3DBlockFilePluginInterface> p = PluginLoader::GetPluginLoader()->CreatePlugin<I3DBlockFilePluginInterface>( ".lvd" );
+	auto lvd = dynamic_cast<ILVDFilePluginInterface *>( p.Get() );
+	ASSERT_TRUE( lvd != nullptr );
+	lvd->SetReadOnly( true );
+	p->Open( fileName );
+	auto view = lvd->GetLODView( 0 );
+	ASSERT_EQ( dynamic_cast<ILVDFilePluginInterface *>( view.Get() )->GetLOD(), 0 );
+
+	std::vector<size_t> ids( p->GetVirtualPageCount() );
+	for ( size_t i = 0; i < ids.size(); i++ ) ids[ i ] = i;
+	lvd->Prefetch( ids, 0 );
+	const size_t blockBytes = size_t( 1 ) << 15;
+	for ( size_t i = 0; i < ids.size(); i++ ) {
+		auto page = (const char *)p->GetPage( i );
+		ASSERT_EQ( page[ 100 ], char( i * 7 + 100 % 13 ) );
+	}
+	lvd->Evict( ids, 0 );
+	ASSERT_EQ( ( (const char *)p->GetPage( 3 ) )[ blockBytes - 1 ], char( 3 * 7 + ( blockBytes - 1 ) % 13 ) );
+
+	std::vector<char> block( blockBytes );
+	ASSERT_THROW( p->Write( block.data(), 0, false ), std::runtime_error );
+}
+
+TEST( test_lvdwr, batched_pages )
+{
+	using namespace vm;
+	const char *fileName = "test_batched_pages.lvd";
+	for ( int version : { LVD_VERSION_1, LVD_VERSION_2 } ) {
+		{
+			LVDFile writer( fileName, 5, Vec3i{ 150, 100, 100 }, 1, version );
+			std::vector<char> block( writer.BlockDataCount() );
+			for ( std::size_t i = 0; i < writer.BlockCount(); i++ ) {
+				for ( size_t j = 0; j < block.size(); j++ ) {
+					// absent, constant (compressed) and noisy (raw) blocks
+					block[ j ] = i % 3 == 0 ? 0 : i % 3 == 1 ? char( i ) : char( ( i * 31 + j * 2654435761u ) >> 7 );
+				}
+				writer.WriteBlock( block.data(), i );
+			}
+		}
+		auto file = std::make_shared<LVDFile>( fileName, true );
+		const size_t blockBytes = file->BlockDataCount();
+		const int count = file->BlockCount();
+		for ( auto mode : { LVD_PAGE_IO_PREAD, LVD_PAGE_IO_MMAP, LVD_PAGE_IO_URING, LVD_PAGE_IO_URING_DIRECT } ) {
+			LVDPageReader reader( file, mode, 4 );
+			if ( mode == LVD_PAGE_IO_URING || mode == LVD_PAGE_IO_URING_DIRECT ) {
+				ASSERT_EQ( reader.Mode(), LVDIOUring::Supported() ? mode : LVD_PAGE_IO_MMAP );
+			}
+			std::vector<unsigned char> staging( count * blockBytes, 0xff );
+			std::vector<LVDPageRequest> requests( count );
+			for ( int i = 0; i < count; i++ ) {
+				requests[ i ].pageID = count - 1 - i;  // out of order, the reader sorts them by offset
+				requests[ i ].buffer = staging.data() + i * blockBytes;
+			}
+			reader.Submit( requests );
+			std::vector<LVDPageRequest> done;
+			while ( done.size() < requests.size() ) {
+				ASSERT_GT( reader.Collect( done, 1 ), 0 );
+			}
+			ASSERT_EQ( reader.Collect( done, 1 ), 0 );
+
+			std::vector<char> expected( blockBytes );
+			for ( const auto &r : done ) {
+				ASSERT_TRUE( r.ok );
+				file->ReadBlock( expected.data(), int( r.pageID ) );
+				ASSERT_EQ( memcmp( r.buffer, expected.data(), blockBytes ), 0 ) << "block " << r.pageID;
+			}
+		}
+	}
+}
+
+TEST( test_lvdwr, direct_io )
+{
+	using namespace vm;
+	const char *fileName = "test_direct_io.lvd";
+	for ( int version : { LVD_VERSION_1, LVD_VERSION_2 } ) {
+		{
+			LVDFile writer( fileName, 5, Vec3i{ 100, 100, 60 }, 1, version, LVD_FLAG_SPARSE | LVD_FLAG_ALIGNED );
+			std::vector<char> block( writer.BlockDataCount() );
+			for ( std::size_t i = 0; i < writer.BlockCount(); i++ ) {
+				for ( size_t j = 0; j < block.size(); j++ ) {
+					block[ j ] = i % 3 == 0 ? 0 : i % 3 == 1 ? char( j / 1000 ) : char( ( i * 31 + j * 2654435761u ) >> 7 );
+				}
+				writer.WriteBlock( block.data(), i );
+			}
+		}
+		LVDFile mapped( fileName, true );
+		LVDFile direct( fileName, true );
+		if ( version >= LVD_VERSION_2 ) {
+			for ( std::size_t i = 0; i < mapped.BlockCount(); i++ ) {
+				ASSERT_EQ( mapped.LocateBlock( i ).offset % LVD_BLOCK_ALIGNMENT, 0 );
+			}
+		}
+		ASSERT_FALSE( LVDFile( fileName ).SetDirectIO( true ) );  // writable
+		if ( direct.SetDirectIO( true ) == false ) {
+			continue;  // no direct I/O on this file system
+		}
+		ASSERT_EQ( direct.ReadBlock( 1 ), nullptr );
+		std::vector<char> expected( mapped.BlockDataCount() ), read( mapped.BlockDataCount() );
+		for ( std::size_t i = 0; i < mapped.BlockCount(); i++ ) {
+			mapped.ReadBlock( expected.data(), i );
+			direct.ReadBlock( read.data(), i );
+			ASSERT_EQ( read, expected ) << "block " << i;
+		}
+		// the region is read through a page reader in batches of 2 * 4 blocks
+		const Bound3i bound( Point3i( 7, 30, 1 ), Point3i( 95, 71, 59 ) );
+		std::vector<char> region( 88 * 41 * 58 ), regionExpected( region.size() );
+		ASSERT_TRUE( mapped.ReadRegion( bound, 0, regionExpected.data() ) );
+		ASSERT_TRUE( direct.ReadRegion( bound, 0, region.data(), 0, 0, 2 ) );
+		ASSERT_EQ( region, regionExpected );
+		// the next read goes through the same page reader
+		std::fill( region.begin(), region.end(), char( 0 ) );
+		ASSERT_TRUE( direct.ReadRegion( bound, 0, region.data() ) );
+		ASSERT_EQ( region, regionExpected );
+	}
+}
+
+TEST( test_lvdwr, voxel_types )
+{
+	using namespace vm;
+	const char *fileName = "test_voxel_types.lvd";
+	ASSERT_FALSE( LVDFile( fileName, 5, Vec3i{ 40, 40, 40 }, 1, LVD_VERSION_1, 0, LVD_VOXEL_UINT16 ).Valid() );  // v1 has no voxel type
+	{
+		LVDFile writer( fileName, 5, Vec3i{ 40, 40, 40 }, 1, LVD_VERSION_2, LVD_FLAG_SPARSE, LVD_VOXEL_UINT16 );
+		ASSERT_TRUE( writer.Valid() );
+		ASSERT_EQ( writer.BlockBytes(), writer.BlockDataCount() * 2 );
+		std::vector<uint16_t> block( writer.BlockDataCount() );
+		for ( std::size_t i = 0; i < writer.BlockCount(); i++ ) {
+			for ( size_t j = 0; j < block.size(); j++ ) block[ j ] = uint16_t( j % 2 ? 65000 + i : 1000 * i );
+			writer.WriteBlock( (const char *)block.data(), i );
+		}
+	}
+	{
+		LVDFile reader( fileName, true );
+		ASSERT_EQ( reader.VoxelType(), LVD_VOXEL_UINT16 );
+		std::vector<uint16_t> block( reader.BlockDataCount() );
+		for ( std::size_t i = 0; i < reader.BlockCount(); i++ ) {
+			reader.ReadBlock( (char *)block.data(), i );
+			ASSERT_EQ( block[ 0 ], 1000 * i );
+			ASSERT_EQ( block.back(), 65000 + i );
+			const auto stats = reader.BlockStats( i );
+			ASSERT_TRUE( stats != nullptr );
+			ASSERT_EQ( stats->min, 1000 * i );
+			ASSERT_EQ( stats->max, 65000 + i );
+			ASSERT_NEAR( stats->histogram[ 15 ], 65535 / 2, 1 );
+		}
+	}
+	{
+		LVDFile writer( fileName, 5, Vec3i{ 40, 40, 40 }, 1, LVD_VERSION_2, LVD_FLAG_SPARSE, LVD_VOXEL_FLOAT32 );
+		std::vector<float> block( writer.BlockDataCount() );
+		for ( std::size_t i = 0; i < writer.BlockCount(); i++ ) {
+			for ( size_t j = 0; j < block.size(); j++ ) block[ j ] = j % 2 ? 0.75f : 0.125f * i;
+			writer.WriteBlock( (const char *)block.data(), i );
+		}
+	}
+	PluginLoader::LoadPlugins( "plugins" );
+	Ref<I3DBlockFilePluginInterface> p = PluginLoader::GetPluginLoader()->CreatePlugin<I3DBlockFilePluginInterface>( ".lvd" );
+	auto lvd = dynamic_cast<ILVDFilePluginInterface *>( p.Get() );
+	ASSERT_TRUE( lvd != nullptr );
+	p->Open( fileName );
+	ASSERT_EQ( lvd->GetVoxelType( 0 ), LVD_VOXEL_FLOAT32 );
+	for ( int i = 0; i < 4; i++ ) {
+		const auto page = static_cast<const float *>( lvd->GetPage( i, 0 ) );
+		ASSERT_EQ( page[ 0 ], 0.125f * i );
+		ASSERT_EQ( page[ 1 ], 0.75f );
+		const auto stats = lvd->GetPageStats( i, 0 );
+		ASSERT_FLOAT_EQ( stats->min, 0.125f * i );
+		ASSERT_FLOAT_EQ( stats->max, 0.75f );
+		ASSERT_NEAR( stats->histogram[ 12 ], 65535 / 2, 1 );
+	}
+}
+
+TEST( test_lvdwr, morton_order )
+{
+	using namespace vm;
+	ASSERT_EQ( LVDMortonEncode( 1, 0, 0 ), 1 );
+	ASSERT_EQ( LVDMortonEncode( 0, 1, 0 ), 2 );
+	ASSERT_EQ( LVDMortonEncode( 0, 0, 1 ), 4 );
+	ASSERT_EQ( LVDMortonEncode( 3, 3, 3 ), 63 );
+	ASSERT_EQ( LVDMortonEncode( 0x1fffff, 0, 0 ), 0x1249249249249249ULL );
+
+	const Vec3i dataSize{ 150, 130, 100 };
+	const char *rawFileName = "test_morton.raw";
+	std::vector<unsigned char> raw( std::size_t( dataSize.x ) * dataSize.y * dataSize.z );
+	for ( std::size_t i = 0; i < raw.size(); i++ ) {
+		raw[ i ] = i % 150 < 40 ? 0 : ( i * 2654435761u ) >> 13;
+	}
+	{
+		std::ofstream out( rawFileName, std::ios::binary );
+		out.write( (const char *)raw.data(), raw.size() );
+	}
+	LVDConvertOptions options;
+	options.rawFileName = rawFileName;
+	options.dataSize = dataSize;
+	options.blockSideInLog = 5;
+	options.padding = 2;
+	options.threadCount = 1;
+	options.lvdFileName = "test_morton_linear.lvd";
+	ASSERT_TRUE( ConvertRawToLVD( options ) );
+	options.lvdFileName = "test_morton.lvd";
+	options.flags |= LVD_FLAG_MORTON;
+	options.memoryBudget = 1 << 20;	 // cells of 2^3 blocks
+	ASSERT_TRUE( ConvertRawToLVD( options ) );
+
+	LVDFile linear( "test_morton_linear.lvd" ), morton( "test_morton.lvd" );
+	ASSERT_TRUE( morton.MortonOrder() );
+	ASSERT_FALSE( linear.MortonOrder() );
+	ASSERT_EQ( morton.OccupiedBlockCount(), linear.OccupiedBlockCount() );
+	std::vector<char> a( linear.BlockBytes() ), b( morton.BlockBytes() );
+	for ( std::size_t i = 0; i < linear.BlockCount(); i++ ) {
+		linear.ReadBlock( a.data(), i );
+		morton.ReadBlock( b.data(), i );
+		ASSERT_EQ( a, b ) << "block " << i;
+		ASSERT_EQ( morton.BlockOccupied( i ), linear.BlockOccupied( i ) );
+		ASSERT_EQ( morton.BlockStats( i ) != nullptr, linear.BlockStats( i ) != nullptr );
+		if ( linear.BlockStats( i ) ) {
+			ASSERT_EQ( morton.BlockStats( i )->mean, linear.BlockStats( i )->mean );
+		}
+	}
+	// the payload follows the Morton order
+	const auto order = morton.StorageOrder();
+	ASSERT_EQ( order.size(), std::size_t( morton.BlockCount() ) );
+	uint64_t last = 0;
+	for ( const auto id : order ) {
+		const auto location = morton.LocateBlock( id );
+		if ( location.length ) {
+			ASSERT_GT( location.offset, last );
+			last = location.offset;
+		}
+	}
+}
+
+TEST( test_lvdwr, read_all )
+{
+	using namespace vm;
+	const Vec3i dataSize{ 141, 97, 66 };
+	const char *rawFileName = "test_read_all.raw";
+	std::vector<unsigned char> raw( std::size_t( dataSize.x ) * dataSize.y * dataSize.z );
+	for ( std::size_t i = 0; i < raw.size(); i++ ) {
+		raw[ i ] = i / dataSize.x % dataSize.y < 30 ? 0 : ( i * 2654435761u ) >> 13;
+	}
+	{
+		std::ofstream out( rawFileName, std::ios::binary );
+		out.write( (const char *)raw.data(), raw.size() );
+	}
+	LVDConvertOptions options;
+	options.rawFileName = rawFileName;
+	options.dataSize = dataSize;
+	options.blockSideInLog = 5;
+	options.padding = 3;
+	options.lvdFileName = "test_read_all.lvd";
+	ASSERT_TRUE( ConvertRawToLVD( options ) );
+	options.lvdFileName = "test_read_all_morton.lvd";
+	options.flags |= LVD_FLAG_MORTON;
+	ASSERT_TRUE( ConvertRawToLVD( options ) );
+
+	for ( const auto name : { "test_read_all.lvd", "test_read_all_morton.lvd" } ) {
+		LVDFile lvd( name );
+		ASSERT_TRUE( lvd.Valid() );
+		ASSERT_LT( lvd.OccupiedBlockCount(), std::size_t( lvd.BlockCount() ) );
+		for ( const int threadCount : { 1, 4 } ) {
+			std::vector<unsigned char> all( raw.size(), 0xcd );
+			lvd.ReadAll( all.data(), 0, threadCount );
+			ASSERT_EQ( all, raw ) << name << " with " << threadCount << " threads";
+		}
+		ASSERT_EQ( ( lvd.ReadAll<uint16_t, 6>() ), nullptr );
+		const auto array = lvd.ReadAll<unsigned char, 6>();
+		ASSERT_NE( array, nullptr );
+		ASSERT_EQ( array->Width(), dataSize.x );
+		ASSERT_EQ( array->Depth(), dataSize.z );
+	}
+
+	// without padding the blocks are the bricks of the array
+	options.lvdFileName = "test_read_all_bricks.lvd";
+	options.padding = 0;
+	ASSERT_TRUE( ConvertRawToLVD( options ) );
+	LVDFile lvd( options.lvdFileName, true );
+	const auto array = lvd.ReadAll<unsigned char, 5>();
+	ASSERT_NE( array, nullptr );
+	for ( int z = 0; z < dataSize.z; z++ ) {
+		for ( int y = 0; y < dataSize.y; y++ ) {
+			for ( int x = 0; x < dataSize.x; x++ ) {
+				const auto brick = array->BlockData( x / 32, y / 32, z / 32 );
+				ASSERT_EQ( brick[ ( ( z % 32 ) * 32 + y % 32 ) * 32 + x % 32 ], raw[ ( std::size_t( z ) * dataSize.y + y ) * dataSize.x + x ] );
+			}
+		}
+	}
+}
+
+TEST( test_lvdwr, read_region )
+{
+	using namespace vm;
+	const Vec3i dataSize{ 120, 90, 70 };
+	const char *fileName = "test_read_region.lvd";
+	std::vector<uint16_t> volume( std::size_t( dataSize.x ) * dataSize.y * dataSize.z );
+	for ( std::size_t i = 0; i < volume.size(); i++ ) {
+		volume[ i ] = uint16_t( i * 2654435761u >> 7 );
+	}
+	{
+		LVDFile writer( fileName, 5, dataSize, 2, LVD_VERSION_2, LVD_FLAG_SPARSE, LVD_VOXEL_UINT16 );
+		const int side = writer.BlockSize(), step = side - 4;
+		const auto blockDim = writer.SizeByBlock();
+		std::vector<uint16_t> block( writer.BlockDataCount() );
+		for ( std::size_t id = 0; id < writer.BlockCount(); id++ ) {
+			const int bx = id % blockDim.x, by = id / blockDim.x % blockDim.y, bz = id / ( blockDim.x * blockDim.y );
+			for ( int z = 0; z < side; z++ )
+				for ( int y = 0; y < side; y++ )
+					for ( int x = 0; x < side; x++ ) {
+						const int gx = bx * step + x - 2, gy = by * step + y - 2, gz = bz * step + z - 2;
+						const bool inside = gx >= 0 && gy >= 0 && gz >= 0 && gx < dataSize.x && gy < dataSize.y && gz < dataSize.z;
+						block[ ( std::size_t( z ) * side + y ) * side + x ] = inside ? volume[ ( std::size_t( gz ) * dataSize.y + gy ) * dataSize.x + gx ] : 0;
+					}
+			writer.WriteBlock( (const char *)block.data(), id );
+		}
+	}
+	LVDFile lvd( fileName, true );
+	ASSERT_TRUE( lvd.Valid() );
+	const Bound3i bound{ Point3i( 13, 27, 5 ), Point3i( 101, 60, 69 ) };
+	const int w = bound.max.x - bound.min.x, h = bound.max.y - bound.min.y, d = bound.max.z - bound.min.z;
+	// rows padded to 100 voxels, the padding is left alone
+	const std::size_t rowStride = 100 * sizeof( uint16_t ), sliceStride = rowStride * h;
+	std::vector<uint16_t> region( sliceStride / sizeof( uint16_t ) * d, 0xabcd );
+	std::atomic<int> visited{ 0 };
+	ASSERT_TRUE( lvd.ReadRegion( bound, 0, region.data(), rowStride, sliceStride, 0, [ &visited ]( std::size_t ) { visited++; return true; } ) );
+	ASSERT_EQ( visited, 4 * 3 * 3 );  // only the blocks covering the region are looked at
+	for ( int z = 0; z < d; z++ )
+		for ( int y = 0; y < h; y++ )
+			for ( int x = 0; x < 100; x++ ) {
+				const auto v = region[ ( std::size_t( z ) * h + y ) * 100 + x ];
+				ASSERT_EQ( v, x < w ? volume[ ( std::size_t( z + bound.min.z ) * dataSize.y + y + bound.min.y ) * dataSize.x + x + bound.min.x ] : 0xabcd );
+			}
+	// tightly packed, a single voxel
+	uint16_t voxel = 0;
+	ASSERT_TRUE( lvd.ReadRegion( Bound3i{ Point3i( 119, 89, 69 ), Point3i( 120, 90, 70 ) }, 0, &voxel ) );
+	ASSERT_EQ( voxel, volume.back() );
+	ASSERT_FALSE( lvd.ReadRegion( Bound3i{ Point3i( 0, 0, 0 ), Point3i( 121, 10, 10 ) }, 0, region.data() ) );
+	ASSERT_FALSE( lvd.ReadRegion( Bound3i{ Point3i( 5, 0, 0 ), Point3i( 5, 10, 10 ) }, 0, region.data() ) );
+}
+
+TEST( test_lvdwr, sharded )
+{
+	using namespace vm;
+	const Vec3i dataSize{ 130, 100, 90 };
+	const char *rawFileName = "test_sharded.raw";
+	std::vector<unsigned char> raw( std::size_t( dataSize.x ) * dataSize.y * dataSize.z );
+	for ( std::size_t i = 0; i < raw.size(); i++ ) {
+		raw[ i ] = i % dataSize.x < 50 ? 0 : ( i * 2654435761u ) >> 13;
+	}
+	{
+		std::ofstream out( rawFileName, std::ios::binary );
+		out.write( (const char *)raw.data(), raw.size() );
+	}
+	LVDConvertOptions options;
+	options.rawFileName = rawFileName;
+	options.dataSize = dataSize;
+	options.blockSideInLog = 5;
+	options.padding = 2;
+	options.lvdFileName = "test_sharded_single.lvd";
+	ASSERT_TRUE( ConvertRawToLVD( options ) );
+	LVDFile single( options.lvdFileName );
+
+	options.shardCount = 3;
+	for ( const auto striping : { LVD_STRIPING_ROUND_ROBIN, LVD_STRIPING_MORTON_RANGE } ) {
+		options.striping = striping;
+		options.flags = LVD_FLAG_SPARSE | ( striping == LVD_STRIPING_MORTON_RANGE ? LVD_FLAG_MORTON : 0 );
+		options.lvdFileName = "test_sharded.lvds";
+		ASSERT_TRUE( ConvertRawToLVD( options ) );
+
+		auto sharded = std::make_shared<LVDShardedFile>( "test_sharded.lvds", true );
+		ASSERT_TRUE( sharded->Valid() );
+		ASSERT_EQ( sharded->ShardCount(), 3 );
+		ASSERT_EQ( sharded->Striping(), striping );
+		ASSERT_EQ( sharded->OccupiedBlockCount(), single.OccupiedBlockCount() );
+		std::vector<char> a( single.BlockBytes() ), b( single.BlockBytes() );
+		std::vector<std::size_t> perShard( 3 );
+		for ( std::size_t i = 0; i < single.BlockCount(); i++ ) {
+			const int shard = sharded->ShardOf( i );
+			perShard[ shard ]++;
+			for ( int s = 0; s < 3; s++ ) {
+				// a block is only stored in its own shard
+				ASSERT_TRUE( s == shard || sharded->Shard( s )->BlockOccupied( i ) == false );
+			}
+			single.ReadBlock( a.data(), i );
+			sharded->ReadBlock( b.data(), i );
+			ASSERT_EQ( a, b ) << "block " << i;
+		}
+		for ( const auto count : perShard ) {
+			ASSERT_GE( count, single.BlockCount() / 3 );
+		}
+
+		std::vector<unsigned char> all( raw.size(), 0xcd );
+		ASSERT_TRUE( sharded->ReadRegion( Bound3i{ Point3i( 0, 0, 0 ), Point3i( dataSize.x, dataSize.y, dataSize.z ) }, 0, all.data() ) );
+		ASSERT_EQ( all, raw );
+
+		LVDPageReader reader( sharded, LVD_PAGE_IO_PREAD, 4 );
+		std::vector<unsigned char> staging( single.BlockCount() * single.BlockBytes() );
+		std::vector<LVDPageRequest> requests( single.BlockCount() );
+		for ( std::size_t i = 0; i < requests.size(); i++ ) {
+			requests[ i ].pageID = i;
+			requests[ i ].buffer = staging.data() + i * single.BlockBytes();
+		}
+		reader.Submit( requests );
+		std::vector<LVDPageRequest> done;
+		while ( done.size() < requests.size() ) {
+			ASSERT_GT( reader.Collect( done, 1 ), 0 );
+		}
+		for ( const auto &r : done ) {
+			ASSERT_TRUE( r.ok );
+			single.ReadBlock( a.data(), r.pageID );
+			ASSERT_EQ( memcmp( r.buffer, a.data(), a.size() ), 0 ) << "block " << r.pageID;
+		}
+	}
+}
+
+TEST( test_lvdwr, raw_plugin )
+{
+	using namespace vm;
+	const Vec3i dataSize{ 200, 130, 70 };
+	const char *rawFileName = "test_raw_plugin.raw";
+	std::vector<unsigned char> raw( std::size_t( dataSize.x ) * dataSize.y * dataSize.z );
+	for ( std::size_t i = 0; i < raw.size(); i++ ) {
+		raw[ i ] = ( i * 2654435761u ) >> 13;
+	}
+	{
+		std::ofstream out( rawFileName, std::ios::binary );
+		out.write( (const char *)raw.data(), raw.size() );
+		RawJSONStruct sidecar;
+		sidecar.dataSize = { dataSize.x, dataSize.y, dataSize.z };
+		sidecar.type = "uint8";
+		std::ofstream json( std::string( rawFileName ) + ".json" );
+		vm::json::Writer writer;
+		writer.write( json, sidecar );
+	}
+	// the same blocks as a conversion with the block size and padding of the plugin
+	LVDConvertOptions options;
+	options.rawFileName = rawFileName;
+	options.dataSize = dataSize;
+	options.blockSideInLog = 6;
+	options.padding = 2;
+	options.lvdFileName = "test_raw_plugin.lvd";
+	ASSERT_TRUE( ConvertRawToLVD( options ) );
+	LVDFile lvd( options.lvdFileName );
+
+	PluginLoader::LoadPlugins( "plugins" );
+	Ref<I3DBlockFilePluginInterface> p = PluginLoader::GetPluginLoader()->CreatePlugin<I3DBlockFilePluginInterface>( ".raw" );
+	ASSERT_TRUE( p != nullptr );
+	p->Open( rawFileName );
+	ASSERT_EQ( p->GetPadding(), 2 );
+	ASSERT_EQ( p->Get3DPageSizeInLog(), 6 );
+	ASSERT_EQ( p->GetVirtualPageCount(), lvd.BlockCount() );
+	ASSERT_EQ( p->Get3DPageCount().x, lvd.SizeByBlock().x );
+	std::vector<char> expected( lvd.BlockBytes() );
+	// twice, the second time from the cache
+	for ( int pass = 0; pass < 2; pass++ ) {
+		for ( std::size_t i = 0; i < lvd.BlockCount(); i++ ) {
+			lvd.ReadBlock( expected.data(), i );
+			ASSERT_EQ( memcmp( p->GetPage( i ), expected.data(), expected.size() ), 0 ) << "block " << i;
+		}
+	}
+	ASSERT_EQ( p->GetPage( lvd.BlockCount() ), nullptr );
+	p->Close();
+}
+
+TEST( test_lvdwr, large_offsets )
+{
+	using namespace vm;
+	{
+		// revision 1 keeps the dimensions in 64 bits
+		LVDFileHeader header;
+		header.magicNum = LVD_MAGIC_NUMBER_V2;
+		header.dataDim[ 0 ] = ( uint64_t( 1 ) << 33 ) + 128;
+		header.dataDim[ 1 ] = header.dataDim[ 2 ] = 128;
+		header.originalDataDim[ 0 ] = ( uint64_t( 1 ) << 33 ) + 100;
+		header.originalDataDim[ 1 ] = header.originalDataDim[ 2 ] = 100;
+		header.blockLengthInLog = 7;
+		header.padding = 1;
+		header.version = LVD_VERSION_2;
+		LVDFileHeader decoded;
+		decoded.Decode( header.Encode() );
+		ASSERT_EQ( decoded.revision, LVD_HEADER_REVISION );
+		ASSERT_EQ( decoded.dataDim[ 0 ], header.dataDim[ 0 ] );
+		ASSERT_EQ( decoded.originalDataDim[ 0 ], header.originalDataDim[ 0 ] );
+		ASSERT_EQ( decoded.dataDim[ 1 ], 128 );
+	}
+
+	// a v1 level and the second level of a v2 container both lie past 4 GiB. The files are sparse
+	// on disk, only the written blocks take space.
+	const Vec3i big{ 1760, 1760, 1760 };  // 14^3 blocks of 128^3, 5.75 GB raw
+	const char *v1FileName = "test_large_offsets_v1.lvd", *v2FileName = "test_large_offsets.lvd";
+	auto fill = []( std::vector<char> &block, std::size_t id ) {
+		for ( size_t j = 0; j < block.size(); j++ ) block[ j ] = char( ( id * 31 + j * 2654435761u ) >> 7 );
+	};
+	std::vector<char> block( std::size_t( 1 ) << 21 );
+	{
+		LVDFile v1( v1FileName, 7, big, 1, LVD_VERSION_1 );
+		LVDFile v2( v2FileName, 7, std::vector<Vec3i>{ big, Vec3i{ 200, 200, 200 } }, 1, LVD_VERSION_2 );
+		ASSERT_TRUE( v1.Valid() && v2.Valid() );
+		for ( std::size_t id : { std::size_t( 0 ), v1.BlockCount() - 1 } ) {
+			fill( block, id );
+			v1.WriteBlock( block.data(), id );
+			v2.WriteBlock( block.data(), id );
+		}
+		for ( std::size_t id = 0; id < v2.BlockCount( 1 ); id++ ) {
+			fill( block, id );
+			v2.WriteBlock( block.data(), id, 1 );
+		}
+	}
+	auto v1 = std::make_shared<LVDFile>( v1FileName, true );
+	auto v2 = std::make_shared<LVDFile>( v2FileName, true );
+	ASSERT_GT( v1->LocateBlock( v1->BlockCount() - 1 ).offset, uint64_t( 4 ) << 30 );
+	ASSERT_GT( v2->LocateBlock( 0, 1 ).offset, uint64_t( 4 ) << 30 );
+
+	std::vector<char> expected( block.size() );
+	auto check = [ & ]( LVDFile &file, std::size_t id, int lod ) {
+		fill( expected, id );
+		file.ReadBlock( block.data(), id, lod );
+		return block == expected;
+	};
+	for ( bool direct : { false, true } ) {
+		v1->SetDirectIO( direct );
+		v2->SetDirectIO( direct );
+		ASSERT_TRUE( check( *v1, v1->BlockCount() - 1, 0 ) );
+		ASSERT_TRUE( check( *v2, v2->BlockCount() - 1, 0 ) );
+		for ( std::size_t id = 0; id < v2->BlockCount( 1 ); id++ ) {
+			ASSERT_TRUE( check( *v2, id, 1 ) ) << "block " << id;
+		}
+	}
+	v1->SetDirectIO( false );
+	for ( auto mode : { LVD_PAGE_IO_PREAD, LVD_PAGE_IO_URING } ) {
+		LVDPageReader reader( v2, mode, 2 );
+		std::vector<LVDPageRequest> requests( v2->BlockCount( 1 ) );
+		std::vector<std::vector<char>> buffers( requests.size(), std::vector<char>( block.size() ) );
+		for ( std::size_t i = 0; i < requests.size(); i++ ) {
+			requests[ i ].pageID = i;
+			requests[ i ].lod = 1;
+			requests[ i ].buffer = buffers[ i ].data();
+		}
+		reader.Submit( requests );
+		std::vector<LVDPageRequest> done;
+		while ( done.size() < requests.size() ) {
+			ASSERT_GT( reader.Collect( done, 1 ), 0 );
+		}
+		for ( const auto &r : done ) {
+			ASSERT_TRUE( r.ok );
+			fill( expected, r.pageID );
+			ASSERT_EQ( memcmp( r.buffer, expected.data(), expected.size() ), 0 ) << "block " << r.pageID;
+		}
+	}
+}
+
+TEST( test_lvdwr, dedup )
+{
+	using namespace vm;
+	const char *fileName = "test_dedup.lvd";
+	const Vec3i dataSize{ 112, 112, 112 };	// 4^3 blocks of 32^3 with padding 2
+	auto fill = []( std::vector<char> &block, int kind, std::size_t id ) {
+		for ( size_t j = 0; j < block.size(); j++ ) {
+			block[ j ] = kind == 0 ? 0 : kind == 1 ? char( j * 7 ) : kind == 2 ? char( ( j * 13 ) ^ 0x5a ) : char( ( id * 31 + j * 2654435761u ) >> 7 );
+		}
+	};
+	// every fourth block is zero, the others are one of two repeated blocks or unique
+	std::vector<int> kinds;
+	std::vector<char> block( std::size_t( 1 ) << 15 );
+	{
+		LVDFile lvd( fileName, 5, dataSize, 2, LVD_VERSION_2, LVD_FLAG_SPARSE | LVD_FLAG_DEDUP );
+		ASSERT_TRUE( lvd.Valid() );
+		for ( std::size_t id = 0; id < lvd.BlockCount(); id++ ) {
+			kinds.push_back( id % 4 );
+			fill( block, kinds.back(), id );
+			lvd.WriteBlock( block.data(), id );
+		}
+		// a shared extent is not rewritten in place, its other blocks keep their voxels
+		fill( block, 3, 1 );
+		lvd.WriteBlock( block.data(), 1 );
+		kinds[ 1 ] = 3;
+		fill( block, 1, 2 );
+		lvd.WriteBlock( block.data(), 2 );
+		kinds[ 2 ] = 1;
+	}
+	std::vector<char> expected( block.size() );
+	auto check = [ & ]( LVDFile &lvd ) {
+		std::size_t firstOf[ 3 ] = { SIZE_MAX, SIZE_MAX, SIZE_MAX };
+		for ( std::size_t id = 0; id < lvd.BlockCount(); id++ ) {
+			fill( expected, kinds[ id ], id );
+			lvd.ReadBlock( block.data(), id );
+			ASSERT_EQ( block, expected ) << "block " << id;
+			if ( kinds[ id ] == 3 ) {
+				ASSERT_EQ( lvd.BlockInstance( id ), id );
+				continue;
+			}
+			if ( firstOf[ kinds[ id ] ] == SIZE_MAX ) {
+				firstOf[ kinds[ id ] ] = id;
+			}
+			ASSERT_EQ( lvd.BlockInstance( id ), firstOf[ kinds[ id ] ] ) << "block " << id;
+			ASSERT_EQ( lvd.LocateBlock( id ).offset, lvd.LocateBlock( firstOf[ kinds[ id ] ] ).offset );
+		}
+	};
+	{
+		LVDFile lvd( fileName, true );
+		ASSERT_TRUE( lvd.GetHeader().flags & LVD_FLAG_DEDUP );
+		check( lvd );
+		// the repeated blocks are stored once
+		std::set<uint64_t> extents;
+		for ( std::size_t id = 0; id < lvd.BlockCount(); id++ ) {
+			if ( lvd.BlockOccupied( id ) ) {
+				extents.insert( lvd.LocateBlock( id ).offset );
+			}
+		}
+		ASSERT_EQ( extents.size(), std::count( kinds.begin(), kinds.end(), 3 ) + 2 );
+	}
+	{
+		// the index is rebuilt when the file is opened again, equal blocks of a finalized level are shared
+		LVDFile lvd( fileName );
+		fill( block, 2, 7 );
+		lvd.WriteBlock( block.data(), 7 );
+		kinds[ 7 ] = 2;
+		fill( block, 3, 5 );
+		ASSERT_THROW( lvd.WriteBlock( block.data(), 5 ), std::runtime_error );
+	}
+	LVDFile lvd( fileName, true );
+	check( lvd );
+}
+
+TEST( test_lvdwr, series )
+{
+	using namespace vm;
+	const char *manifestName = "test_series.lvdt";
+	const Vec3i dataSize{ 112, 112, 84 };  // 4x4x3 blocks of 32^3 with padding 2
+	const int timestepCount = 5;
+	// every timestep changes the blocks id % 5 == t of the first one, timestep 1 also zeroes block 3
+	auto kind = []( int t, std::size_t id ) { return id % 5 == std::size_t( t ) || ( t == 1 && id == 3 ) ? t : 0; };
+	auto fill = [ & ]( std::vector<char> &block, int t, std::size_t id ) {
+		const int k = kind( t, id );
+		for ( size_t j = 0; j < block.size(); j++ ) {
+			block[ j ] = t == 1 && id == 3 ? 0 : char( ( id * 31 + k * 17 + j * 2654435761u ) >> 7 );
+		}
+	};
+	std::vector<char> block( std::size_t( 1 ) << 15 );
+	{
+		LVDSeriesFile series( manifestName, 3, 5, dataSize, 2 );
+		ASSERT_TRUE( series.Valid() );
+		for ( int t = 0; t < timestepCount; t++ ) {
+			ASSERT_EQ( series.AppendTimestep(), t );
+			for ( std::size_t id = 0; id < series.BlockCount(); id++ ) {
+				fill( block, t, id );
+				series.WriteBlock( block.data(), id );
+			}
+		}
+	}
+
+	auto series = std::make_shared<LVDSeriesFile>( manifestName );
+	ASSERT_TRUE( series->Valid() );
+	ASSERT_EQ( series->TimestepCount(), timestepCount );
+	const std::size_t blockCount = series->BlockCount();
+	std::vector<char> expected( block.size() );
+	for ( int t = 0; t < timestepCount; t++ ) {
+		ASSERT_EQ( series->KeyframeOf( t ), t < 3 ? 0 : 3 );
+		if ( t != series->KeyframeOf( t ) ) {
+			// a delta only stores the blocks changed since the keyframe
+			std::size_t changed = 0;
+			for ( std::size_t id = 0; id < blockCount; id++ ) {
+				fill( block, t, id );
+				fill( expected, series->KeyframeOf( t ), id );
+				changed += block != expected;
+			}
+			ASSERT_EQ( series->Timestep( t )->OccupiedBlockCount(), changed );
+		}
+		ASSERT_TRUE( series->SetTimestep( t ) );
+		for ( std::size_t id = 0; id < blockCount; id++ ) {
+			fill( expected, t, id );
+			series->ReadBlock( block.data(), id );
+			ASSERT_EQ( block, expected ) << "timestep " << t << " block " << id;
+		}
+	}
+	// the blocks differing between two timesteps are all reported
+	for ( int from = 0; from < timestepCount; from++ ) {
+		for ( int to = 0; to < timestepCount; to++ ) {
+			const auto changed = series->ChangedBlocks( from, to );
+			for ( std::size_t id = 0; id < blockCount; id++ ) {
+				fill( block, from, id );
+				fill( expected, to, id );
+				if ( block != expected ) {
+					ASSERT_TRUE( std::binary_search( changed.begin(), changed.end(), id ) ) << from << " -> " << to << " block " << id;
+				}
+			}
+		}
+	}
+	ASSERT_LT( series->ChangedBlocks( 1, 2 ).size(), blockCount / 2 );
+	ASSERT_EQ( series->ChangedBlocks( 2, 3 ).size(), blockCount );
+
+	// the plugin serves the current timestep to the page reads and the region reads
+	Ref<I3DBlockFilePluginInterface> p = PluginLoader::GetPluginLoader()->CreatePlugin<I3DBlockFilePluginInterface>( ".lvdt" );
+	auto lvd = dynamic_cast<ILVDFilePluginInterface *>( p.Get() );
+	ASSERT_NE( lvd, nullptr );
+	lvd->Open( manifestName );
+	ASSERT_EQ( lvd->GetTimestepCount(), timestepCount );
+	auto view = lvd->GetLODView( 0 );
+	ASSERT_TRUE( lvd->SetTimestep( 4 ) );
+	ASSERT_EQ( dynamic_cast<ILVDFilePluginInterface *>( view.Get() )->GetTimestep(), 4 );
+	ASSERT_EQ( lvd->GetChangedPages( 3, 4, 0 ).size(), series->ChangedBlocks( 3, 4 ).size() );
+	std::vector<unsigned char> staging( blockCount * block.size() );
+	std::vector<LVDPageRequest> requests( blockCount );
+	for ( std::size_t i = 0; i < blockCount; i++ ) {
+		requests[ i ].pageID = i;
+		requests[ i ].buffer = staging.data() + i * block.size();
+	}
+	lvd->SubmitPages( requests );
+	std::vector<LVDPageRequest> done;
+	while ( done.size() < requests.size() ) {
+		ASSERT_GT( lvd->CollectPages( done, 1 ), 0 );
+	}
+	for ( const auto &r : done ) {
+		ASSERT_TRUE( r.ok );
+		fill( expected, 4, r.pageID );
+		ASSERT_EQ( memcmp( r.buffer, expected.data(), expected.size() ), 0 ) << "block " << r.pageID;
+		ASSERT_EQ( memcmp( view->GetPage( r.pageID ), expected.data(), expected.size() ), 0 ) << "block " << r.pageID;
+	}
+	ASSERT_TRUE( lvd->SetTimestep( 1 ) );
+	const int step = 28;
+	std::vector<unsigned char> region( std::size_t( dataSize.x ) * dataSize.y * dataSize.z );
+	ASSERT_TRUE( lvd->ReadRegion( Bound3i{ Point3i( 0, 0, 0 ), Point3i( dataSize.x, dataSize.y, dataSize.z ) }, 0, region.data(), 0, 0 ) );
+	for ( std::size_t id = 0; id < blockCount; id++ ) {
+		fill( expected, 1, id );
+		const int bx = id % 4, by = id / 4 % 4, bz = id / 16;
+		const auto voxel = ( ( std::size_t( bz * step ) * dataSize.y + by * step ) * dataSize.x + bx * step );
+		ASSERT_EQ( char( region[ voxel ] ), expected[ ( 2 * 32 + 2 ) * 32 + 2 ] ) << "block " << id;
+	}
+}